@@ -1,124 +1,274 @@
 // The main ray tracer.
 
-#include <Fl/fl_ask.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
 
 #include "RayTracer.h"
 #include "scene/light.h"
 #include "scene/material.h"
 #include "scene/ray.h"
+#include "scene/packet.h"
+#include "scene/counters.h"
 #include "fileio/read.h"
 #include "fileio/parse.h"
-#include "ui/TraceUI.h"
 #include "fileio/bitmap.h"
 
-extern TraceUI* traceUI;
+// The medium rays start in.  It is never the material of anything they
+// hit, so it never gets popped.
+static const Medium AIR = { NULL, 1.0 };
+
+// A reflected or transmitted ray waiting in shadeHit()'s list.  For a
+// transmission only the hit it comes from is known; which way it bends
+// depends on the media stack as it stands once the reflection at the
+// same hit, and everything that leads to, has been traced.
+struct PendingRay
+{
+	enum Kind
+	{
+		TRACE,		// trace the ray (p, d)
+		REFRACT		// bend the ray (p, d) where it hit at t, with normal N
+	};
+
+	Kind kind;
+	vec3f p;
+	vec3f d;
+	vec3f thresh;		// product of the kr and kt of the hits on the way
+	int depth;
+	double intensity;
+
+	// for REFRACT, the hit
+	double t;
+	vec3f N;
+	const Material *material;	// to tell whether the ray is leaving it
+	double index;
+};
+
+// What shadeHit() works with, kept for each thread from pixel to pixel so
+// that it's made once rather than on every hit: the media stack stops
+// allocating once it has grown to what the scene needs.
+struct TraceState
+{
+	MediaStack mediaStack;
+
+	// every hit above the one being shaded leaves at most its
+	// transmission behind, and that one adds two more
+	PendingRay pending[ MAX_TRACE_DEPTH + 2 ];
+};
+
+static TraceState& threadTraceState()
+{
+	static thread_local TraceState state;
+	return state;
+}
 
 // Trace a top-level ray through normalized window coordinates (x,y)
 // through the projection plane, and out into the scene.  All we do is
 // enter the main ray-tracing method, getting things started by plugging
 // in an initial ray weight of (0.0,0.0,0.0) and an initial recursion depth of 0.
-vec3f RayTracer::trace( Scene *scene, double x, double y )
+// If hitObj is given, the object the ray hit first goes there, NULL if
+// it hit nothing.
+vec3f RayTracer::trace( Scene *scene, double x, double y, const SceneObject **hitObj )
 {
     ray r( vec3f(0,0,0), vec3f(0,0,0) );
     scene->getCamera()->rayThrough( x,y,r );
-	mediaStack = std::stack<const Material*>();
-	Material air;
-	mediaStack.push(&air);
-	return traceRay( scene, r, vec3f(1.0,1.0,1.0), 0 ).clamp();
+	RAY_COUNT( primaryRays, 1 );
+
+	vec3f col = traceRay( scene, r, hitObj );
+	return options.hdr ? col : col.clamp();
 }
 
-// Do recursive ray tracing!  You'll want to insert a lot of code here
-// (or places called from here) to handle reflection, refraction, etc etc.
-vec3f RayTracer::traceRay( Scene *scene, const ray& r, 
-	const vec3f& thresh, int depth, double intensity )
+// The colour seen along r, reflections and transmissions included.  If
+// hitObj is given, the object r hit first goes there, NULL if it hit
+// nothing.
+vec3f RayTracer::traceRay( Scene *scene, const ray& r, const SceneObject **hitObj )
 {
 	isect i;
+	vec3f col;
+	if( scene->intersect( r, i ) )
+		col = shadeHit( scene, r, i, NULL );
+	else
+		col = missColor( scene, r );
 
-	if( scene->intersect( r, i ) ) {
+	if( hitObj )
+		*hitObj = i.obj;
+	return col;
+}
 
-		const Material& m = i.getMaterial();
-		vec3f shade = m.shade(scene, r, i);
-		
-		const vec3f result(shade[0] * thresh[0], shade[1] * thresh[1], shade[2] * thresh[2]);
+// Color of the hit i of ray r, including whatever is reflected and
+// transmitted there.  traced is passed on to Material::shade for this hit.
+//
+// The reflected and transmitted rays are followed from a fixed list rather
+// than by recursion: depth first, reflection before transmission, as the
+// recursion went, so the media stack sees the same pushes in the same
+// order.  Each hit adds its shade straight to the total, weighted as the
+// recursion would have weighted it on the way back up.
+vec3f RayTracer::shadeHit( Scene *scene, const ray& r, const isect& i, const TracedLights *traced )
+{
+	TraceState& state = threadTraceState();
+	MediaStack& mediaStack = state.mediaStack;
+	mediaStack.clear();
+	mediaStack.push_back( AIR );
 
-		vec3f reflection;
-		vec3f transmission;
-		if (depth < traceUI->getDepth()	&& (traceUI->m_intThreshSlider->value() == 0 || intensity > traceUI->m_intThreshSlider->value()))
-		{
-			//handle reflection
-			if (!m.kr.iszero())
-			{
-				vec3f rDir = ((2.0 * (i.N.dot(-r.getDirection())) * i.N) - (-r.getDirection())).normalize();
-				vec3f rPoint = r.at(i.t) + i.N * RAY_EPSILON;
-				ray reflectedRay = ray(rPoint, rDir);
-				const vec3f next_thresh(thresh[0] * m.kr[0], thresh[1] * m.kr[1], thresh[2] * m.kr[2]);
-				reflection = prod(m.kr, traceRay(scene, reflectedRay, next_thresh, depth + 1, m.kr.length() * intensity));
-			}
+	PendingRay *pending = state.pending;
+	int count = 0;
 
-			//handle refraction
-			if (!m.kt.iszero())
-			{
-				const Material* currMat = mediaStack.top();
-				double ni, nt;
-				vec3f point, normal;
-				if (currMat == &m) {
-					mediaStack.pop();
-					const Material *outside = mediaStack.top();
-					mediaStack.push(currMat);
-					ni = m.index;
-					nt = outside->index;
-					normal = -i.N;
-				}
-				else {
-					ni = currMat->index;
-					nt = m.index;
-					normal = i.N;
-				}
+	vec3f col;
+	addHit( scene, r, i, traced, vec3f(1.0,1.0,1.0), 0, 1.0, col, pending, count );
 
-				const double nr = ni / nt;
-				const double ndotr = normal.dot(-r.getDirection());
-				point = r.at(i.t) - normal * RAY_EPSILON;
-				double cos_i = max(min(normal * ((-r.getDirection()).normalize()), 1.0), -1.0); //SYSNOTE: min(x, 1.0) to prevent cos_i becomes bigger than 1
-				double sin_i = sqrt(1 - cos_i * cos_i);
-				double sin_t = sin_i * nr;
-
-				if (sin_t <= 1.0) {
-					mediaStack.push(&m);
-					double cos_t = sqrt(1 - sin_t*sin_t);
-					vec3f tDir = (nr * cos_i - cos_t) * normal - nr * (-r.getDirection());
-					ray transmittedRay = ray(r.at(i.t), tDir);
-					const vec3f next_thresh(thresh[0] * m.kt[0], thresh[1] * m.kt[1], thresh[2] * m.kt[2]);
-					transmission = prod(m.kt, traceRay(scene, transmittedRay, next_thresh, depth + 1, m.kt.length() * intensity));
-				}
-			}
+	while( count > 0 ) {
+		// a copy, as the rays it makes may take its place
+		const PendingRay p = pending[ --count ];
+
+		if( p.kind == PendingRay::REFRACT ) {
+			refract( p, mediaStack, pending, count );
+			continue;
 		}
 
-		return result + reflection + transmission;
+		ray next( p.p, p.d );
+		isect hit;
+		if( scene->intersect( next, hit ) )
+			addHit( scene, next, hit, NULL, p.thresh, p.depth, p.intensity, col, pending, count );
+		else
+			col += prod( p.thresh, missColor( scene, next ) );
 	}
-	else
-		if (useBackground)
+
+	return col;
+}
+
+// Add the shade of hit i of ray r to col and queue the rays reflected and
+// transmitted there.  thresh is the product of the kr and kt of the hits
+// that led to r; the shade is scaled by it twice, once where it's worked
+// out and once more on the way back to the eye.
+void RayTracer::addHit( Scene *scene, const ray& r, const isect& i, const TracedLights *traced,
+	const vec3f& thresh, int depth, double intensity, vec3f& col, PendingRay *pending, int& count )
+{
+	const Material& m = i.getMaterial();
+	vec3f shade = m.shade(scene, r, i, traced);
+	
+	const vec3f result(shade[0] * thresh[0], shade[1] * thresh[1], shade[2] * thresh[2]);
+	col += prod( thresh, result );
+
+	if (depth < options.depth && (options.threshold == 0 || intensity > options.threshold))
+	{
+		// the transmission goes under the reflection, to come after it
+		if (!m.kt.iszero())
 		{
-			vec3f x = scene->getCamera()->getU();
-			vec3f y = scene->getCamera()->getV();
-			vec3f z = scene->getCamera()->getLook();
-			double dis_x = r.getDirection() * x;
-			double dis_y = r.getDirection() * y;
-			double dis_z = r.getDirection() * z;
-			return getBackgroundImage(dis_x / dis_z + 0.5, dis_y / dis_z + 0.5);
+			PendingRay& t = pending[ count++ ];
+			t.kind = PendingRay::REFRACT;
+			t.p = r.getPosition();
+			t.d = r.getDirection();
+			t.thresh = vec3f(thresh[0] * m.kt[0], thresh[1] * m.kt[1], thresh[2] * m.kt[2]);
+			t.depth = depth + 1;
+			t.intensity = m.kt.length() * intensity;
+			t.t = i.t;
+			t.N = i.N;
+			// a material interpolated over the object lives in i, so the
+			// object's own stands for it
+			t.material = &i.obj->getMaterial();
+			t.index = m.index;
 		}
-		else
+
+		//handle reflection
+		if (!m.kr.iszero())
 		{
-			return vec3f(0.0, 0.0, 0.0);
+			vec3f rDir = ((2.0 * (i.N.dot(-r.getDirection())) * i.N) - (-r.getDirection())).normalize();
+			vec3f rPoint = r.at(i.t) + i.N * RAY_EPSILON;
+			RAY_COUNT( reflectedRays, 1 );
+
+			PendingRay& reflected = pending[ count++ ];
+			reflected.kind = PendingRay::TRACE;
+			reflected.p = rPoint;
+			reflected.d = rDir;
+			reflected.thresh = vec3f(thresh[0] * m.kr[0], thresh[1] * m.kr[1], thresh[2] * m.kr[2]);
+			reflected.depth = depth + 1;
+			reflected.intensity = m.kr.length() * intensity;
 		}
+	}
+}
+
+// Work out which way the transmission p bends, going by the media the ray
+// is in, and queue the transmitted ray unless it's totally reflected.
+void RayTracer::refract( const PendingRay& p, MediaStack& mediaStack, PendingRay *pending, int& count )
+{
+	const ray r( p.p, p.d );
+	const Medium curr = mediaStack.back();
+	double ni, nt;
+	vec3f point, normal;
+	if (curr.material == p.material) {
+		mediaStack.pop_back();
+		const Medium outside = mediaStack.back();
+		mediaStack.push_back(curr);
+		ni = p.index;
+		nt = outside.index;
+		normal = -p.N;
+	}
+	else {
+		ni = curr.index;
+		nt = p.index;
+		normal = p.N;
+	}
+
+	const double nr = ni / nt;
+	point = r.at(p.t) - normal * RAY_EPSILON;
+	double cos_i = max(min(normal * ((-r.getDirection()).normalize()), 1.0), -1.0); //SYSNOTE: min(x, 1.0) to prevent cos_i becomes bigger than 1
+	double sin_i = sqrt(1 - cos_i * cos_i);
+	double sin_t = sin_i * nr;
+
+	if (sin_t <= 1.0) {
+		const Medium entered = { p.material, p.index };
+		mediaStack.push_back(entered);
+		double cos_t = sqrt(1 - sin_t*sin_t);
+		vec3f tDir = (nr * cos_i - cos_t) * normal - nr * (-r.getDirection());
+		RAY_COUNT( refractedRays, 1 );
+
+		PendingRay& transmitted = pending[ count++ ];
+		transmitted.kind = PendingRay::TRACE;
+		transmitted.p = r.at(p.t);
+		transmitted.d = tDir;
+		transmitted.thresh = p.thresh;
+		transmitted.depth = p.depth;
+		transmitted.intensity = p.intensity;
+	}
+}
+
+// Color seen along a ray that hits nothing.
+vec3f RayTracer::missColor( Scene *scene, const ray& r )
+{
+	if (useBackground)
+	{
+		vec3f x = scene->getCamera()->getU();
+		vec3f y = scene->getCamera()->getV();
+		vec3f z = scene->getCamera()->getLook();
+		double dis_x = r.getDirection() * x;
+		double dis_y = r.getDirection() * y;
+		double dis_z = r.getDirection() * z;
+		return getBackgroundImage(dis_x / dis_z + 0.5, dis_y / dis_z + 0.5);
+	}
+	else
+	{
+		return vec3f(0.0, 0.0, 0.0);
+	}
 }
 
 RayTracer::RayTracer()
 {
 	buffer = NULL;
 	buffer_width = buffer_height = 256;
+	bufferY0 = bufferRows = 0;
 	scene = NULL;
+	useBackground = false;
+	backgroundImage = NULL;
+	background_width = background_height = 0;
 
 	m_bSceneLoaded = false;
+	stopRequested = false;
+	pixelsTraced = 0;
+	pixelsToTrace = 0;
+	loadSeconds = 0.0;
 }
 
 
@@ -147,24 +297,29 @@ bool RayTracer::sceneLoaded()
 
 bool RayTracer::loadScene( char* fn )
 {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 	try
 	{
-		scene = readScene( fn );
+		loadError.clear();
+		scene = readScene( fn, options );
 	}
 	catch( ParseError pe )
 	{
-		fl_alert( "ParseError: %s\n", pe );
+		loadError = pe.getMsg();
 		return false;
 	}
 
 	if( !scene )
 		return false;
+	loadSeconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
 	
 	buffer_width = 256;
 	buffer_height = (int)(buffer_width / scene->getCamera()->getAspectRatio() + 0.5);
 
 	bufferSize = buffer_width * buffer_height * 3;
 	buffer = new unsigned char[ bufferSize ];
+	bufferY0 = 0;
+	bufferRows = buffer_height;
 	
 	// separate objects into bounded and unbounded
 	scene->initScene();
@@ -178,16 +333,68 @@ bool RayTracer::loadScene( char* fn )
 
 void RayTracer::traceSetup( int w, int h )
 {
-	if( buffer_width != w || buffer_height != h )
-	{
-		buffer_width = w;
-		buffer_height = h;
+	traceStripSetup( w, h, h );
+}
 
-		bufferSize = buffer_width * buffer_height * 3;
+// Set up to render a w x h image a strip of rows at a time with
+// traceStrip(), holding no more than those rows in memory.
+void RayTracer::traceStripSetup( int w, int h, int rows )
+{
+	if( rows > h )
+		rows = h;
+
+	if( buffer_width != w || bufferRows != rows )
+	{
+		bufferSize = w * rows * 3;
 		delete [] buffer;
 		buffer = new unsigned char[ bufferSize ];
 	}
-	memset( buffer, 0, w*h*3 );
+	buffer_width = w;
+	buffer_height = h;
+	bufferY0 = 0;
+	bufferRows = rows;
+	memset( buffer, 0, bufferSize );
+
+	if( options.costMeasure != COST_NONE )
+		costs.assign( w * rows, 0.0f );
+	else
+		costs.clear();
+
+	if( options.hdr )
+		hdrBuffer.assign( w * rows * 3, 0.0f );
+	else
+		hdrBuffer.clear();
+
+	if( scene )
+		scene->setLightCutoff( options.lightCutoff );
+
+	stopRequested = false;
+	pixelsTraced = 0;
+	pixelsToTrace = w * h;
+}
+
+// Render the strip of rows starting at y0 into the buffer, on a pool of
+// threads as traceTiles() does.
+void RayTracer::traceStrip( int y0, int threads )
+{
+	bufferY0 = y0;
+	memset( buffer, 0, bufferSize );
+	if( !costs.empty() )
+		std::fill( costs.begin(), costs.end(), 0.0f );
+	if( !hdrBuffer.empty() )
+		std::fill( hdrBuffer.begin(), hdrBuffer.end(), 0.0f );
+
+	// the rows before are done, whether in this run or an earlier one
+	pixelsTraced = y0 * buffer_width;
+	traceTiles( threads );
+}
+
+// The rows the buffer holds: rows of them from y0 up.
+const unsigned char *RayTracer::getStrip( int &y0, int &rows ) const
+{
+	y0 = bufferY0;
+	rows = bufferEnd() - bufferY0;
+	return buffer;
 }
 
 void RayTracer::traceLines( int start, int stop )
@@ -196,14 +403,448 @@ void RayTracer::traceLines( int start, int stop )
 	if( !scene )
 		return;
 
-	if( stop > buffer_height )
-		stop = buffer_height;
+	if( start < bufferY0 )
+		start = bufferY0;
+	if( stop > bufferEnd() )
+		stop = bufferEnd();
 
 	for( int j = start; j < stop; ++j )
 		for( int i = 0; i < buffer_width; ++i )
 			tracePixel(i,j);
 }
 
+// Render the image in tileSize x tileSize blocks on a pool of worker
+// threads.  threads <= 0 uses every hardware thread.
+void RayTracer::traceTiles( int threads, int tileSize )
+{
+	using namespace std::placeholders;
+	runTiles( threads, tileSize, std::bind( &RayTracer::traceTile, this, _1, _2, _3, _4 ) );
+}
+
+// Render the image in passes that get finer by halves, starting with one
+// traced pixel per coarsest x coarsest block and ending at every pixel.
+// Each pass only traces the pixels that no earlier one did and paints
+// them over the step x step block they stand for, so the whole render
+// costs one trace per pixel, the same as traceTiles().  With
+// anti-aliasing on, a last pass then renders the image again anti-aliased.
+// coarsest must be a power of two.
+void RayTracer::traceProgressive( int threads, int coarsest )
+{
+	using namespace std::placeholders;
+
+	bool antialias = options.aaSamples > 1;
+	pixelsToTrace = buffer_width * buffer_height * (antialias ? 2 : 1);
+
+	// tiles have to line up with the coarsest grid
+	int tileSize = max( 32, coarsest );
+	for( int step = coarsest; step >= 1 && !stopRequested; step /= 2 ) {
+		runTiles( threads, tileSize, std::bind( &RayTracer::traceBlocks, this, _1, _2, _3, _4,
+			step, step == coarsest ) );
+	}
+
+	if( antialias )
+		traceTiles( threads );
+}
+
+// Hand out tileSize x tileSize tiles of the image to a pool of worker
+// threads.  Each worker claims the next untraced tile until none are left
+// or stop() is called; tiles don't overlap, so the workers write straight
+// into buffer.
+void RayTracer::runTiles( int threads, int tileSize, const TileFunction& tile )
+{
+	if( !scene )
+		return;
+
+	if( threads <= 0 )
+		threads = std::thread::hardware_concurrency();
+	if( threads <= 0 )
+		threads = 1;
+
+	int tilesX = (buffer_width + tileSize - 1) / tileSize;
+	int tilesY = (bufferEnd() - bufferY0 + tileSize - 1) / tileSize;
+	int numTiles = tilesX * tilesY;
+	if( threads > numTiles )
+		threads = numTiles;
+
+	std::atomic<int> nextTile( 0 );
+	struct Worker
+	{
+		static void run( RayTracer *rt, const TileFunction *tile, std::atomic<int> *next,
+			int numTiles, int tilesX, int tileSize )
+		{
+			int t;
+			while( !rt->stopRequested && (t = (*next)++) < numTiles ) {
+				int x0 = (t % tilesX) * tileSize;
+				int y0 = rt->bufferY0 + (t / tilesX) * tileSize;
+				(*tile)( x0, y0, x0 + tileSize, y0 + tileSize );
+			}
+			flushCounters();
+		}
+	};
+
+	// the calling thread is the last worker
+	std::vector<std::thread> pool;
+	for( int k = 1; k < threads; ++k )
+		pool.push_back( std::thread( Worker::run, this, &tile, &nextTile, numTiles, tilesX, tileSize ) );
+	Worker::run( this, &tile, &nextTile, numTiles, tilesX, tileSize );
+
+	for( size_t k = 0; k < pool.size(); ++k )
+		pool[k].join();
+}
+
+double RayTracer::getProgress() const
+{
+	return pixelsToTrace > 0 ? double( pixelsTraced ) / pixelsToTrace : 1.0;
+}
+
+// Trace the pixels in columns [x0,x1) of rows [y0,y1), clipped to the buffer.
+void RayTracer::traceTile( int x0, int y0, int x1, int y1 )
+{
+	if( x1 > buffer_width )
+		x1 = buffer_width;
+	if( y1 > bufferEnd() )
+		y1 = bufferEnd();
+
+	if( options.aaSamples > 1 ) {
+		traceTileAA( x0, y0, x1, y1 );
+		pixelsTraced += (x1 - x0) * (y1 - y0);
+		return;
+	}
+
+	int packetSize = options.packetSize;
+	if( packetSize > 0 ) {
+		for( int j = y0; j < y1; j += packetSize )
+			for( int i = x0; i < x1; i += packetSize )
+				tracePacket( i, j, min( i + packetSize, x1 ), min( j + packetSize, y1 ) );
+	} else {
+		for( int j = y0; j < y1; ++j )
+			for( int i = x0; i < x1; ++i )
+				tracePixel(i,j);
+	}
+
+	pixelsTraced += (x1 - x0) * (y1 - y0);
+}
+
+// One tile of a traceProgressive() pass: trace the pixels of columns
+// [x0,x1) and rows [y0,y1) that lie on the grid of spacing step, leaving
+// out those on the grid twice as coarse unless this is the first pass,
+// and fill the step x step block below and to the right of each with its
+// colour.  x0 and y0 must be on the grid.
+void RayTracer::traceBlocks( int x0, int y0, int x1, int y1, int step, bool first )
+{
+	if( x1 > buffer_width )
+		x1 = buffer_width;
+	if( y1 > bufferEnd() )
+		y1 = bufferEnd();
+
+	int traced = 0;
+	for( int j = y0; j < y1; j += step ) {
+		for( int i = x0; i < x1; i += step ) {
+			if( !first && i % (2 * step) == 0 && j % (2 * step) == 0 )
+				continue;
+
+			tracePixel( i, j );
+			++traced;
+			if( step == 1 )
+				continue;
+
+			const unsigned char *pixel = pixelAt( i, j );
+			int width = min( step, x1 - i );
+			int height = min( step, y1 - j );
+			for( int v = 0; v < height; ++v ) {
+				unsigned char *row = pixelAt( i, j + v );
+				for( int u = 0; u < width; ++u, row += 3 ) {
+					row[0] = pixel[0];
+					row[1] = pixel[1];
+					row[2] = pixel[2];
+				}
+			}
+
+			if( hdrBuffer.empty() )
+				continue;
+			const float *hdrPixel = hdrPixelAt( i, j );
+			for( int v = 0; v < height; ++v ) {
+				float *row = hdrPixelAt( i, j + v );
+				for( int u = 0; u < width; ++u, row += 3 ) {
+					row[0] = hdrPixel[0];
+					row[1] = hdrPixel[1];
+					row[2] = hdrPixel[2];
+				}
+			}
+		}
+	}
+
+	pixelsTraced += traced;
+}
+
+// The lattice anti-aliasing refines pixels on: AA_GRID x AA_GRID cells,
+// which allows four levels of subdivision.
+static const int AA_GRID = 16;
+
+// A repeatable pseudo-random number in [-0.5, 0.5) for point (u,v) of
+// pixel (i,j), so that jittered samples come out the same however the
+// image is split between threads.
+static inline double jitter( int i, int j, int u, int v )
+{
+	unsigned int h = (unsigned int)i * 73856093u ^ (unsigned int)j * 19349663u
+		^ (unsigned int)u * 83492791u ^ (unsigned int)v * 2654435761u;
+	h ^= h >> 13;
+	h *= 0x5bd1e995u;
+	h ^= h >> 15;
+	return (h & 0xffffff) / double( 0x1000000 ) - 0.5;
+}
+
+// Do the samples at the corners of a cell call for a closer look?
+static bool samplesDiffer( const PixelSample *s[4], double threshold )
+{
+	for( int k = 1; k < 4; ++k )
+		if( s[k]->obj != s[0]->obj )
+			return true;
+
+	for( int c = 0; c < 3; ++c ) {
+		double lo = s[0]->color[c];
+		double hi = lo;
+		for( int k = 1; k < 4; ++k ) {
+			lo = min( lo, s[k]->color[c] );
+			hi = max( hi, s[k]->color[c] );
+		}
+		if( hi - lo > threshold )
+			return true;
+	}
+	return false;
+}
+
+// Sample the image at (x,y) in pixels.
+PixelSample RayTracer::sampleAt( double x, double y )
+{
+	PixelSample s;
+	s.color = trace( scene, x / double(buffer_width), y / double(buffer_height), &s.obj );
+	return s;
+}
+
+// Trace the pixels in columns [x0,x1) of rows [y0,y1), clipped by the
+// caller, with adaptive anti-aliasing.  The pixel corners are sampled
+// once for the whole tile, then each pixel is refined on its own.  Pixels
+// are centred where tracePixel() samples them, so a pixel's corners are
+// half a pixel either side of that.
+void RayTracer::traceTileAA( int x0, int y0, int x1, int y1 )
+{
+	int cornersX = x1 - x0 + 1;
+	int cornersY = y1 - y0 + 1;
+	vector<PixelSample> corners( cornersX * cornersY );
+	double before = costs.empty() ? 0.0 : costNow();
+	for( int j = 0; j < cornersY; ++j )
+		for( int i = 0; i < cornersX; ++i )
+			corners[ i + j * cornersX ] = sampleAt( x0 + i - 0.5, y0 + j - 0.5 );
+	if( !costs.empty() )
+		addCost( x0, y0, x1, y1, costNow() - before );
+
+	for( int j = y0; j < y1; ++j ) {
+		for( int i = x0; i < x1; ++i ) {
+			const PixelSample *c = &corners[ (i - x0) + (j - y0) * cornersX ];
+			before = costs.empty() ? 0.0 : costNow();
+			setPixel( i, j, antialiasPixel( i, j, c[0], c[1], c[cornersX], c[cornersX + 1] ) );
+			if( !costs.empty() )
+				addCost( i, j, i + 1, j + 1, costNow() - before );
+		}
+	}
+}
+
+// The colour of pixel (i,j) given the samples at its corners, top left
+// to bottom right.  The pixel is a cell of the lattice, and cells whose
+// corners differ are split in four, coarsest first, while the sample
+// budget lasts.  Samples that a split adds inside the pixel are jittered
+// by up to a quarter of the new spacing.  The result is the average of
+// each final cell's corners weighted by its area.
+vec3f RayTracer::antialiasPixel( int i, int j, const PixelSample& c00, const PixelSample& c10,
+	const PixelSample& c01, const PixelSample& c11 )
+{
+	const int N = AA_GRID;
+	PixelSample lattice[ N + 1 ][ N + 1 ];
+	bool have[ N + 1 ][ N + 1 ];
+	memset( have, 0, sizeof( have ) );
+
+	lattice[0][0] = c00;
+	lattice[0][N] = c10;
+	lattice[N][0] = c01;
+	lattice[N][N] = c11;
+	have[0][0] = have[0][N] = have[N][0] = have[N][N] = true;
+	int used = 4;
+
+	// cells waiting to be looked at, in the order they were made
+	struct Cell
+	{
+		int u, v, size;
+	};
+	Cell queue[ 1 + 4 + 16 + 64 + 256 ];
+	int head = 0;
+	int tail = 0;
+	queue[ tail ].u = 0;
+	queue[ tail ].v = 0;
+	queue[ tail ].size = N;
+	++tail;
+
+	vec3f sum;
+	while( head < tail ) {
+		Cell cell = queue[ head++ ];
+		int u = cell.u;
+		int v = cell.v;
+		int s = cell.size;
+		const PixelSample *c[4] = { &lattice[v][u], &lattice[v][u + s],
+			&lattice[v + s][u], &lattice[v + s][u + s] };
+
+		if( s > 1 && samplesDiffer( c, options.aaThreshold ) ) {
+			// the centre and the middles of the edges
+			int h = s / 2;
+			int points[5][2] = { { u + h, v }, { u, v + h }, { u + h, v + h },
+				{ u + s, v + h }, { u + h, v + s } };
+			int missing = 0;
+			for( int k = 0; k < 5; ++k )
+				missing += !have[ points[k][1] ][ points[k][0] ];
+
+			if( used + missing <= options.aaSamples ) {
+				for( int k = 0; k < 5; ++k ) {
+					int pu = points[k][0];
+					int pv = points[k][1];
+					if( have[pv][pu] )
+						continue;
+
+					double amount = 0.5 * h / N;
+					double x = double( pu ) / N + amount * jitter( i, j, pu, 2 * pv );
+					double y = double( pv ) / N + amount * jitter( i, j, 2 * pu + 1, pv );
+					x = min( max( x, 0.0 ), 1.0 );
+					y = min( max( y, 0.0 ), 1.0 );
+					lattice[pv][pu] = sampleAt( i - 0.5 + x, j - 0.5 + y );
+					have[pv][pu] = true;
+				}
+				used += missing;
+
+				for( int k = 0; k < 4; ++k ) {
+					queue[ tail ].u = u + (k & 1) * h;
+					queue[ tail ].v = v + (k >> 1) * h;
+					queue[ tail ].size = h;
+					++tail;
+				}
+				continue;
+			}
+		}
+
+		sum += (double( s * s ) / 4.0) * (c[0]->color + c[1]->color + c[2]->color + c[3]->color);
+	}
+
+	return sum / double( N * N );
+}
+
+// What tracePacket() works with, kept for each thread like TraceState: a
+// packet is costly to make, and the light terms would be allocated on
+// every call otherwise.
+struct PacketState
+{
+	RayPacket packet;
+	vector<LightTerm> terms;
+};
+
+static PacketState& threadPacketState()
+{
+	static thread_local PacketState state;
+	return state;
+}
+
+// Trace the pixels in columns [x0,x1) of rows [y0,y1), at most
+// MAX_PACKET_SIZE of them, with one packet of primary rays.  The light
+// terms at the primary hits are worked out once, and their shadow rays go
+// out as one packet per light, from the hits that light matters to;
+// reflection and refraction are traced ray by ray as usual.
+void RayTracer::tracePacket( int x0, int y0, int x1, int y1 )
+{
+	if( !scene )
+		return;
+
+	double before = costs.empty() ? 0.0 : costNow();
+	PacketState& state = threadPacketState();
+	RayPacket& packet = state.packet;
+	packet.clear();
+	ray r( vec3f(0,0,0), vec3f(0,0,0) );
+	for( int j = y0; j < y1; ++j ) {
+		for( int i = x0; i < x1; ++i ) {
+			double x = double(i)/double(buffer_width);
+			double y = double(j)/double(buffer_height);
+			scene->getCamera()->rayThrough( x,y,r );
+			packet.add( r.getPosition(), r.getDirection() );
+		}
+	}
+
+	RAY_COUNT( primaryRays, packet.count );
+	scene->intersect( packet );
+
+	// each hit's light terms, worked out once here and handed to
+	// Material::shade with their shadows filled in; hit h has
+	// terms[ first[h] ] up to terms[ first[h+1] ], in the scene's order
+	vector<LightTerm>& terms = state.terms;
+	terms.clear();
+	int first[ MAX_PACKET_SIZE + 1 ];
+	vec3f points[ MAX_PACKET_SIZE ];
+	int numHits = 0;
+	for( int k = 0; k < packet.count; ++k ) {
+		if( packet.hit[k] ) {
+			const isect& i = packet.isects[k];
+			ray pr = packet.getRay( k );
+			first[ numHits ] = (int)terms.size();
+			i.getMaterial().lightTerms( scene, pr, i, terms );
+			points[ numHits ] = pr.at( i.t ) + i.N * RAY_EPSILON;
+			++numHits;
+		}
+	}
+	first[ numHits ] = (int)terms.size();
+
+	if( !terms.empty() ) {
+		// next[h] is the first term of hit h not yet given its shadow
+		int next[ MAX_PACKET_SIZE ];
+		std::copy( first, first + numHits, next );
+		vec3f lit[ MAX_PACKET_SIZE ];
+		int which[ MAX_PACKET_SIZE ];
+		vec3f atten[ MAX_PACKET_SIZE ];
+		int l = 0;
+		for( Scene::cliter j = scene->beginLights(); j != scene->endLights(); ++j, ++l ) {
+			int numLit = 0;
+			for( int h = 0; h < numHits; ++h ) {
+				if( next[h] < first[h+1] && terms[ next[h] ].index == l ) {
+					lit[ numLit ] = points[h];
+					which[ numLit ] = next[h]++;
+					++numLit;
+				}
+			}
+			if( numLit == 0 )
+				continue;
+			(*j)->shadowAttenuationPacket( lit, numLit, atten );
+			for( int n = 0; n < numLit; ++n )
+				terms[ which[n] ].shadow = atten[n];
+		}
+	}
+
+	int k = 0;
+	int h = 0;
+	for( int j = y0; j < y1; ++j ) {
+		for( int i = x0; i < x1; ++i, ++k ) {
+			ray pr = packet.getRay( k );
+			vec3f col;
+			if( packet.hit[k] ) {
+				TracedLights traced;
+				traced.terms = first[h] < first[h+1] ? &terms[ first[h] ] : NULL;
+				traced.count = first[h+1] - first[h];
+				col = shadeHit( scene, pr, packet.isects[k], &traced );
+				++h;
+			} else {
+				col = missColor( scene, pr );
+			}
+			setPixel( i, j, options.hdr ? col : col.clamp() );
+		}
+	}
+
+	if( !costs.empty() )
+		addCost( x0, y0, x1, y1, costNow() - before );
+}
+
 void RayTracer::tracePixel( int i, int j )
 {
 	vec3f col;
@@ -214,28 +855,119 @@ void RayTracer::tracePixel( int i, int j )
 	double x = double(i)/double(buffer_width);
 	double y = double(j)/double(buffer_height);
 
+	double before = costs.empty() ? 0.0 : costNow();
 	col = trace( scene,x,y );
+	setPixel( i, j, col );
+	if( !costs.empty() )
+		addCost( i, j, i + 1, j + 1, costNow() - before );
+}
+
+// Where the calling thread's measure of cost stands now; the cost of some
+// work is the difference before and after.
+double RayTracer::costNow() const
+{
+	switch( options.costMeasure ) {
+		case COST_TIME:
+		return std::chrono::duration<double, std::nano>(
+			std::chrono::steady_clock::now().time_since_epoch() ).count();
 
-	unsigned char *pixel = buffer + ( i + j * buffer_width ) * 3;
+		case COST_RAYS:
+		return (double)getThreadCounters().rays();
 
+		case COST_TESTS:
+		return (double)(getThreadCounters().nodesVisited + getThreadCounters().primitiveTests);
+
+		default:
+		return 0.0;
+	}
+}
+
+// Spread cost evenly over the pixels of columns [x0,x1) and rows [y0,y1).
+void RayTracer::addCost( int x0, int y0, int x1, int y1, double cost )
+{
+	float share = float( cost / ((x1 - x0) * (y1 - y0)) );
+	for( int j = y0; j < y1; ++j )
+		for( int i = x0; i < x1; ++i )
+			costs[ i + (j - bufferY0) * buffer_width ] += share;
+}
+
+// A colour in [0,1] as the bytes of a pixel.
+static inline void toBytes( const vec3f& col, unsigned char *pixel )
+{
 	pixel[0] = (int)( 255.0 * col[0]);
 	pixel[1] = (int)( 255.0 * col[1]);
 	pixel[2] = (int)( 255.0 * col[2]);
 }
 
+// Store col as pixel (i,j).  With the HDR buffer col goes in it as it is,
+// and through the tone map into the bytes; otherwise it must be clamped
+// already.
+void RayTracer::setPixel( int i, int j, const vec3f& col )
+{
+	if( hdrBuffer.empty() ) {
+		toBytes( col, pixelAt( i, j ) );
+		return;
+	}
+
+	float *hdrPixel = hdrPixelAt( i, j );
+	hdrPixel[0] = (float)col[0];
+	hdrPixel[1] = (float)col[1];
+	hdrPixel[2] = (float)col[2];
+	toBytes( toneMap.apply( col ), pixelAt( i, j ) );
+}
+
+// Redo the bytes of the pixels the buffer holds from their unclamped
+// colours, through the current tone map.
+void RayTracer::applyToneMap()
+{
+	if( hdrBuffer.empty() )
+		return;
+
+	for( int j = bufferY0; j < bufferEnd(); ++j ) {
+		for( int i = 0; i < buffer_width; ++i ) {
+			const float *hdrPixel = hdrPixelAt( i, j );
+			toBytes( toneMap.apply( vec3f( hdrPixel[0], hdrPixel[1], hdrPixel[2] ) ), pixelAt( i, j ) );
+		}
+	}
+}
+
+void RayTracer::setOptions( const RenderOptions& opts )
+{
+	options = opts;
+
+	// a block of packetSize x packetSize pixels has to fit in one packet
+	if( options.packetSize < 0 )
+		options.packetSize = 0;
+	while( options.packetSize * options.packetSize > MAX_PACKET_SIZE )
+		--options.packetSize;
+
+	// nor can shadeHit's list of pending rays
+	if( options.depth > MAX_TRACE_DEPTH )
+		options.depth = MAX_TRACE_DEPTH;
+
+	// the lattice of antialiasPixel can't take any more
+	if( options.aaSamples < 1 )
+		options.aaSamples = 1;
+	// nor would it ever split a pixel with fewer than MIN_AA_SAMPLES
+	if( options.aaSamples > 1 && options.aaSamples < MIN_AA_SAMPLES )
+		options.aaSamples = MIN_AA_SAMPLES;
+	if( options.aaSamples > MAX_AA_SAMPLES )
+		options.aaSamples = MAX_AA_SAMPLES;
+}
+
 void RayTracer::loadBackground(char* fn)
 {
 	unsigned char* data = NULL;
 	data = readBMP(fn, background_width, background_height);
 	if (data) {
-		if (backgroundImage == NULL) delete[] backgroundImage;
+		delete[] backgroundImage;
 		useBackground = true;
 		backgroundImage = data;
 	}
 }
 
 void RayTracer::clearBackground() {
-	if (backgroundImage == NULL) delete[] backgroundImage;
+	delete[] backgroundImage;
 	backgroundImage = NULL;
 	useBackground = false;
 	background_height = background_width = 0;
@@ -5,8 +5,49 @@
 
 #include "scene/scene.h"
 #include "scene/ray.h"
+#include "RenderOptions.h"
+#include "tonemap.h"
+#include <atomic>
+#include <functional>
 #include <map>
-#include <stack>
+#include <vector>
+
+// A medium a transmitted ray has gone into: the material of the surface it
+// went in through, to tell when it comes out again, and the index of
+// refraction.
+struct Medium
+{
+	const Material *material;
+	double index;
+};
+
+// Refraction stack of the media a ray is currently inside.  Each render
+// thread has its own, so pixels may be traced from several threads at once.
+typedef std::vector<Medium> MediaStack;
+
+struct PendingRay;
+
+// Deepest that reflections and transmissions are followed, whatever
+// RenderOptions::depth asks for.
+const int MAX_TRACE_DEPTH = 64;
+
+// A sample of the image for anti-aliasing: its colour and the object its
+// primary ray hit first, NULL for none.
+struct PixelSample
+{
+	PixelSample() : obj( NULL ) {}
+
+	vec3f color;
+	const SceneObject *obj;
+};
+
+// Most samples a pixel can be given, with RenderOptions::aaSamples: all of
+// antialiasPixel's 17 x 17 lattice.
+const int MAX_AA_SAMPLES = 289;
+
+// Fewest it can be given and still refine a pixel: the first split of the
+// four corners takes five more.
+const int MIN_AA_SAMPLES = 9;
 
 class RayTracer
 {
@@ -14,15 +55,60 @@ public:
     RayTracer();
     ~RayTracer();
 
-    vec3f trace( Scene *scene, double x, double y );
-	vec3f traceRay( Scene *scene, const ray& r, const vec3f& thresh, int depth, double intensity = 1.0 );
+    vec3f trace( Scene *scene, double x, double y, const SceneObject **hitObj = NULL );
+	vec3f traceRay( Scene *scene, const ray& r, const SceneObject **hitObj = NULL );
+	vec3f shadeHit( Scene *scene, const ray& r, const isect& i, const TracedLights *traced );
+	vec3f missColor( Scene *scene, const ray& r );
 
 
 	void getBuffer( unsigned char *&buf, int &w, int &h );
 	double aspectRatio();
 	void traceSetup( int w, int h );
+	void traceStripSetup( int w, int h, int rows );
+	void traceStrip( int y0, int threads = 0 );
+	const unsigned char *getStrip( int &y0, int &rows ) const;
 	void traceLines( int start = 0, int stop = 10000000 );
+	void traceTiles( int threads = 0, int tileSize = 32 );
+	void traceProgressive( int threads = 0, int coarsest = 16 );
+	void traceTile( int x0, int y0, int x1, int y1 );
+	void traceBlocks( int x0, int y0, int x1, int y1, int step, bool first );
+	void traceTileAA( int x0, int y0, int x1, int y1 );
+	vec3f antialiasPixel( int i, int j, const PixelSample& c00, const PixelSample& c10,
+		const PixelSample& c01, const PixelSample& c11 );
+	PixelSample sampleAt( double x, double y );
+	void tracePacket( int x0, int y0, int x1, int y1 );
 	void tracePixel( int i, int j );
+	void setPixel( int i, int j, const vec3f& col );
+
+	// Make a traceTiles() or traceProgressive() running on another thread
+	// return soon, leaving the buffer part done.  traceSetup() clears it.
+	void stop() { stopRequested = true; }
+	bool stopped() const { return stopRequested; }
+
+	// What each pixel cost to render, in the units of
+	// RenderOptions::costMeasure, row by row from the bottom like the
+	// buffer.  NULL unless the options asked for it at traceSetup().
+	const float *getCosts() const { return costs.empty() ? NULL : &costs[0]; }
+
+	// The unclamped colours of the pixels the buffer holds, three floats a
+	// pixel, if the options asked for them at traceSetup(); otherwise NULL.
+	const float *getHDRBuffer() const { return hdrBuffer.empty() ? NULL : &hdrBuffer[0]; }
+
+	// How the unclamped colours become the bytes in the buffer.  Set it
+	// before tracing, or call applyToneMap() afterwards to redo the bytes
+	// from the floats; not while a trace is running.
+	void setToneMap( const ToneMap& map ) { toneMap = map; }
+	const ToneMap& getToneMap() const { return toneMap; }
+	void applyToneMap();
+
+	// Fraction of the pixels traced since traceSetup().  Safe to call
+	// while tracing on another thread.
+	double getProgress() const;
+
+	// Options for the next loadScene() or trace.  Don't change them while
+	// a trace is running.
+	void setOptions( const RenderOptions& opts );
+	const RenderOptions& getOptions() const { return options; }
 	void loadBackground(char* fn);
 	void clearBackground();
 	vec3f getBackgroundImage(double x, double y);
@@ -30,18 +116,47 @@ public:
 	bool loadScene( char* fn );
 
 	bool sceneLoaded();
+	const Scene *getScene() const { return scene; }
+	// How long loadScene() spent reading the file, in seconds; the rest
+	// is the scene's getPrepareTime().
+	double getLoadTime() const { return loadSeconds; }
+	// why the last loadScene() failed, if it was a parse error
+	const string& getLoadError() const { return loadError; }
 
 private:
+	typedef std::function<void( int x0, int y0, int x1, int y1 )> TileFunction;
+	void runTiles( int threads, int tileSize, const TileFunction& tile );
+	int bufferEnd() const { return min( bufferY0 + bufferRows, buffer_height ); }
+	unsigned char *pixelAt( int i, int j ) { return buffer + ( i + (j - bufferY0) * buffer_width ) * 3; }
+	float *hdrPixelAt( int i, int j ) { return &hdrBuffer[ ( i + (j - bufferY0) * buffer_width ) * 3 ]; }
+	void addHit( Scene *scene, const ray& r, const isect& i, const TracedLights *traced, const vec3f& thresh,
+		int depth, double intensity, vec3f& col, PendingRay *pending, int& count );
+	void refract( const PendingRay& p, MediaStack& mediaStack, PendingRay *pending, int& count );
+	double costNow() const;
+	void addCost( int x0, int y0, int x1, int y1, double cost );
+
 	unsigned char *buffer;
 	int buffer_width, buffer_height;
 	int bufferSize;
+	// buffer holds rows [bufferY0, bufferY0 + bufferRows) of the image; all
+	// of it unless traceStripSetup() said otherwise
+	int bufferY0, bufferRows;
 	bool useBackground;
 	unsigned char *backgroundImage;
 	int background_height, background_width;
-	std::stack<const Material*> mediaStack;
 	Scene *scene;
+	RenderOptions options;
+	string loadError;
+	double loadSeconds;
+	std::vector<float> costs;
+	std::vector<float> hdrBuffer;
+	ToneMap toneMap;
 
 	bool m_bSceneLoaded;
+
+	std::atomic<bool> stopRequested;
+	std::atomic<int> pixelsTraced;
+	std::atomic<int> pixelsToTrace;
 };
 
 #endif // __RAYTRACER_H__
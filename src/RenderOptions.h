@@ -0,0 +1,65 @@
+#ifndef __RENDEROPTIONS_H__
+#define __RENDEROPTIONS_H__
+
+// Settings that control how a scene is loaded and rendered.  The UI fills
+// them in from its sliders and the command line from its arguments; the
+// renderer itself never looks at either.
+
+// What RayTracer measures the cost of each pixel in, if anything.
+enum CostMeasure
+{
+	COST_NONE,
+	COST_TIME,			// nanoseconds
+	COST_RAYS,			// rays traced, shadow rays included
+	COST_TESTS			// BVH nodes visited and primitives tested
+};
+
+struct RenderOptions
+{
+	RenderOptions()
+		: depth( 0 ), threshold( 0.0 ),
+		  constAtten( 0.0 ), linearAtten( 0.0 ), quadAtten( 0.0 ),
+		  packetSize( 0 ), aaSamples( 1 ), aaThreshold( 0.1 ),
+		  costMeasure( COST_NONE ), hdr( false ), bakeMeshes( false ), lightCutoff( 0.0 ) {}
+
+	int depth;				// how many bounces of reflection/refraction to follow
+	double threshold;		// stop following rays whose contribution falls to this;
+							// 0 follows them all the way to depth
+
+	// distance attenuation of point lights that don't give their own
+	double constAtten;
+	double linearAtten;
+	double quadAtten;
+
+	int packetSize;			// side of the pixel blocks traced as packets, 0 for none
+
+	// Anti-aliasing.  With aaSamples > 1 each pixel is sampled at its
+	// corners and subdivided where they hit different objects or differ
+	// by more than aaThreshold in some channel, using at most aaSamples
+	// samples on the pixel, its four corners included.  Anything from 2 to
+	// 8 is taken as 9, the fewest that can split a pixel.  Packets aren't
+	// used then.
+	int aaSamples;
+	double aaThreshold;
+
+	// Measure what each pixel costs to render, for a heat map.  Packets
+	// and anti-aliasing corners shared by a tile are measured together
+	// and their cost spread evenly over the pixels they stand for.
+	CostMeasure costMeasure;
+
+	// Keep every pixel's colour unclamped, as floats, alongside the bytes,
+	// which then come from it through the ToneMap (tonemap.h).
+	bool hdr;
+
+	// Move the vertices and normals of meshes into world space as they
+	// are loaded, so that rays needn't be moved into the meshes' space.
+	// Meshes that their transformation turns inside out are left alone.
+	bool bakeMeshes;
+
+	// Trace no shadow ray toward a light that couldn't add more than this
+	// to any channel of a hit's colour, and leave the light out.  0 only
+	// leaves out lights that add nothing, so the image doesn't change.
+	double lightCutoff;
+};
+
+#endif // __RENDEROPTIONS_H__
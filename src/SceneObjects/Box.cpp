@@ -1,5 +1,6 @@
 #include <cmath>
 #include <assert.h>
+#include <limits>
 
 #include "Box.h"
 
@@ -62,7 +63,14 @@ bool Box::intersectLocal( const ray& r, isect& i ) const
 			}
 		}		
 	}
-	// Box survived all above tests, return true with intersection point Tnear
+	// Box survived all above tests.  From inside the box the near plane
+	// is behind the ray, so the hit is where it leaves through the far one.
+	if (tnear < RAY_EPSILON)
+	{
+		i.setT(tfar);
+		i.setN(Nfar);
+		return true;
+	}
 	i.setT(tnear);
 	i.setN(Nnear);
 	return true;
@@ -37,6 +37,11 @@ public:
 	bool intersectBody( const ray& r, isect& i ) const;
 	bool intersectCaps( const ray& r, isect& i ) const;
 
+	double getHeight() const { return height; }
+	double getBottomRadius() const { return b_radius; }
+	double getTopRadius() const { return t_radius; }
+	bool isCapped() const { return capped; }
+
 
 protected:
 	void computeABC()
@@ -27,6 +27,8 @@ public:
     bool intersectBody( const ray& r, isect& i ) const;
 	bool intersectCaps( const ray& r, isect& i ) const;
 
+	bool isCapped() const { return capped; }
+
 protected:
 	bool capped;
 };
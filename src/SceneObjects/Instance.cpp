@@ -0,0 +1,21 @@
+#include "Instance.h"
+
+bool Instance::intersectLocal( const ray& r, isect& i ) const
+{
+	if( !shared->intersectLocal( r, i ) )
+		return false;
+
+	// the rest of the hit means the same to the shared object
+	i.obj = this;
+	return true;
+}
+
+bool Instance::occludedLocal( const ray& r, double tMax ) const
+{
+	return shared->occludedLocal( r, tMax );
+}
+
+vec3f Instance::getLocalNormal( const isect& i ) const
+{
+	return shared->getLocalNormal( i );
+}
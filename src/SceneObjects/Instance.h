@@ -0,0 +1,49 @@
+#ifndef __INSTANCE_H__
+#define __INSTANCE_H__
+
+#include "../scene/scene.h"
+
+// A copy of a shared object, such as a mesh that a scene uses many times,
+// under a transformation of its own.  The shared object is kept once, by
+// the scene, and intersected in the instance's local space; hits on it
+// are reported as hits on the instance so that they're finished under
+// the instance's transformation.
+class Instance
+	: public SceneObject
+{
+public:
+	// shared must be one of the scene's shared objects, whose own
+	// transformation is the identity.
+	Instance( Scene *scene, SceneObject *shared, TransformNode *transform )
+		: SceneObject( scene ), shared( shared )
+	{
+		this->transform = transform;
+	}
+
+	const SceneObject *getShared() const { return shared; }
+
+	virtual bool intersectLocal( const ray& r, isect& i ) const;
+	virtual bool occludedLocal( const ray& r, double tMax ) const;
+	virtual vec3f getLocalNormal( const isect& i ) const;
+
+	virtual const Material& getMaterial() const { return shared->getMaterial(); }
+	virtual const Material& getHitMaterial( const isect& i, Material& scratch ) const
+	{ return shared->getHitMaterial( i, scratch ); }
+
+	// the material is the shared object's
+	virtual void setMaterial( Material *m ) {}
+	virtual void setOrder( int ord ) { order = ord; }
+
+	virtual bool hasInterior() const { return shared->hasInterior(); }
+	virtual bool hasTransparency() const { return shared->hasTransparency(); }
+	virtual bool hasBoundingBoxCapability() const { return shared->hasBoundingBoxCapability(); }
+
+	// The shared object's bounds; Scene::initScene() works those out
+	// before any instance's.
+	virtual BoundingBox ComputeLocalBoundingBox() { return shared->getBoundingBox(); }
+
+private:
+	SceneObject *shared;
+};
+
+#endif // __INSTANCE_H__
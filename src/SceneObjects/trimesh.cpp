@@ -1,6 +1,10 @@
 #include <cmath>
 #include <float.h>
+#include <string.h>
 #include "trimesh.h"
+#include "../scene/parallel.h"
+
+bool Trimesh::usePackedFaces = true;
 
 Trimesh::~Trimesh()
 {
@@ -13,7 +17,7 @@ Trimesh::~Trimesh()
 // must add vertices, normals, and materials IN ORDER
 void Trimesh::addVertex( const vec3f &v )
 {
-    vertices.push_back( v );
+    vertices.push_back( Vertex( v ) );
 }
 
 void Trimesh::addMaterial( Material *m )
@@ -34,10 +38,7 @@ bool Trimesh::addFace( int a, int b, int c )
     if( a >= vcnt || b >= vcnt || c >= vcnt )
         return false;
 
-    TrimeshFace *newFace = new TrimeshFace( scene, new Material(*this->material), this, a, b, c );
-    newFace->setTransform(this->transform);
-    faces.push_back( newFace );
-    scene->add(newFace);
+    faces.push_back( TrimeshFace( this, a, b, c ) );
     return true;
 }
 
@@ -54,21 +55,171 @@ Trimesh::doubleCheck()
     return 0;
 }
 
+// Callback for BVH::intersect.  Faces are stored in leaf order, so the
+// faces of a leaf are the ones from its first index on.
+struct FaceHit
+{
+    FaceHit( const Trimesh& mesh, isect& i )
+        : mesh( mesh ), i( i ) {}
+
+    bool operator()( const int *index, int count, const ray& r, double& tMax )
+    {
+        return mesh.intersectFaces( index[0], count, r, tMax, i );
+    }
+
+    const Trimesh& mesh;
+    isect& i;
+};
+
+bool Trimesh::intersectLocal( const ray& r, isect& i ) const
+{
+    FaceHit hit( *this, i );
+    return faceBVH.intersect( r, 1.0e308, hit );
+}
+
+bool Trimesh::intersectFaces( int first, int count, const ray& r, double& tMax, isect& i ) const
+{
+    if( packed.size() ) {
+        double t, u, v;
+        int k = intersectTriangles( r, packed, first, count, tMax, t, u, v );
+        if( k < 0 )
+            return false;
+
+        tMax = t;
+        setHit( k, t, vec3f( 1.0 - u - v, u, v ), i );
+        return true;
+    }
+
+    bool hit = false;
+    double t;
+    vec3f bary, n;
+    for( int k = first; k < first + count; ++k ) {
+        if( faces[k].intersectLocal( r, t, bary, n ) && t < tMax ) {
+            tMax = t;
+            setHit( k, t, bary, i );
+            hit = true;
+        }
+    }
+    return hit;
+}
+
+// Callback for BVH::occluded.
+struct FaceOcclusion
+{
+    FaceOcclusion( const Trimesh& mesh )
+        : mesh( mesh ) {}
+
+    bool operator()( const int *index, int count, const ray& r, double& tMax )
+    {
+        return mesh.occludesFaces( index[0], count, r, tMax );
+    }
+
+    const Trimesh& mesh;
+};
+
+bool Trimesh::occludedLocal( const ray& r, double tMax ) const
+{
+    if( transparent )
+        return Geometry::occludedLocal( r, tMax );
+
+    FaceOcclusion occlusion( *this );
+    return faceBVH.occluded( r, tMax, occlusion );
+}
+
+bool Trimesh::occludesFaces( int first, int count, const ray& r, double tMax ) const
+{
+    if( packed.size() ) {
+        double t, u, v;
+        return intersectTriangles( r, packed, first, count, tMax, t, u, v ) >= 0;
+    }
+
+    double t;
+    vec3f bary, n;
+    for( int k = first; k < first + count; ++k ) {
+        if( faces[k].intersectLocal( r, t, bary, n ) && t < tMax )
+            return true;
+    }
+    return false;
+}
+
+void Trimesh::bakeTransform( TransformNode *root )
+{
+    // mirroring would flip which side of the faces is the front
+    if( transform->getKind() == TransformNode::IDENTITY || transform->isMirrored() )
+        return;
+
+    for( Vertices::iterator vi = vertices.begin(); vi != vertices.end(); ++vi )
+        *vi = Vertex( transform->localToGlobalCoords( vec3f( *vi ) ) );
+    // not normalized: their lengths weight them where they're interpolated
+    const mat3f normi = transform->getXform().upper33().inverse().transpose();
+    for( Normals::iterator ni = normals.begin(); ni != normals.end(); ++ni )
+        *ni = normi * *ni;
+
+    transform = root;
+}
+
+BoundingBox Trimesh::ComputeLocalBoundingBox()
+{
+    // per-vertex materials replace the mesh's own
+    transparent = false;
+    if( materials.size() ) {
+        for( Materials::const_iterator mi = materials.begin(); mi != materials.end(); ++mi )
+            transparent = transparent || !(*mi)->kt.iszero();
+    } else {
+        transparent = !material->kt.iszero();
+    }
+
+    if( faceBVH.empty() ) {
+        vector<BoundingBox> boxes( faces.size() );
+        parallelFor( (int)faces.size(), 16384, [&]( int first, int last ) {
+            for( int k = first; k < last; ++k )
+                boxes[k] = faces[k].ComputeLocalBoundingBox();
+        } );
+
+        faceBVH.build( boxes );
+        faceBVH.reorder( faces );
+    }
+
+    packed.clear();
+    if( usePackedFaces ) {
+        for( Faces::const_iterator fi = faces.begin(); fi != faces.end(); ++fi )
+            packed.push_back( vec3f( vertices[(*fi)[0]] ), vec3f( vertices[(*fi)[1]] ),
+                vec3f( vertices[(*fi)[2]] ) );
+    }
+
+    if( faceBVH.empty() )
+        return BoundingBox();
+    return faceBVH.getBounds();
+}
+
+BoundingBox TrimeshFace::ComputeLocalBoundingBox() const
+{
+    const vec3f a( parent->vertices[ids[0]] );
+    const vec3f b( parent->vertices[ids[1]] );
+    const vec3f c( parent->vertices[ids[2]] );
+
+    BoundingBox localbounds;
+    localbounds.max = maximum( a, b );
+    localbounds.min = minimum( a, b );
+
+    localbounds.max = maximum( c, localbounds.max);
+    localbounds.min = minimum( c, localbounds.min);
+    return localbounds;
+}
+
 // Intersect ray r with the triangle abc.  If it hits returns true,
 // and put the parameter in t and the barycentric coordinates of the
 // intersection in bary.
 // Uses the algorithm and notation from _Graphic Gems 5_, p. 232.
 //
 // Calculates and returns the normal of the triangle too.
-bool TrimeshFace::intersectLocal( const ray& r, isect& i ) const
+bool TrimeshFace::intersectLocal( const ray& r, double& tHit, vec3f& bary, vec3f& n ) const
 {
-    const vec3f& a = parent->vertices[ids[0]];
-    const vec3f& b = parent->vertices[ids[1]];
-    const vec3f& c = parent->vertices[ids[2]];
+    const vec3f a( parent->vertices[ids[0]] );
+    const vec3f b( parent->vertices[ids[1]] );
+    const vec3f c( parent->vertices[ids[2]] );
     
-    vec3f bary;
     float t;
-    vec3f n;
     
     vec3f p = r.getPosition();
     vec3f v = r.getDirection();
@@ -117,29 +268,49 @@ bool TrimeshFace::intersectLocal( const ray& r, isect& i ) const
     if( bary[0] < 0 || bary[1] < 0 || bary[1] > 1 || bary[2] < 0 || bary[2] > 1 )
         return false;
 
-    // if we get this far, we have an intersection.  Fill in the info.
+    // if we get this far, we have an intersection.
+    tHit = t;
+    return true;
+}
+
+void Trimesh::setHit( int face, double t, const vec3f& bary, isect& i ) const
+{
     i.setT( t );
-    if(parent->normals.size())
+    i.obj = this;
+    i.face = face;
+    i.bary = bary;
+}
+
+vec3f Trimesh::getLocalNormal( const isect& i ) const
+{
+    const TrimeshFace& f = faces[ i.face ];
+
+    if(normals.size())
     {
         // use interpolated normals
-        i.setN( (bary[0] * parent->normals[ids[0]]
-                 + bary[1] * parent->normals[ids[1]]
-                 + bary[2] * parent->normals[ids[2]]).normalize() );
-    } else {
-        i.setN( n );           // use face normal
+        return (i.bary[0] * normals[f[0]]
+                + i.bary[1] * normals[f[1]]
+                + i.bary[2] * normals[f[2]]).normalize();
     }
-    i.obj = this;
+
+    // use face normal
+    if( packed.size() )
+        return vec3f( packed.n[0][i.face], packed.n[1][i.face], packed.n[2][i.face] );
+    const vec3f a( vertices[f[0]] );
+    return ((vec3f( vertices[f[1]] ) - a).cross(vec3f( vertices[f[2]] ) - a)).normalize();
+}
+
+const Material& Trimesh::getHitMaterial( const isect& i, Material& scratch ) const
+{
+    if( materials.empty() )
+        return *material;
 
     // linearly interpolate materials
-    if( parent->materials.size() )
-    {
-        Material *m = new Material();
-        for( int jj = 0; jj < 3; ++jj )
-            (*m) += bary[jj] * (*parent->materials[ ids[jj] ]);
-        i.setMaterial( m );
-    }
-    
-    return true;
+    const TrimeshFace& f = faces[ i.face ];
+    scratch = Material();
+    for( int jj = 0; jj < 3; ++jj )
+        scratch += i.bary[jj] * (*materials[ f[jj] ]);
+    return scratch;
 }
 
 void
@@ -154,16 +325,16 @@ Trimesh::generateNormals()
     
     for( Faces::iterator fi = faces.begin(); fi != faces.end(); ++fi )
     {
-        vec3f a = vertices[(**fi)[0]];
-        vec3f b = vertices[(**fi)[1]];
-        vec3f c = vertices[(**fi)[2]];
+        vec3f a( vertices[(*fi)[0]] );
+        vec3f b( vertices[(*fi)[1]] );
+        vec3f c( vertices[(*fi)[2]] );
         
         vec3f faceNormal = ((b-a).cross(c-a)).normalize();
         
         for( int i = 0; i < 3; ++i )
         {
-            normals[(**fi)[i]] += faceNormal;
-            ++numFaces[(**fi)[i]];
+            normals[(*fi)[i]] += faceNormal;
+            ++numFaces[(*fi)[i]];
         }
     }
 
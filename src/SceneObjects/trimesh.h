@@ -7,28 +7,72 @@
 #include "../scene/ray.h"
 #include "../scene/material.h"
 #include "../scene/scene.h"
-class TrimeshFace;
+#include "../scene/bvh.h"
+#include "../scene/kernels.h"
+class Trimesh;
+
+// One triangle of a Trimesh.  Faces aren't scene objects of their own;
+// the mesh intersects them in its local space and reports itself as the
+// object that was hit.
+class TrimeshFace
+{
+    Trimesh *parent;
+    int ids[3];
+public:
+    TrimeshFace( Trimesh *parent, int a, int b, int c )
+    {
+        this->parent = parent;
+        ids[0] = a;
+        ids[1] = b;
+        ids[2] = c;
+    }
+
+    int operator[]( int i ) const
+    {
+        return ids[i];
+    }
+
+    // If the ray hits the face, returns true with the parameter of the hit
+    // in t, its barycentric coordinates in bary and the unit face normal in n.
+    bool intersectLocal( const ray& r, double& t, vec3f& bary, vec3f& n ) const;
+
+    BoundingBox ComputeLocalBoundingBox() const;
+};
 
 class Trimesh : public MaterialSceneObject
 {
     friend class TrimeshFace;
+public:
     typedef vector<vec3f> Normals;
-    typedef vector<vec3f> Vertices;
-    typedef vector<TrimeshFace*> Faces;
+    typedef vec3t<TraversalReal> Vertex;		// stored as the faces are intersected
+    typedef vector<Vertex> Vertices;
+    typedef vector<TrimeshFace> Faces;
     typedef vector<Material*> Materials;
+private:
     Vertices vertices;
     Faces faces;
     Normals normals;
     Materials materials;
+
+    // hierarchy over faces, in the mesh's local space
+    BVH faceBVH;
+    PackedTriangles packed;
+
+    // whether any of the mesh's materials lets light through
+    bool transparent;
 public:
+    // Whether meshes precompute PackedTriangles for their faces.  It costs
+    // 96 bytes a face but saves the edge and normal setup on every test.
+    static bool usePackedFaces;
+
     Trimesh( Scene *scene, Material *mat, TransformNode *transform )
-        : MaterialSceneObject(scene, mat)
+        : MaterialSceneObject(scene, mat), transparent( false )
     {
         this->transform = transform;
     }
 
     ~Trimesh();
-    
+
     // must add vertices, normals, and materials IN ORDER
     void addVertex( const vec3f & );
     void addMaterial( Material *m );
@@ -37,46 +81,55 @@ public:
     bool addFace( int a, int b, int c );
 
     char *doubleCheck();
-    
-    void generateNormals();
-};
 
-class TrimeshFace : public MaterialSceneObject
-{
-    Trimesh *parent;
-    int ids[3];
-public:
-    TrimeshFace( Scene *scene, Material *mat, Trimesh *parent, int a, int b, int c)
-        : MaterialSceneObject( scene, mat )
-    {
-        this->parent = parent;
-        ids[0] = a;
-        ids[1] = b;
-        ids[2] = c;
-    }
+    // The mesh as it stands, for saving it with a compiled scene.  Once
+    // the mesh is in a scene its faces are in the leaf order of faceBVH.
+    const Vertices& getVertices() const { return vertices; }
+    const Faces& getFaces() const { return faces; }
+    const Normals& getNormals() const { return normals; }
+    const Materials& getMaterials() const { return materials; }
+    const BVH& getFaceBVH() const { return faceBVH; }
 
-    int operator[]( int i ) const
-    {
-        return ids[i];
-    }
+    // Use a saved faceBVH instead of building one.  The faces must have
+    // been added in the order it was saved with.
+    void setFaceBVH( vector<BVHNode>& nodes, vector<int>& indices ) { faceBVH.assign( nodes, indices ); }
+
+    void generateNormals();
+
+    // Move the vertices and normals into world space and hang the mesh
+    // off root, which must be the identity, unless the mesh's
+    // transformation turns it inside out.  Must come before the mesh is
+    // in a scene.
+    void bakeTransform( TransformNode *root );
 
     virtual bool intersectLocal( const ray& r, isect& i ) const;
 
+    // Intersect the ray with faces [first, first+count) in local space,
+    // keeping the closest hit before tMax.
+    bool intersectFaces( int first, int count, const ray& r, double& tMax, isect& i ) const;
+
+    // Record a hit of face at parameter t with barycentric coordinates
+    // bary.  Normals and materials are left to getLocalNormal and
+    // getHitMaterial, which only the closest hit gets to.
+    void setHit( int face, double t, const vec3f& bary, isect& i ) const;
+
+    virtual vec3f getLocalNormal( const isect& i ) const;
+
+    virtual const Material& getHitMaterial( const isect& i, Material& scratch ) const;
+
+    // An opaque mesh is occluding wherever any face is hit, so this skips
+    // the normals and materials and stops at the first face found.
+    virtual bool occludedLocal( const ray& r, double tMax ) const;
+    bool occludesFaces( int first, int count, const ray& r, double tMax ) const;
+
+    virtual bool hasTransparency() const { return transparent; }
+
     virtual bool hasBoundingBoxCapability() const { return true; }
 
-	virtual bool hasInterior() const { return true; }
-      
-    virtual BoundingBox ComputeLocalBoundingBox()
-    {
-        BoundingBox localbounds;
-        localbounds.max = maximum( parent->vertices[ids[0]], parent->vertices[ids[1]]);
-		localbounds.min = minimum( parent->vertices[ids[0]], parent->vertices[ids[1]]);
-        
-        localbounds.max = maximum( parent->vertices[ids[2]], localbounds.max);
-		localbounds.min = minimum( parent->vertices[ids[2]], localbounds.min);
-        return localbounds;
-    }
-    
+    // Builds faceBVH, unless a saved one was set, and the packed faces, and
+    // looks at the materials, so the mesh must be complete by the time this
+    // runs (Scene::initScene calls it through ComputeBoundingBox).
+    virtual BoundingBox ComputeLocalBoundingBox();
 };
 
 
@@ -0,0 +1,281 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "cli.h"
+#include "RayTracer.h"
+#include "fileio/bitmap.h"
+#include "fileio/rayb.h"
+#include "report.h"
+#include "heatmap.h"
+#include "stream.h"
+#include "fileio/hdr.h"
+
+// from getopt.cpp
+extern int getopt( int argc, char **argv, const char *optstring );
+extern char* optarg;
+extern int optind, opterr, optopt;
+
+bool parseCommandLine( int argc, char **argv, CommandLine& cl )
+{
+	int i;
+
+	while( (i = getopt( argc, argv, "ctbr:w:h:j:p:a:A:s:H:m:S:Rf:e:T:L:" )) != EOF ) {
+		switch( i ) {
+			case 'c':
+			cl.compile = true;
+			break;
+
+			case 't':
+			cl.report = true;
+			break;
+
+			case 'b':
+			cl.options.bakeMeshes = true;
+			break;
+
+			case 's':
+			cl.statsName = optarg;
+			break;
+
+			case 'r':
+			cl.options.depth = atoi( optarg );
+			break;
+
+			case 'w':
+			cl.width = atoi( optarg );
+			break;
+
+			case 'h':
+			// the height always follows from the camera's aspect ratio
+			break;
+
+			case 'j':
+			cl.threads = atoi( optarg );
+			break;
+
+			case 'p':
+			cl.options.packetSize = atoi( optarg );
+			break;
+
+			case 'a':
+			cl.options.aaSamples = atoi( optarg );
+			break;
+
+			case 'A':
+			cl.options.aaThreshold = atof( optarg );
+			break;
+
+			case 'L':
+			cl.options.lightCutoff = atof( optarg );
+			break;
+
+			case 'H':
+			cl.heatmapName = optarg;
+			break;
+
+			case 'S':
+			cl.stripRows = atoi( optarg );
+			break;
+
+			case 'R':
+			cl.resume = true;
+			break;
+
+			case 'f':
+			cl.hdrName = optarg;
+			if( !isHDRImageName( cl.hdrName ) ) {
+				fprintf( stderr, "-f writes .pfm or .hdr files.\n" );
+				return false;
+			}
+			break;
+
+			case 'e':
+			cl.toneMap.exposure = atof( optarg );
+			break;
+
+			case 'T':
+			if( !strcmp( optarg, "clamp" ) )
+				cl.toneMap.op = TONE_CLAMP;
+			else if( !strcmp( optarg, "reinhard" ) )
+				cl.toneMap.op = TONE_REINHARD;
+			else {
+				fprintf( stderr, "-T takes clamp or reinhard.\n" );
+				return false;
+			}
+			break;
+
+			case 'm':
+			if( !strcmp( optarg, "time" ) )
+				cl.options.costMeasure = COST_TIME;
+			else if( !strcmp( optarg, "rays" ) )
+				cl.options.costMeasure = COST_RAYS;
+			else if( !strcmp( optarg, "tests" ) )
+				cl.options.costMeasure = COST_TESTS;
+			else {
+				fprintf( stderr, "-m takes time, rays or tests.\n" );
+				return false;
+			}
+			break;
+
+			default:
+			return false;
+		}
+	}
+
+	if( cl.compile ) {
+		if( optind >= argc || optind < argc-2 ) {
+			fprintf( stderr, "-c takes an input and optionally an output name.\n" );
+			return false;
+		}
+		cl.rayName = argv[optind];
+		cl.imgName = optind < argc-1 ? argv[optind+1] : NULL;
+		return true;
+	}
+
+	if( cl.heatmapName ) {
+		if( cl.options.costMeasure == COST_NONE )
+			cl.options.costMeasure = COST_TIME;
+		if( cl.options.costMeasure != COST_TIME && !countersEnabled() ) {
+			fprintf( stderr, "this build doesn't count rays or tests; -m time only.\n" );
+			return false;
+		}
+	}
+
+	// tone mapping needs the colours before they're clamped
+	if( cl.hdrName || !cl.toneMap.isIdentity() )
+		cl.options.hdr = true;
+
+	if( cl.resume && cl.stripRows <= 0 )
+		cl.stripRows = DEFAULT_STRIP_ROWS;
+	if( cl.stripRows > 0 && (cl.heatmapName || cl.hdrName) ) {
+		fprintf( stderr, "-H and -f need the whole image in memory; they can't be streamed.\n" );
+		return false;
+	}
+
+	// the image is optional with a heat map or an HDR image
+	if( optind >= argc || (optind == argc-1 && !cl.heatmapName && !cl.hdrName) ) {
+		fprintf( stderr, "no input and/or output name.\n" );
+		return false;
+	}
+
+	cl.rayName = argv[optind];
+	cl.imgName = optind < argc-1 ? argv[optind+1] : NULL;
+
+	return true;
+}
+
+void printUsage( FILE *f, const char *progname )
+{
+	RenderOptions defaults;
+	CommandLine cl;
+
+	fprintf( f, "usage: %s [options] [input.ray output.bmp]\n", progname );
+	fprintf( f, "       %s -H heatmap.bmp [options] input.ray [output.bmp]\n", progname );
+	fprintf( f, "       %s -c input.ray [output.rayb]\n", progname );
+	fprintf( f, "  -r <#>      set recurssion level (default %d)\n", defaults.depth );
+	fprintf( f, "  -w <#>      set output image width (default %d)\n", cl.width );
+	fprintf( f, "  -j <#>      set number of render threads (default: all cores)\n" );
+	fprintf( f, "  -p <#>      trace primary rays in #x# packets, 2 to 8 (default: off)\n" );
+	fprintf( f, "  -a <#>      anti-alias with up to # samples per pixel, %d to %d (default: off)\n",
+		MIN_AA_SAMPLES, MAX_AA_SAMPLES );
+	fprintf( f, "  -A <#>      colour difference that makes anti-aliasing look closer (default %g)\n",
+		defaults.aaThreshold );
+	fprintf( f, "  -H <file>   write a heat map of what each pixel cost to render\n" );
+	fprintf( f, "  -m <what>   measure the cost in time, rays or tests (default time)\n" );
+	fprintf( f, "  -S <#>      write the image # rows at a time as they are done, keeping\n"
+				"              a checkpoint to resume from (default: all at the end)\n" );
+	fprintf( f, "  -R          resume a render streamed with -S from its checkpoint\n" );
+	fprintf( f, "  -f <file>   also write the image unclamped, as .pfm or .hdr\n" );
+	fprintf( f, "  -e <#>      exposure of the image, in stops (default 0)\n" );
+	fprintf( f, "  -T <how>    bring colours above 1 down by clamp or reinhard (default clamp)\n" );
+	fprintf( f, "  -L <#>      skip lights that add no more than # to a colour (default %g)\n",
+		defaults.lightCutoff );
+	fprintf( f, "  -b          move meshes into world space as they are loaded\n" );
+	fprintf( f, "  -t			report time statistics\n" );
+	fprintf( f, "  -s <file>   write the statistics to file as JSON\n" );
+	fprintf( f, "  -c			compile the scene; renders of input.ray then load the\n"
+				"			compiled copy while it is up to date\n" );
+}
+
+// Wall time since start, in seconds; clock() would add up the time of
+// every thread.
+static double secondsSince( std::chrono::steady_clock::time_point start )
+{
+	return std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
+
+bool renderCommandLine( const CommandLine& cl, RenderReport& report )
+{
+	RayTracer tracer;
+	tracer.setOptions( cl.options );
+	tracer.setToneMap( cl.toneMap );
+	if( !tracer.loadScene( cl.rayName ) ) {
+		if( !tracer.getLoadError().empty() )
+			fprintf( stderr, "ParseError: %s\n", tracer.getLoadError().c_str() );
+		return false;
+	}
+
+	int width = cl.width;
+	int height = (int)(width / tracer.aspectRatio() + 0.5);
+	tracer.traceSetup( width, height );
+
+	report.scene = cl.rayName;
+	report.width = width;
+	report.height = height;
+	report.threads = cl.threads;
+	report.options = tracer.getOptions();
+	report.parseSeconds = tracer.getLoadTime();
+	describeScene( tracer.getScene(), report );
+
+	// count the render alone
+	resetCounters();
+	if( cl.stripRows > 0 ) {
+		StreamTimes times;
+		if( !renderStreaming( tracer, cl.rayName, cl.imgName, width, height, cl.stripRows,
+				cl.threads, cl.resume, times ) )
+			return false;
+		report.renderSeconds = times.renderSeconds;
+		report.writeSeconds = times.writeSeconds;
+		report.counters = getCounters();
+		if( cl.report && times.firstRow > 0 )
+			fprintf( stderr, "resumed from row %d of %d\n", times.firstRow, height );
+	} else {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		tracer.traceTiles( cl.threads );
+		report.renderSeconds = secondsSince( start );
+		report.counters = getCounters();
+
+		start = std::chrono::steady_clock::now();
+		unsigned char* buf;
+		tracer.getBuffer( buf, width, height );
+		if( buf && cl.imgName )
+			writeBMP( cl.imgName, width, height, buf );
+		if( cl.hdrName && tracer.getHDRBuffer()
+				&& !writeHDRImage( cl.hdrName, width, height, tracer.getHDRBuffer() ) )
+			fprintf( stderr, "couldn't write %s\n", cl.hdrName );
+		report.writeSeconds = secondsSince( start );
+	}
+
+	if( cl.heatmapName && tracer.getCosts() ) {
+		vector<unsigned char> heat( width * height * 3 );
+		double scale = costHeatmap( tracer.getCosts(), width, height, &heat[0] );
+		writeBMP( cl.heatmapName, width, height, &heat[0] );
+		fprintf( stderr, "%s: red is %.4g %s per pixel\n", cl.heatmapName, scale,
+			costUnits( cl.options.costMeasure ) );
+	}
+
+	if( cl.report )
+		printReport( stderr, report );
+	if( cl.statsName && !writeReportJSON( cl.statsName, report ) )
+		fprintf( stderr, "couldn't write %s\n", cl.statsName );
+
+	return true;
+}
+
+bool compileCommandLine( const CommandLine& cl )
+{
+	string raybName = cl.imgName ? string( cl.imgName ) : compiledSceneName( cl.rayName );
+	return compileScene( cl.rayName, raybName, cl.options );
+}
@@ -0,0 +1,55 @@
+#ifndef __CLI_H__
+#define __CLI_H__
+
+// Command line handling, shared by the text mode of the UI program and by
+// the headless ray-cli.
+
+#include <stdio.h>
+
+#include "RenderOptions.h"
+#include "tonemap.h"
+
+struct RenderReport;
+
+struct CommandLine
+{
+	CommandLine()
+		: rayName( NULL ), imgName( NULL ), width( 150 ), threads( 0 ), report( false ),
+		  compile( false ), statsName( NULL ), heatmapName( NULL ), stripRows( 0 ),
+		  resume( false ), hdrName( NULL ) {}
+
+	char *rayName;			// scene to read
+	char *imgName;			// image to write, or NULL for just the heat map; with
+							// compile, the compiled scene to write, or NULL for
+							// the usual name
+	int width;				// image width; the height follows from the camera
+	int threads;			// render threads, 0 for one per hardware thread
+	bool report;			// print how long the render took and what it did
+	bool compile;			// compile the scene to .rayb instead of rendering it
+	char *statsName;		// where to write the same as JSON, or NULL
+	char *heatmapName;		// where to write the cost of each pixel as a
+							// heat map, or NULL
+	int stripRows;			// write the image as it goes, this many rows at a
+							// time; 0 renders it all in memory first
+	bool resume;			// carry on from the streamed image's checkpoint
+	char *hdrName;			// where to write the unclamped image, or NULL
+	ToneMap toneMap;		// from the unclamped colours to the image's
+	RenderOptions options;
+};
+
+// Read the options and the input and output names from argv.  Returns
+// false if they don't make sense.
+bool parseCommandLine( int argc, char **argv, CommandLine& cl );
+
+void printUsage( FILE *f, const char *progname );
+
+// Load the scene, render it and save the image as cl says, printing or
+// writing the statistics if asked to.  Returns false if the scene couldn't
+// be loaded; otherwise the statistics go in report too.
+bool renderCommandLine( const CommandLine& cl, RenderReport& report );
+
+// Compile the scene as cl says.  Returns false, with the reason printed, if
+// that fails.
+bool compileCommandLine( const CommandLine& cl );
+
+#endif // __CLI_H__
@@ -97,13 +97,34 @@ unsigned char *readBMP(char *fname, int& width, int& height)
 	return data; 
 } 
  
-void writeBMP(char *iname, int width, int height, unsigned char *data) 
-{ 
-	int bytes, pad;
-	bytes = width * 3;
-	pad = (bytes%4) ? 4-(bytes%4) : 0;
-	bytes += pad;
-	bytes *= height;
+// Bytes in a row of a width pixel wide image, padded to a multiple of 4.
+static int rowBytes( int width )
+{
+	int bytes = width * 3;
+	return (bytes%4) ? bytes + 4-(bytes%4) : bytes;
+}
+
+static int seekBMP( FILE *file, long long offset )
+{
+#ifdef _WIN32
+	return _fseeki64( file, offset, SEEK_SET );
+#else
+	return fseeko( file, (off_t)offset, SEEK_SET );
+#endif
+}
+
+static long long tellBMP( FILE *file )
+{
+#ifdef _WIN32
+	return _ftelli64( file );
+#else
+	return (long long)ftello( file );
+#endif
+}
+
+FILE *beginBMP(char *iname, int width, int height)
+{
+	BMP_DWORD bytes = (BMP_DWORD)rowBytes( width ) * height;
 
 	bmfh.bfType = 0x4d42;    // "BM"
 	bmfh.bfSize = sizeof(BMP_BITMAPFILEHEADER) + sizeof(BMP_BITMAPINFOHEADER) + bytes;
@@ -125,6 +146,8 @@ void writeBMP(char *iname, int width, int height, unsigned char *data)
 	bmih.biClrImportant = 0;
 
 	FILE *foo=fopen(iname, "wb"); 
+	if (!foo)
+		return NULL;
 
 	//	fwrite(&bmfh, sizeof(BMP_BITMAPFILEHEADER), 1, foo);
 	fwrite( &(bmfh.bfType), 2, 1, foo); 
@@ -135,21 +158,68 @@ void writeBMP(char *iname, int width, int height, unsigned char *data)
 
 	fwrite(&bmih, sizeof(BMP_BITMAPINFOHEADER), 1, foo); 
 
-	bytes /= height;
+	return foo;
+}
+
+FILE *resumeBMP(char *iname, int width, int height, int rows)
+{
+	FILE* file; 
+
+	if ( (file=fopen( iname, "r+b" )) == NULL )  
+		return NULL; 
+
+	fread( &(bmfh.bfType), 2, 1, file); 
+	fread( &(bmfh.bfSize), 4, 1, file); 
+	fread( &(bmfh.bfReserved1), 2, 1, file); 
+	fread( &(bmfh.bfReserved2), 2, 1, file); 
+	fread( &(bmfh.bfOffBits), 4, 1, file); 
+	if ( fread( &bmih, sizeof(BMP_BITMAPINFOHEADER), 1, file ) != 1 
+		|| bmfh.bfType != 0x4d42 || bmih.biBitCount != 24
+		|| bmih.biWidth != width || bmih.biHeight != height ) {
+		fclose( file );
+		return NULL;
+	}
+
+	// the rows must all be there
+	long long offset = bmfh.bfOffBits + (long long)rowBytes( width ) * rows;
+	if ( seekBMP( file, 0 ) != 0 || fseek( file, 0, SEEK_END ) != 0
+		|| tellBMP( file ) < offset || seekBMP( file, offset ) != 0 ) {
+		fclose( file );
+		return NULL;
+	}
+
+	return file;
+}
+
+bool writeBMPRows(FILE *file, int width, int rows, const unsigned char *data)
+{
+	int bytes = rowBytes( width );
 	unsigned char* scanline = new unsigned char [bytes];
-	for ( int j = 0; j < height; ++j )
+	memset( scanline, 0, bytes );
+	for ( int j = 0; j < rows; ++j )
 	{
-		memcpy( scanline, data + j*3*width, bytes );
+		const unsigned char *row = data + j*3*width;
 		for ( int i = 0; i < width; ++i )
 		{
-			unsigned char temp = scanline[i*3];
-			scanline[i*3] = scanline[i*3+2];
-			scanline[i*3+2] = temp;
+			scanline[i*3] = row[i*3+2];
+			scanline[i*3+1] = row[i*3+1];
+			scanline[i*3+2] = row[i*3];
 		}
-		fwrite( scanline, bytes, 1, foo);
+		fwrite( scanline, bytes, 1, file);
 	}
 
 	delete [] scanline;
 
+	return !ferror( file );
+}
+
+void writeBMP(char *iname, int width, int height, unsigned char *data) 
+{ 
+	FILE *foo = beginBMP( iname, width, height );
+	if (!foo)
+		return;
+
+	writeBMPRows( foo, width, height, data );
+
 	fclose(foo);
-} 
\ No newline at end of file
+}
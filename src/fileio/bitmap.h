@@ -43,4 +43,14 @@ typedef struct {
 extern unsigned char *readBMP(char *fname, int& width, int& height);
 extern void writeBMP(char *iname, int width, int height, unsigned char *data); 
 
+// Writing a bitmap a band of rows at a time, bottom row first, so that
+// the whole image never has to be in memory.  beginBMP() writes the
+// headers and resumeBMP() reopens a file it began, which must have at
+// least rows rows written already, to carry on after them; both return
+// NULL if they can't.  writeBMPRows() takes the rows as writeBMP() does
+// and returns false if they can't be written.
+extern FILE *beginBMP(char *iname, int width, int height);
+extern FILE *resumeBMP(char *iname, int width, int height, int rows);
+extern bool writeBMPRows(FILE *file, int width, int rows, const unsigned char *data);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,94 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "hdr.h"
+
+using namespace std;
+
+bool writePFM( const char *iname, int width, int height, const float *data )
+{
+	FILE *f = fopen( iname, "wb" );
+	if( !f )
+		return false;
+
+	// the sign of the scale gives the byte order of the floats
+	unsigned int one = 1;
+	bool littleEndian = *(unsigned char *)&one == 1;
+	fprintf( f, "PF\n%d %d\n%s\n", width, height, littleEndian ? "-1.0" : "1.0" );
+
+	// PFM rows go from the bottom up too
+	fwrite( data, sizeof( float ), (size_t)width * height * 3, f );
+
+	bool ok = !ferror( f );
+	return fclose( f ) == 0 && ok;
+}
+
+// A colour as a shared exponent and three 8 bit mantissas.
+static void toRGBE( const float *rgb, unsigned char *rgbe )
+{
+	float v = max( max( rgb[0], rgb[1] ), rgb[2] );
+	if( v < 1e-32f ) {
+		rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+		return;
+	}
+
+	int e;
+	float scale = (float)frexp( v, &e ) * 256.0f / v;
+	for( int k = 0; k < 3; ++k )
+		rgbe[k] = (unsigned char)( max( rgb[k], 0.0f ) * scale );
+	rgbe[3] = (unsigned char)( e + 128 );
+}
+
+bool writeRadianceHDR( const char *iname, int width, int height, const float *data )
+{
+	FILE *f = fopen( iname, "wb" );
+	if( !f )
+		return false;
+
+	fprintf( f, "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y %d +X %d\n", height, width );
+
+	// flat scanlines, top row first
+	vector<unsigned char> scanline( width * 4 );
+	for( int j = height - 1; j >= 0; --j ) {
+		const float *row = data + (size_t)j * width * 3;
+		for( int i = 0; i < width; ++i )
+			toRGBE( row + i * 3, &scanline[ i * 4 ] );
+		fwrite( &scanline[0], 1, scanline.size(), f );
+	}
+
+	bool ok = !ferror( f );
+	return fclose( f ) == 0 && ok;
+}
+
+static bool hasExtension( const char *iname, const char *ext )
+{
+	size_t n = strlen( iname ), m = strlen( ext );
+	if( n < m )
+		return false;
+	for( size_t k = 0; k < m; ++k ) {
+		char c = iname[ n - m + k ];
+		if( c >= 'A' && c <= 'Z' )
+			c += 'a' - 'A';
+		if( c != ext[k] )
+			return false;
+	}
+	return true;
+}
+
+bool isHDRImageName( const char *iname )
+{
+	return hasExtension( iname, ".pfm" ) || hasExtension( iname, ".hdr" );
+}
+
+bool writeHDRImage( const char *iname, int width, int height, const float *data )
+{
+	if( hasExtension( iname, ".pfm" ) )
+		return writePFM( iname, width, height, data );
+	if( hasExtension( iname, ".hdr" ) )
+		return writeRadianceHDR( iname, width, height, data );
+	return false;
+}
@@ -0,0 +1,22 @@
+//
+// hdr.h
+//
+// Writing floating point images: Portable Float Map (.pfm) and Radiance
+// RGBE (.hdr).  Both take RGB floats a pixel, rows from the bottom up as
+// RayTracer keeps them, and return false if the file can't be written.
+//
+
+#ifndef __HDR_H__
+#define __HDR_H__
+
+bool writePFM( const char *iname, int width, int height, const float *data );
+bool writeRadianceHDR( const char *iname, int width, int height, const float *data );
+
+// Write as the name's extension says, .pfm or .hdr.  Returns false for
+// any other.
+bool writeHDRImage( const char *iname, int width, int height, const float *data );
+
+// Is the name one writeHDRImage() knows?
+bool isHDRImageName( const char *iname );
+
+#endif // __HDR_H__
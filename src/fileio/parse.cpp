@@ -5,258 +5,419 @@
 #endif
 
 #include <cstring>
+#include <cstdlib>
 
 #include "parse.h"
 
-static string readID( istream& is );
-static Obj *readString( istream& is );
-static Obj *readScalar( istream& is );
-static Obj *readTuple( istream& is );
-static Obj *readDict( istream& is );
-static Obj *readObject( istream& is );
-static Obj *readName( istream& is );
-static void eatWS( istream& is );
-static void eatNL( istream& is );
-
-Obj *readFile( istream& is )
+// Where the parser is in the text.  *end is always '\0', so looking at *p
+// is safe even when p == end; it just doesn't match anything.
+struct Cursor
 {
-	return readObject( is );
-}
-
-static void eatWS( istream& is )
+	const char *p;
+	const char *end;
+};
+
+static string readID( Cursor& c );
+static Obj *readString( Cursor& c );
+static Obj *readScalar( Cursor& c );
+static Obj *readTuple( Cursor& c );
+static Obj *readDict( Cursor& c );
+static Obj *readObject( Cursor& c );
+static Obj *readName( Cursor& c );
+
+Obj *readFile( const char*& pos, const char *end )
 {
-	int ch = is.peek();
-	while( ch == ' ' || ch == '\t' || ch == '\n' || ch == 0x0D || ch == 0x0A) {
-		is.get();
-		if( !is ) {
-			return;
-		}
-		ch = is.peek();
-	}
+	Cursor c = { pos, end };
+	Obj *ret = readObject( c );
+	pos = c.p;
+	return ret;
 }
 
-static void eatNL( istream& is )
+static bool isDigit( char ch )
 {
-	int ch = is.peek();
-	while( ch != '\n' ) {
-		is.get();
-		if( !is ) {
-			return;
-		}
-		ch = is.peek();
-	}
+	return ch >= '0' && ch <= '9';
 }
 
-static bool eat( istream& is ) 
+// Skip whitespace and comments.  Returns false at the end of the text.
+static bool eat( Cursor& c )
 {
-	while( is ) {
-		eatWS( is );
-		if( is ) {
-			int ch = is.peek();
-			if( ch == '/' ) {
-				is.get();
-				int ch = is.peek();
-				if( ch == '/' ) {
-					eatNL( is );
-				} else if( ch == '*' ) {
-					while( true ) {
-						is.get();
-						ch = is.peek();
-						if( ch == '*' ) {
-							is.get();
-							ch = is.peek();
-							if( ch == '/' ) {
-								is.get();
-								break;
-							} else if( ch == -1 ) {	
-								is.get();
-								throw ParseError( 
-									"Parse Error: unterminated comment" );
-							}
-						} else if( ch == -1 ) {
-							is.get();
-							throw ParseError( 
-								"Parse Error: unterminated comment" );
-						}
-					}
-				} else {
-					return true;
+	while( c.p < c.end ) {
+		char ch = *c.p;
+		if( ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' ) {
+			++c.p;
+		} else if( ch == '/' && c.p[1] == '/' ) {
+			while( c.p < c.end && *c.p != '\n' )
+				++c.p;
+		} else if( ch == '/' && c.p[1] == '*' ) {
+			c.p += 2;
+			while( true ) {
+				if( c.p >= c.end ) {
+					throw ParseError( 
+						"Parse Error: unterminated comment" );
 				}
-			} else if( ch == -1 ) {
-				is.get();
-				return false;
-			} else {
-				return true;
+				if( c.p[0] == '*' && c.p[1] == '/' ) {
+					c.p += 2;
+					break;
+				}
+				++c.p;
 			}
 		} else {
-			return false;
+			return true;
 		}
 	}
 	return false;
 }
 
-static Obj *readName( istream& is )
+static void expectMore( Cursor& c )
 {
-	string s = readID( is );
+	if( !eat( c ) ) {
+		throw ParseError( "Parse error: unexpected end of file." );
+	}
+}
+
+static Obj *readName( Cursor& c )
+{
+	string s = readID( c );
 
 	if( s == "true" ) {
 		return new BooleanObj( true );
 	} else if( s == "false" ) {
 		return new BooleanObj( false );
 	} else {
-		if( !eat( is ) ) {
+		if( !eat( c ) ) {
 			return new IdObj( s );
 		}
 
-		int ch = is.peek();
-		if( strchr( "}),;", ch ) != NULL ) {
+		char ch = *c.p;
+		if( ch == '}' || ch == ')' || ch == ',' || ch == ';' ) {
 			return new IdObj( s );
 		} else {
-			return new NamedObj( s, readObject( is ) );
+			return new NamedObj( s, readObject( c ) );
 		}
 	}
 }
 
-static string readID( istream& is )
+static string readID( Cursor& c )
 {
-	int ch;
-	string ret( "" );
+	const char *start = c.p++;
 
-	ret += char( is.get() );
+	while( c.p < c.end && strchr( " \t\n\r={}();,/", *c.p ) == NULL ) {
+		++c.p;
+	}
 
-	while( is ) {
-		ch = is.peek();
-		if( strchr( " \t\n={}();,/", ch ) != NULL ) {
-			break;
-		} else {
-			ret += char( ch );
-			is.get();
-		}
+	return string( start, c.p );
+}
+
+static Obj *readString( Cursor& c ) 
+{
+	const char *start = ++c.p;
+
+	while( c.p < c.end && *c.p != '"' ) {
+		++c.p;
+	}
+	if( c.p >= c.end ) {
+		throw ParseError( "Parse error: unterminated string." );
 	}
 
-	return ret;
+	return new StringObj( string( start, c.p++ ) );
 }
 
-static Obj *readString( istream& is ) 
+static bool isNumberStart( const Cursor& c )
 {
-	int ch;
-	string ret( "" );
+	return *c.p == '-' || isDigit( *c.p );
+}
 
-	is.get();
+static bool isNumberChar( char ch )
+{
+	return ch == '-' || ch == '+' || ch == '.' || ch == 'e' || ch == 'E' || isDigit( ch );
+}
 
-	while( true ) {
-		ch = is.peek();
-		if( ch == '"' ) {
-			is.get();
-			return new StringObj( ret );
+// Powers of ten that a double holds exactly.
+static const double exactPowers[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static double readNumber( Cursor& c )
+{
+	// Numbers in scene files are short decimals like -0.25 or 1.5e-3.  When
+	// the digits fit in 53 bits and the power of ten is exactly
+	// representable, one multiply or divide gives the correctly rounded
+	// result, the same that strtod would.  Anything else goes to strtod.
+	const char *start = c.p;
+	const char *p = c.p;
+	bool negative = false;
+	bool exact = true;
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+
+	if( *p == '-' ) {
+		negative = true;
+		++p;
+	}
+	for( ; isDigit( *p ); ++p, ++digits ) {
+		if( mantissa < 100000000000000000ULL ) {
+			mantissa = mantissa * 10 + ( *p - '0' );
 		} else {
-			ret += char( ch );
+			++exponent;
+			exact = false;
+		}
+	}
+	if( *p == '.' ) {
+		for( ++p; isDigit( *p ); ++p, ++digits ) {
+			if( mantissa < 100000000000000000ULL ) {
+				mantissa = mantissa * 10 + ( *p - '0' );
+				--exponent;
+			} else {
+				exact = false;
+			}
 		}
-		is.get();
 	}
+	if( digits > 0 && ( *p == 'e' || *p == 'E' ) ) {
+		const char *q = p + 1;
+		bool negativeExp = false;
+		if( *q == '-' || *q == '+' ) {
+			negativeExp = *q == '-';
+			++q;
+		}
+		if( isDigit( *q ) ) {
+			int e = 0;
+			for( ; isDigit( *q ); ++q ) {
+				if( e < 10000 )
+					e = e * 10 + ( *q - '0' );
+			}
+			exponent += negativeExp ? -e : e;
+			p = q;
+		}
+	}
+
+	// something odd like 1.2.3; take what strtod makes of it, as atof did
+	if( digits == 0 || isNumberChar( *p ) ) {
+		exact = false;
+		while( isNumberChar( *p ) )
+			++p;
+	}
+	c.p = p;
+
+	if( !exact || mantissa > ( 1ULL << 53 ) || exponent < -22 || exponent > 22 ) {
+		return strtod( start, NULL );
+	}
+
+	double value = double( mantissa );
+	if( exponent < 0 ) {
+		value /= exactPowers[ -exponent ];
+	} else {
+		value *= exactPowers[ exponent ];
+	}
+	return negative ? -value : value;
 }
 
-static Obj *readScalar( istream& is )
+static Obj *readScalar( Cursor& c )
 {
-	int ch;
-	string ret( "" );
+	return new ScalarObj( readNumber( c ) );
+}
 
-	while( true ) {
-		ch = is.peek();
-		if( (ch == '-') || (ch == '.') || (ch == 'e') || (ch == 'E')
-				|| (ch >= '0' && ch <= '9') ) {
-			ret += char( ch );
-			is.get();
-		} else {
+// A flat tuple of the given numbers.
+static NumberTupleObj *makeRow( const double *values, int count )
+{
+	NumberTupleObj *row = new NumberTupleObj;
+	for( int k = 0; k < count; ++k ) {
+		row->addNumber( values[k] );
+	}
+	row->endRow();
+	return row;
+}
+
+// Read a tuple of nothing but numbers into a new row of numbers.  If the
+// tuple holds anything else, leave c and numbers as they were and return
+// false.
+static bool readNumberRow( Cursor& c, NumberTupleObj *numbers )
+{
+	Cursor start = c;
+
+	++c.p;
+	while( eat( c ) && isNumberStart( c ) ) {
+		numbers->addNumber( readNumber( c ) );
+		eat( c );
+		if( *c.p == ')' ) {
+			++c.p;
+			numbers->endRow();
+			return true;
+		} else if( *c.p != ',' ) {
 			break;
 		}
+		++c.p;
 	}
 
-	return new ScalarObj( atof( ret.c_str() ) );
+	numbers->discardRow();
+	c = start;
+	return false;
 }
 
-static Obj *readTuple( istream& is )
+static Obj *readTuple( Cursor& c )
 {
-	vector<Obj*> ret;
-
-	is.get();
+	// Numbers, or tuples of nothing but numbers, go straight into a
+	// NumberTupleObj.  If some other element turns up, whatever was read
+	// so far is turned into objects and the rest is read the general way.
+	NumberTupleObj *numbers = new NumberTupleObj;
+	bool flat = false;
+	bool nested = false;
+	mytuple ret;
+
+	++c.p;
+
+	expectMore( c );
+	if( *c.p == ')' ) {
+		++c.p;
+		delete numbers;
+		return new TupleObj( ret );
+	}
 
 	while( true ) {
-		eat( is );
-		ret.push_back( readObject( is ) );	
-		eat( is );
-		int ch = is.get();
-		if( ch == ')' ) {
-			return new TupleObj( ret );
-		} else if( ch == ',' ) {
-			continue;
+		expectMore( c );
+		if( numbers && !nested && isNumberStart( c ) ) {
+			numbers->addNumber( readNumber( c ) );
+			flat = true;
+		} else if( numbers && !flat && *c.p == '(' && readNumberRow( c, numbers ) ) {
+			nested = true;
 		} else {
+			Obj *obj = readObject( c );
+			if( obj == NULL ) {
+				throw ParseError( "Parse error: unexpected end of file." );
+			}
+
+			if( numbers ) {
+				if( flat ) {
+					numbers->endRow();
+					const double *values = numbers->getRow( 0 );
+					for( int k = 0; k < numbers->rowSize( 0 ); ++k ) {
+						ret.push_back( new ScalarObj( values[k] ) );
+					}
+				} else {
+					for( int r = 0; r < numbers->numRows(); ++r ) {
+						ret.push_back( makeRow( numbers->getRow( r ), numbers->rowSize( r ) ) );
+					}
+				}
+				delete numbers;
+				numbers = NULL;
+			}
+			ret.push_back( obj );
+		}
+
+		eat( c );
+		char ch = *c.p;
+		if( c.p < c.end ) {
+			++c.p;
+		}
+		if( ch == ')' ) {
+			break;
+		} else if( ch != ',' ) {
 			throw ParseError( "Parse error: expected comma." );
 		}
 	}
 
-	throw ParseError( "Parse error: internal error." );
+	if( !numbers ) {
+		return new TupleObj( ret );
+	}
+	if( flat ) {
+		numbers->endRow();
+	} else {
+		numbers->setNested();
+	}
+	return numbers;
 }
 
-static Obj *readDict( istream& is )
+static Obj *readDict( Cursor& c )
 {
 	string lhs;
 	Obj *rhs;
 
 	map<string,Obj*> ret;
 
-	is.get();
+	++c.p;
 
 	while( true ) {
-		eat( is );
-		if( is.peek() == '}' ) {
-			is.get();
+		expectMore( c );
+		if( *c.p == '}' ) {
+			++c.p;
 			return new DictObj( ret );
 		}
-		lhs = readID( is );
-		eat( is );
-		if( is.get() != '=' ) {
+		lhs = readID( c );
+		eat( c );
+		if( *c.p != '=' ) {
 			throw ParseError( "Parse error: expected equals." );
 		}
-		rhs = readObject( is );
+		++c.p;
+		rhs = readObject( c );
+		if( rhs == NULL ) {
+			throw ParseError( "Parse error: unexpected end of file." );
+		}
 		ret[ lhs ] = rhs;
-		eat( is );
-		int ch = is.peek();
+		eat( c );
+		char ch = *c.p;
 		if( ch == ';' ) {
-			is.get();
+			++c.p;
 		} else if( ch != '}' ) {
 			throw ParseError( "Parse error: expected semicolon or brace." );
 		}
 	}
 }
 
-static Obj *readObject( istream& is )
+static Obj *readObject( Cursor& c )
 {
-	if( !eat( is ) ) {
+	if( !eat( c ) ) {
 		return NULL;
 	}
 
-	int ch = is.peek();
+	char ch = *c.p;
 
-	if( (ch == '-') || (ch >= '0' && ch <= '9') ) {
-		return readScalar( is );
+	if( ch == '-' || isDigit( ch ) ) {
+		return readScalar( c );
 	} else if( ch == '"' ) {
-		return readString( is );
+		return readString( c );
 	} else if( ch == '(' ) {
-		return readTuple( is );
+		return readTuple( c );
 	} else if( ch == '{' ) {
-		return readDict( is );
+		return readDict( c );
 	} else {
-		return readName( is );
+		return readName( c );
 	}
 }
 
-/*
-int main( void )
+const mytuple& NumberTupleObj::getTuple() const
 {
-	Obj *o = readFile( cin );
-	o->printOn( cout );
-	delete o;
-	return 0;
+	if( !materialized ) {
+		if( nested ) {
+			for( int r = 0; r < numRows(); ++r ) {
+				tuple.push_back( makeRow( getRow( r ), rowSize( r ) ) );
+			}
+		} else if( numRows() > 0 ) {
+			for( int k = 0; k < rowSize( 0 ); ++k ) {
+				tuple.push_back( new ScalarObj( getRow( 0 )[k] ) );
+			}
+		}
+		materialized = true;
+	}
+	return tuple;
+}
+
+void NumberTupleObj::printOn( ostream& os ) const
+{
+	os << '(';
+	for( int r = 0; r < numRows(); ++r ) {
+		if( nested ) {
+			os << ( r > 0 ? ", (" : "(" );
+		}
+		for( int k = 0; k < rowSize( r ); ++k ) {
+			if( k > 0 ) {
+				os << ", ";
+			}
+			os << getRow( r )[k];
+		}
+		if( nested ) {
+			os << ')';
+		}
+	}
+	os << ')';
 }
-*/
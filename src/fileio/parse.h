@@ -29,6 +29,7 @@ inline ostream& operator <<( ostream& os, const Exception& x )
 }
 
 class Obj;
+class NumberTupleObj;
 
 typedef vector<Obj*> 		mytuple;
 typedef map<string,Obj*> 	dict;
@@ -77,6 +78,10 @@ public:
 	{ throw ObjTypeMismatch( string( "named" ), getTypeName() ); }
 	virtual Obj 		 *getChild() const
 	{ throw ObjTypeMismatch( string( "named" ), getTypeName() ); }
+
+	// Tuples of numbers, and tuples of tuples of numbers, come out of the
+	// parser as flat arrays.  NULL for anything else.
+	virtual const NumberTupleObj *getNumbers() const { return NULL; }
 protected:
 	Obj() {}
 
@@ -194,6 +199,59 @@ private:
 	mytuple val;
 };
 
+// A tuple of numbers, such as (1, 2, 3), or a tuple of them, such as
+// ((0, 1, 2), (0, 2, 3)).  The numbers are kept in one array, row after row,
+// instead of as a ScalarObj each; a flat tuple is a single row.  Meshes are
+// long lists of these, so this is most of what a big scene file holds.
+class NumberTupleObj
+	: public Obj
+{
+public:
+	NumberTupleObj()
+		: Obj()
+		, nested( false )
+		, materialized( false )
+	{
+		rowStart.push_back( 0 );
+	}
+	virtual ~NumberTupleObj()
+	{
+		for( mytuple::iterator i = tuple.begin(); i != tuple.end(); ++i ) {
+			delete (*i);
+		}
+	}
+
+	virtual string getTypeName() const { return string( "tuple" ); }
+	virtual void printOn( ostream& os ) const;
+
+	// The elements as a tree of objects, built the first time it's asked
+	// for.  Prefer the rows where speed matters.
+	virtual const mytuple& getTuple() const;
+
+	virtual const NumberTupleObj *getNumbers() const { return this; }
+
+	// A tuple of tuples has a row per inner tuple; a tuple of numbers
+	// has one row with all of them.
+	bool isNested() const { return nested; }
+	int numRows() const { return int( rowStart.size() ) - 1; }
+	int rowSize( int row ) const { return rowStart[ row + 1 ] - rowStart[ row ]; }
+	const double *getRow( int row ) const { return values.data() + rowStart[ row ]; }
+
+	// for the parser
+	void addNumber( double v ) { values.push_back( v ); }
+	void endRow() { rowStart.push_back( int( values.size() ) ); }
+	void discardRow() { values.resize( rowStart.back() ); }
+	void setNested() { nested = true; }
+
+private:
+	vector<double> values;
+	vector<int> rowStart;		// where each row begins in values, then the end
+	bool nested;
+
+	mutable mytuple tuple;
+	mutable bool materialized;
+};
+
 class DictObj
 	: public Obj
 {
@@ -261,6 +319,9 @@ private:
 	Obj *child;
 };
 
-Obj *readFile( istream& is );
+// Read the next object from the text at pos, leaving pos just past it.
+// Returns NULL once only whitespace and comments are left.  The text must
+// be followed by a '\0' at end.
+Obj *readFile( const char*& pos, const char *end );
 
 #endif // __PARSE_H__
@@ -0,0 +1,967 @@
+#ifdef WIN32
+#pragma warning( disable : 4786 )
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <map>
+#include <vector>
+
+#include "rayb.h"
+#include "read.h"
+#include "parse.h"
+
+#include "../scene/bvh.h"
+#include "../scene/light.h"
+#include "../SceneObjects/trimesh.h"
+#include "../SceneObjects/Box.h"
+#include "../SceneObjects/Cone.h"
+#include "../SceneObjects/Cylinder.h"
+#include "../SceneObjects/Instance.h"
+#include "../SceneObjects/Sphere.h"
+#include "../SceneObjects/Square.h"
+
+// The file is the header followed by records, each a tag and then its
+// fields.  Everything is written in the machine's own byte order; the
+// header has a marker to tell when that doesn't match.  Bump the version
+// whenever the layout of anything changes.
+static const char RAYB_MAGIC[4] = { 'R', 'A', 'Y', 'B' };
+static const int RAYB_VERSION = 4;
+static const int RAYB_BYTE_ORDER = 0x01020304;
+
+// record tags
+enum
+{
+	RAYB_CAMERA = 1,
+	RAYB_AMBIENT,
+	RAYB_MATERIALS,		// table that objects refer to by index
+	RAYB_TRANSFORMS,	// global transforms that objects refer to by index
+	RAYB_LIGHT,			// lights and objects come in the scene's order
+	RAYB_OBJECT,
+	RAYB_TRIMESH,
+	RAYB_SCENE_BVH,
+	RAYB_END,
+	RAYB_SHARED_MESH,	// a mesh for instances, by name; these come before the objects
+	RAYB_INSTANCE		// in the scene's order with the other objects
+};
+
+// kinds of RAYB_OBJECT
+enum
+{
+	RAYB_SPHERE = 1,
+	RAYB_BOX,
+	RAYB_SQUARE,
+	RAYB_CYLINDER,
+	RAYB_CONE
+};
+
+// kinds of RAYB_LIGHT
+enum
+{
+	RAYB_DIRECTIONAL_LIGHT = 1,
+	RAYB_POINT_LIGHT,
+	RAYB_AMBIENT_LIGHT
+};
+
+// What the header says about where the scene came from.
+struct RaybHeader
+{
+	int version;
+	long long sourceSize;
+	long long sourceTime;
+	double constAtten;
+	double linearAtten;
+	double quadAtten;
+	int bakeMeshes;
+	int traversalSize;		// sizeof( TraversalReal ) in the build that wrote it
+};
+
+// Size and modification time of a file.
+static bool fileStamp( const string& name, long long& size, long long& time )
+{
+	struct stat st;
+	if( stat( name.c_str(), &st ) != 0 ) {
+		return false;
+	}
+	size = (long long) st.st_size;
+	time = (long long) st.st_mtime;
+	return true;
+}
+
+string compiledSceneName( const string& rayName )
+{
+	size_t len = rayName.size();
+	if( len > 4 && rayName.compare( len - 4, 4, ".ray" ) == 0 ) {
+		return rayName + "b";
+	}
+	return rayName + ".rayb";
+}
+
+bool isCompiledSceneName( const string& filename )
+{
+	size_t len = filename.size();
+	return len > 5 && filename.compare( len - 5, 5, ".rayb" ) == 0;
+}
+
+// A file mapped read-only into memory.  data() is NULL if that failed.
+class MappedFile
+{
+public:
+	MappedFile( const string& name );
+	~MappedFile();
+
+	const char *data() const { return ptr; }
+	size_t size() const { return len; }
+
+private:
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+	const char *ptr;
+	size_t len;
+};
+
+#ifdef _WIN32
+MappedFile::MappedFile( const string& name )
+	: mapping( NULL ), ptr( NULL ), len( 0 )
+{
+	file = CreateFileA( name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if( file == INVALID_HANDLE_VALUE ) {
+		return;
+	}
+
+	LARGE_INTEGER size;
+	if( !GetFileSizeEx( file, &size ) || size.QuadPart == 0 ) {
+		return;
+	}
+
+	mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+	if( mapping == NULL ) {
+		return;
+	}
+
+	ptr = (const char *) MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+	if( ptr ) {
+		len = (size_t) size.QuadPart;
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	if( ptr ) {
+		UnmapViewOfFile( ptr );
+	}
+	if( mapping ) {
+		CloseHandle( mapping );
+	}
+	if( file != INVALID_HANDLE_VALUE ) {
+		CloseHandle( file );
+	}
+}
+#else
+MappedFile::MappedFile( const string& name )
+	: ptr( NULL ), len( 0 )
+{
+	fd = open( name.c_str(), O_RDONLY );
+	if( fd < 0 ) {
+		return;
+	}
+
+	struct stat st;
+	if( fstat( fd, &st ) != 0 || st.st_size == 0 ) {
+		return;
+	}
+
+	void *p = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	if( p != MAP_FAILED ) {
+		ptr = (const char *) p;
+		len = st.st_size;
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	if( ptr ) {
+		munmap( (void *) ptr, len );
+	}
+	if( fd >= 0 ) {
+		close( fd );
+	}
+}
+#endif
+
+// Appends the fields of a compiled scene to a buffer.
+class RaybWriter
+{
+public:
+	void put( const void *p, size_t n )
+	{
+		const char *c = (const char *) p;
+		data.insert( data.end(), c, c + n );
+	}
+
+	void putInt( int v ) { put( &v, sizeof( v ) ); }
+	void putLong( long long v ) { put( &v, sizeof( v ) ); }
+	void putDouble( double v ) { put( &v, sizeof( v ) ); }
+
+	void putString( const string& s )
+	{
+		putInt( (int) s.size() );
+		put( s.data(), s.size() );
+	}
+
+	void putVec( const vec3f& v )
+	{
+		putDouble( v[0] );
+		putDouble( v[1] );
+		putDouble( v[2] );
+	}
+
+	void putBVH( const BVH& bvh )
+	{
+		const vector<BVHNode>& nodes = bvh.getNodes();
+		const vector<int>& indices = bvh.getIndices();
+
+		putInt( (int) nodes.size() );
+		for( size_t k = 0; k < nodes.size(); ++k ) {
+			// always in double, whatever the nodes are kept in
+			const BoundingBox& bounds = toBoundingBox( nodes[k].bounds );
+			putVec( bounds.min );
+			putVec( bounds.max );
+			putInt( nodes[k].offset );
+			putInt( nodes[k].count );
+			putInt( nodes[k].axis );
+		}
+
+		putInt( (int) indices.size() );
+		put( indices.empty() ? NULL : &indices[0], indices.size() * sizeof( int ) );
+	}
+
+	bool save( const string& name ) const
+	{
+		FILE *f = fopen( name.c_str(), "wb" );
+		if( !f ) {
+			return false;
+		}
+		bool ok = fwrite( &data[0], 1, data.size(), f ) == data.size();
+		return fclose( f ) == 0 && ok;
+	}
+
+private:
+	vector<char> data;
+};
+
+// Reads the fields of a compiled scene back out of memory, throwing a
+// ParseError if the data runs out early.
+class RaybReader
+{
+public:
+	RaybReader( const char *data, size_t size )
+		: p( data ), end( data + size ) {}
+
+	void get( void *dst, size_t n )
+	{
+		if( size_t( end - p ) < n ) {
+			throw ParseError( "file is truncated" );
+		}
+		memcpy( dst, p, n );
+		p += n;
+	}
+
+	int getInt() { int v; get( &v, sizeof( v ) ); return v; }
+	long long getLong() { long long v; get( &v, sizeof( v ) ); return v; }
+	double getDouble() { double v; get( &v, sizeof( v ) ); return v; }
+
+	string getString()
+	{
+		string s( getCount( 1 ), '\0' );
+		get( &s[0], s.size() );
+		return s;
+	}
+
+	vec3f getVec()
+	{
+		double v[3];
+		get( v, sizeof( v ) );
+		return vec3f( v[0], v[1], v[2] );
+	}
+
+	// A count of items of itemSize bytes that follow.  Checked against
+	// what is left, so that a damaged file can't ask for a huge array.
+	int getCount( size_t itemSize )
+	{
+		int count = getInt();
+		if( count < 0 || size_t( count ) > size_t( end - p ) / itemSize ) {
+			throw ParseError( "bad array size" );
+		}
+		return count;
+	}
+
+	// An index into a table of size entries.
+	int getIndex( size_t size )
+	{
+		int index = getInt();
+		if( index < 0 || size_t( index ) >= size ) {
+			throw ParseError( "index out of range" );
+		}
+		return index;
+	}
+
+	// A hierarchy over primCount primitives.  With inOrder the primitives
+	// must have been sorted into the order of the leaves, as a mesh's
+	// faces are, so that indices just counts up.
+	void getBVH( vector<BVHNode>& nodes, vector<int>& indices, int primCount, bool inOrder )
+	{
+		nodes.resize( getCount( 6 * sizeof( double ) + 3 * sizeof( int ) ) );
+		for( size_t k = 0; k < nodes.size(); ++k ) {
+			BoundingBox bounds;
+			bounds.min = getVec();
+			bounds.max = getVec();
+			nodes[k].bounds = NodeBox( bounds );
+			nodes[k].offset = getInt();
+			nodes[k].count = getInt();
+			nodes[k].axis = getInt();
+		}
+
+		indices.resize( getCount( sizeof( int ) ) );
+		get( indices.empty() ? NULL : &indices[0], indices.size() * sizeof( int ) );
+
+		// make sure the walks can't go astray: children come after their
+		// parent, no deeper than the walks' stacks allow, leaves stay
+		// inside indices and indices inside the primitives
+		int nodeCount = (int) nodes.size();
+		int indexCount = (int) indices.size();
+		vector<int> depths( nodeCount, 0 );
+		for( int k = 0; k < nodeCount; ++k ) {
+			const BVHNode& node = nodes[k];
+			bool ok;
+			if( node.count > 0 ) {
+				ok = node.offset >= 0 && node.offset <= indexCount - node.count;
+			} else {
+				ok = node.count == 0 && k + 1 < nodeCount
+					&& node.offset > k + 1 && node.offset < nodeCount
+					&& node.axis >= 0 && node.axis < 3
+					&& depths[k] < BVH_MAX_DEPTH;
+				if( ok ) {
+					depths[ k + 1 ] = max( depths[ k + 1 ], depths[k] + 1 );
+					depths[ node.offset ] = max( depths[ node.offset ], depths[k] + 1 );
+				}
+			}
+			if( !ok ) {
+				throw ParseError( "bad hierarchy" );
+			}
+		}
+		for( int k = 0; k < indexCount; ++k ) {
+			if( indices[k] < 0 || indices[k] >= primCount || (inOrder && indices[k] != k) ) {
+				throw ParseError( "bad hierarchy" );
+			}
+		}
+	}
+
+	bool atEnd() const { return p == end; }
+
+private:
+	const char *p;
+	const char *end;
+};
+
+static void writeHeader( RaybWriter& out, const RaybHeader& header )
+{
+	out.put( RAYB_MAGIC, sizeof( RAYB_MAGIC ) );
+	out.putInt( header.version );
+	out.putInt( RAYB_BYTE_ORDER );
+	out.putLong( header.sourceSize );
+	out.putLong( header.sourceTime );
+	out.putDouble( header.constAtten );
+	out.putDouble( header.linearAtten );
+	out.putDouble( header.quadAtten );
+	out.putInt( header.bakeMeshes );
+	out.putInt( header.traversalSize );
+}
+
+// Read the header and check that this version can read the rest.
+static RaybHeader readHeader( RaybReader& in )
+{
+	char magic[ sizeof( RAYB_MAGIC ) ];
+	in.get( magic, sizeof( magic ) );
+	if( memcmp( magic, RAYB_MAGIC, sizeof( magic ) ) != 0 ) {
+		throw ParseError( "not a compiled scene" );
+	}
+
+	RaybHeader header;
+	header.version = in.getInt();
+	if( header.version != RAYB_VERSION || in.getInt() != RAYB_BYTE_ORDER ) {
+		throw ParseError( "compiled by a different version" );
+	}
+	header.sourceSize = in.getLong();
+	header.sourceTime = in.getLong();
+	header.constAtten = in.getDouble();
+	header.linearAtten = in.getDouble();
+	header.quadAtten = in.getDouble();
+	header.bakeMeshes = in.getInt();
+	header.traversalSize = in.getInt();
+	return header;
+}
+
+static void writeMaterial( RaybWriter& out, const Material& m )
+{
+	out.putVec( m.ke );
+	out.putVec( m.ka );
+	out.putVec( m.ks );
+	out.putVec( m.kd );
+	out.putVec( m.kr );
+	out.putVec( m.kt );
+	out.putDouble( m.shininess );
+	out.putDouble( m.index );
+}
+
+static Material readMaterial( RaybReader& in )
+{
+	Material m;
+	m.ke = in.getVec();
+	m.ka = in.getVec();
+	m.ks = in.getVec();
+	m.kd = in.getVec();
+	m.kr = in.getVec();
+	m.kt = in.getVec();
+	m.shininess = in.getDouble();
+	m.index = in.getDouble();
+	return m;
+}
+
+// Number the distinct materials and transforms that the objects use.
+// Objects that share one share its entry.
+typedef map<const Material*, int> MaterialTable;
+typedef map<TransformNode*, int> TransformTable;
+
+static int tableIndex( MaterialTable& table, vector<const Material*>& order, const Material *m )
+{
+	MaterialTable::iterator i = table.find( m );
+	if( i != table.end() ) {
+		return i->second;
+	}
+	table[ m ] = (int) order.size();
+	order.push_back( m );
+	return (int) order.size() - 1;
+}
+
+// The fields of a RAYB_TRIMESH or RAYB_SHARED_MESH after the tag and name.
+static void writeTrimesh( RaybWriter& out, const Trimesh *mesh, int transform,
+	MaterialTable& materials )
+{
+	const Trimesh::Vertices& vertices = mesh->getVertices();
+	const Trimesh::Faces& faces = mesh->getFaces();
+	const Trimesh::Normals& normals = mesh->getNormals();
+	const Trimesh::Materials& vm = mesh->getMaterials();
+
+	out.putInt( transform );
+	out.putInt( materials[ &mesh->getMaterial() ] );
+
+	out.putInt( (int) vertices.size() );
+	for( size_t k = 0; k < vertices.size(); ++k )
+		out.putVec( vec3f( vertices[k] ) );
+
+	out.putInt( (int) faces.size() );
+	for( size_t k = 0; k < faces.size(); ++k ) {
+		out.putInt( faces[k][0] );
+		out.putInt( faces[k][1] );
+		out.putInt( faces[k][2] );
+	}
+
+	out.putInt( (int) normals.size() );
+	for( size_t k = 0; k < normals.size(); ++k )
+		out.putVec( normals[k] );
+
+	out.putInt( (int) vm.size() );
+	for( size_t k = 0; k < vm.size(); ++k )
+		out.putInt( materials[ vm[k] ] );
+
+	out.putBVH( mesh->getFaceBVH() );
+}
+
+static void writeScene( RaybWriter& out, Scene *scene, const RaybHeader& header )
+{
+	writeHeader( out, header );
+
+	Camera *camera = scene->getCamera();
+	const mat3f& rotation = camera->getRotation();
+	out.putInt( RAYB_CAMERA );
+	out.putVec( camera->getEye() );
+	out.putVec( rotation[0] );
+	out.putVec( rotation[1] );
+	out.putVec( rotation[2] );
+	out.putDouble( camera->getNormalizedHeight() );
+	out.putDouble( camera->getAspectRatio() );
+
+	out.putInt( RAYB_AMBIENT );
+	out.putVec( scene->getAmbient() );
+
+	MaterialTable materials;
+	vector<const Material*> materialOrder;
+	TransformTable transforms;
+	vector<TransformNode*> transformOrder;
+
+	// the shared meshes' materials and transforms are in the tables too
+	const Scene::SharedObjects& shared = scene->getSharedObjects();
+	vector<Geometry*> all;
+	for( Scene::SharedObjects::const_iterator s = shared.begin(); s != shared.end(); ++s ) {
+		if( !dynamic_cast<Trimesh*>( s->second ) ) {
+			throw ParseError( "scene shares an object that can't be compiled" );
+		}
+		all.push_back( s->second );
+	}
+	all.insert( all.end(), scene->beginObjects(), scene->endObjects() );
+
+	for( vector<Geometry*>::const_iterator g = all.begin(); g != all.end(); ++g ) {
+		SceneObject *obj = dynamic_cast<SceneObject*>( *g );
+		if( !obj ) {
+			throw ParseError( "scene holds geometry that can't be compiled" );
+		}
+		tableIndex( materials, materialOrder, &obj->getMaterial() );
+
+		Trimesh *mesh = dynamic_cast<Trimesh*>( obj );
+		if( mesh ) {
+			const Trimesh::Materials& vm = mesh->getMaterials();
+			for( size_t k = 0; k < vm.size(); ++k )
+				tableIndex( materials, materialOrder, vm[k] );
+		}
+
+		TransformNode *node = obj->getTransform();
+		if( transforms.find( node ) == transforms.end() ) {
+			transforms[ node ] = (int) transformOrder.size();
+			transformOrder.push_back( node );
+		}
+	}
+
+	out.putInt( RAYB_MATERIALS );
+	out.putInt( (int) materialOrder.size() );
+	for( size_t k = 0; k < materialOrder.size(); ++k ) {
+		writeMaterial( out, *materialOrder[k] );
+	}
+
+	out.putInt( RAYB_TRANSFORMS );
+	out.putInt( (int) transformOrder.size() );
+	for( size_t k = 0; k < transformOrder.size(); ++k ) {
+		const mat4f& xform = transformOrder[k]->getXform();
+		for( int row = 0; row < 4; ++row )
+			for( int col = 0; col < 4; ++col )
+				out.putDouble( xform[row][col] );
+	}
+
+	for( Scene::cliter l = scene->beginLights(); l != scene->endLights(); ++l ) {
+		double atten[3] = { 0.0, 0.0, 0.0 };
+		vec3f where;
+		int kind;
+
+		if( DirectionalLight *light = dynamic_cast<DirectionalLight*>( *l ) ) {
+			kind = RAYB_DIRECTIONAL_LIGHT;
+			where = light->getOrientation();
+		} else if( PointLight *light = dynamic_cast<PointLight*>( *l ) ) {
+			kind = RAYB_POINT_LIGHT;
+			where = light->getPosition();
+			light->getDistanceAttenuation( atten[0], atten[1], atten[2] );
+		} else if( dynamic_cast<AmbientLight*>( *l ) ) {
+			kind = RAYB_AMBIENT_LIGHT;
+		} else {
+			throw ParseError( "scene holds a light that can't be compiled" );
+		}
+
+		out.putInt( RAYB_LIGHT );
+		out.putInt( kind );
+		out.putVec( (*l)->getColor( vec3f() ) );
+		out.putVec( where );
+		out.putDouble( atten[0] );
+		out.putDouble( atten[1] );
+		out.putDouble( atten[2] );
+	}
+
+	map<const SceneObject*, int> sharedMeshes;
+	for( Scene::SharedObjects::const_iterator s = shared.begin(); s != shared.end(); ++s ) {
+		out.putInt( RAYB_SHARED_MESH );
+		out.putString( s->first );
+		writeTrimesh( out, static_cast<Trimesh*>( s->second ), transforms[ s->second->getTransform() ],
+			materials );
+		int index = (int) sharedMeshes.size();
+		sharedMeshes[ s->second ] = index;
+	}
+
+	for( Scene::cgiter g = scene->beginObjects(); g != scene->endObjects(); ++g ) {
+		SceneObject *obj = dynamic_cast<SceneObject*>( *g );
+		int material = materials[ &obj->getMaterial() ];
+		int transform = transforms[ obj->getTransform() ];
+
+		if( Trimesh *mesh = dynamic_cast<Trimesh*>( obj ) ) {
+			out.putInt( RAYB_TRIMESH );
+			writeTrimesh( out, mesh, transform, materials );
+			continue;
+		}
+
+		if( Instance *instance = dynamic_cast<Instance*>( obj ) ) {
+			out.putInt( RAYB_INSTANCE );
+			out.putInt( transform );
+			out.putInt( sharedMeshes[ instance->getShared() ] );
+			continue;
+		}
+
+		int kind;
+		double params[3] = { 0.0, 0.0, 0.0 };
+		int capped = 0;
+
+		if( dynamic_cast<Sphere*>( obj ) ) {
+			kind = RAYB_SPHERE;
+		} else if( dynamic_cast<Box*>( obj ) ) {
+			kind = RAYB_BOX;
+		} else if( dynamic_cast<Square*>( obj ) ) {
+			kind = RAYB_SQUARE;
+		} else if( Cylinder *cylinder = dynamic_cast<Cylinder*>( obj ) ) {
+			kind = RAYB_CYLINDER;
+			capped = cylinder->isCapped();
+		} else if( Cone *cone = dynamic_cast<Cone*>( obj ) ) {
+			kind = RAYB_CONE;
+			params[0] = cone->getHeight();
+			params[1] = cone->getBottomRadius();
+			params[2] = cone->getTopRadius();
+			capped = cone->isCapped();
+		} else {
+			throw ParseError( "scene holds an object that can't be compiled" );
+		}
+
+		out.putInt( RAYB_OBJECT );
+		out.putInt( kind );
+		out.putInt( transform );
+		out.putInt( material );
+		out.putDouble( params[0] );
+		out.putDouble( params[1] );
+		out.putDouble( params[2] );
+		out.putInt( capped );
+	}
+
+	if( scene->getBVH() ) {
+		out.putInt( RAYB_SCENE_BVH );
+		out.putBVH( *scene->getBVH() );
+	}
+
+	out.putInt( RAYB_END );
+}
+
+bool compileScene( const string& rayName, const string& raybName, const RenderOptions& options )
+{
+	RaybHeader header;
+	header.version = RAYB_VERSION;
+	header.constAtten = options.constAtten;
+	header.linearAtten = options.linearAtten;
+	header.quadAtten = options.quadAtten;
+	header.bakeMeshes = options.bakeMeshes;
+	header.traversalSize = (int)sizeof( TraversalReal );
+	if( !fileStamp( rayName, header.sourceSize, header.sourceTime ) ) {
+		cerr << "Error: couldn't read scene file " << rayName << endl;
+		return false;
+	}
+
+	Scene *scene = readTextScene( rayName, options );
+	if( !scene ) {
+		return false;
+	}
+	scene->initScene();
+
+	RaybWriter out;
+	bool ok = false;
+	try {
+		writeScene( out, scene, header );
+		ok = out.save( raybName );
+		if( !ok ) {
+			cerr << "Error: couldn't write " << raybName << endl;
+		}
+	} catch( ParseError& pe ) {
+		cerr << "Error: " << rayName << ": " << pe << endl;
+	}
+
+	delete scene;
+	return ok;
+}
+
+bool compiledSceneIsFresh( const string& raybName, const string& rayName,
+	const RenderOptions& options )
+{
+	long long size, time;
+	if( !fileStamp( rayName, size, time ) ) {
+		return false;
+	}
+
+	// only the header is needed; no point mapping the whole file
+	FILE *f = fopen( raybName.c_str(), "rb" );
+	if( !f ) {
+		return false;
+	}
+	char buf[ 64 ];
+	size_t n = fread( buf, 1, sizeof( buf ), f );
+	fclose( f );
+
+	try {
+		RaybReader in( buf, n );
+		RaybHeader header = readHeader( in );
+		return header.sourceSize == size && header.sourceTime == time
+			&& header.constAtten == options.constAtten
+			&& header.linearAtten == options.linearAtten
+			&& header.quadAtten == options.quadAtten
+			&& (header.bakeMeshes != 0) == options.bakeMeshes
+			&& header.traversalSize == (int)sizeof( TraversalReal );
+	} catch( ParseError& ) {
+		return false;
+	}
+}
+
+static Trimesh *readTrimesh( RaybReader& in, Scene *scene, const vector<Material>& materials,
+	const vector<TransformNode*>& transforms )
+{
+	TransformNode *transform = transforms[ in.getIndex( transforms.size() ) ];
+	Material *mat = new Material( materials[ in.getIndex( materials.size() ) ] );
+	Trimesh *mesh = new Trimesh( scene, mat, transform );
+
+	int vertexCount = in.getCount( 3 * sizeof( double ) );
+	for( int k = 0; k < vertexCount; ++k )
+		mesh->addVertex( in.getVec() );
+
+	int faceCount = in.getCount( 3 * sizeof( int ) );
+	for( int k = 0; k < faceCount; ++k ) {
+		int a = in.getInt();
+		int b = in.getInt();
+		int c = in.getInt();
+		if( a < 0 || b < 0 || c < 0 || !mesh->addFace( a, b, c ) ) {
+			delete mesh;
+			throw ParseError( "bad face in trimesh" );
+		}
+	}
+
+	int normalCount = in.getCount( 3 * sizeof( double ) );
+	for( int k = 0; k < normalCount; ++k )
+		mesh->addNormal( in.getVec() );
+
+	int materialCount = in.getCount( sizeof( int ) );
+	for( int k = 0; k < materialCount; ++k )
+		mesh->addMaterial( new Material( materials[ in.getIndex( materials.size() ) ] ) );
+
+	vector<BVHNode> nodes;
+	vector<int> indices;
+	in.getBVH( nodes, indices, faceCount, true );
+	mesh->setFaceBVH( nodes, indices );
+
+	if( mesh->doubleCheck() ) {
+		delete mesh;
+		throw ParseError( "bad trimesh" );
+	}
+
+	return mesh;
+}
+
+static void readObject( RaybReader& in, Scene *scene, const vector<Material>& materials,
+	const vector<TransformNode*>& transforms )
+{
+	int kind = in.getInt();
+	TransformNode *transform = transforms[ in.getIndex( transforms.size() ) ];
+	const Material& material = materials[ in.getIndex( materials.size() ) ];
+	double params[3];
+	params[0] = in.getDouble();
+	params[1] = in.getDouble();
+	params[2] = in.getDouble();
+	bool capped = in.getInt() != 0;
+
+	SceneObject *obj;
+	switch( kind ) {
+		case RAYB_SPHERE:
+		obj = new Sphere( scene, new Material( material ) );
+		break;
+
+		case RAYB_BOX:
+		obj = new Box( scene, new Material( material ) );
+		break;
+
+		case RAYB_SQUARE:
+		obj = new Square( scene, new Material( material ) );
+		break;
+
+		case RAYB_CYLINDER:
+		obj = new Cylinder( scene, new Material( material ), capped );
+		break;
+
+		case RAYB_CONE:
+		obj = new Cone( scene, new Material( material ), params[0], params[1], params[2], capped );
+		break;
+
+		default:
+		throw ParseError( "unknown kind of object" );
+	}
+
+	obj->setTransform( transform );
+	scene->add( obj );
+}
+
+static void readLight( RaybReader& in, Scene *scene )
+{
+	int kind = in.getInt();
+	vec3f color = in.getVec();
+	vec3f where = in.getVec();
+	double atten[3];
+	atten[0] = in.getDouble();
+	atten[1] = in.getDouble();
+	atten[2] = in.getDouble();
+
+	switch( kind ) {
+		case RAYB_DIRECTIONAL_LIGHT:
+		scene->add( new DirectionalLight( scene, where, color ) );
+		break;
+
+		case RAYB_POINT_LIGHT:
+		{
+			PointLight *light = new PointLight( scene, where, color );
+			light->setDistanceAttenuation( atten[0], atten[1], atten[2] );
+			scene->add( light );
+		}
+		break;
+
+		case RAYB_AMBIENT_LIGHT:
+		scene->add( new AmbientLight( scene, vec3f( 1, 1, 1 ), color ) );
+		break;
+
+		default:
+		throw ParseError( "unknown kind of light" );
+	}
+}
+
+Scene *readCompiledScene( const string& raybName )
+{
+	MappedFile file( raybName );
+	if( !file.data() ) {
+		cerr << "Error: couldn't read compiled scene " << raybName << endl;
+		return NULL;
+	}
+
+	Scene *scene = new Scene;
+	try {
+		RaybReader in( file.data(), file.size() );
+		readHeader( in );
+
+		vector<Material> materials;
+		vector<TransformNode*> transforms;
+		vector<SceneObject*> sharedMeshes;
+		int boundedCount = 0;
+
+		while( true ) {
+			int tag = in.getInt();
+			if( tag == RAYB_END ) {
+				break;
+			}
+
+			switch( tag ) {
+				case RAYB_CAMERA:
+				{
+					vec3f eye = in.getVec();
+					vec3f r0 = in.getVec();
+					vec3f r1 = in.getVec();
+					vec3f r2 = in.getVec();
+					double normalizedHeight = in.getDouble();
+					double aspectRatio = in.getDouble();
+					scene->getCamera()->setView( eye, mat3f( r0, r1, r2 ), normalizedHeight, aspectRatio );
+				}
+				break;
+
+				case RAYB_AMBIENT:
+				scene->setAmbient( in.getVec() );
+				break;
+
+				case RAYB_MATERIALS:
+				materials.resize( in.getCount( 20 * sizeof( double ) ) );
+				for( size_t k = 0; k < materials.size(); ++k )
+					materials[k] = readMaterial( in );
+				break;
+
+				case RAYB_TRANSFORMS:
+				{
+					// each one hangs straight off the root, which is the
+					// identity, so it comes out exactly as saved
+					int count = in.getCount( 16 * sizeof( double ) );
+					for( int k = 0; k < count; ++k ) {
+						mat4f xform;
+						for( int row = 0; row < 4; ++row )
+							for( int col = 0; col < 4; ++col )
+								xform[row][col] = in.getDouble();
+						transforms.push_back( scene->transformRoot.createChild( xform ) );
+					}
+				}
+				break;
+
+				case RAYB_LIGHT:
+				readLight( in, scene );
+				break;
+
+				case RAYB_OBJECT:
+				readObject( in, scene, materials, transforms );
+				++boundedCount;
+				break;
+
+				case RAYB_TRIMESH:
+				scene->add( readTrimesh( in, scene, materials, transforms ) );
+				++boundedCount;
+				break;
+
+				case RAYB_SHARED_MESH:
+				{
+					string name = in.getString();
+					Trimesh *mesh = readTrimesh( in, scene, materials, transforms );
+					if( scene->getShared( name ) || mesh->getTransform()->getKind() != TransformNode::IDENTITY ) {
+						delete mesh;
+						throw ParseError( "bad shared mesh" );
+					}
+					scene->addShared( name, mesh );
+					sharedMeshes.push_back( mesh );
+				}
+				break;
+
+				case RAYB_INSTANCE:
+				{
+					TransformNode *transform = transforms[ in.getIndex( transforms.size() ) ];
+					SceneObject *shared = sharedMeshes[ in.getIndex( sharedMeshes.size() ) ];
+					scene->add( new Instance( scene, shared, transform ) );
+					++boundedCount;
+				}
+				break;
+
+				case RAYB_SCENE_BVH:
+				{
+					vector<BVHNode> nodes;
+					vector<int> indices;
+					in.getBVH( nodes, indices, boundedCount, false );
+
+					BVH *bvh = new BVH;
+					bvh->assign( nodes, indices );
+					scene->setBVH( bvh );
+				}
+				break;
+
+				default:
+				throw ParseError( "unknown record" );
+			}
+		}
+	} catch( ParseError& pe ) {
+		cerr << "Error: " << raybName << ": " << pe << endl;
+		delete scene;
+		return NULL;
+	}
+
+	return scene;
+}
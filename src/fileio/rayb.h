@@ -0,0 +1,44 @@
+//
+// rayb.h
+//
+// Compiled scenes.  A .rayb file holds a scene as it stands once loaded:
+// a flattened transform per object, a table of materials, meshes as flat
+// arrays of vertices, faces and normals, and the bounding volume
+// hierarchies already built.  Loading one maps the file into memory and
+// copies the arrays out; there is nothing to parse and nothing to build.
+//
+// The file also records the size and modification time of the .ray file
+// it was compiled from, the render options that went into it and whether
+// the build that wrote it keeps meshes in float or double (see
+// RAY_FLOAT_TRAVERSAL).  readScene() uses the compiled copy next to a .ray
+// file (scene.ray -> scene.rayb) only while all of those still match.
+//
+
+#ifndef __RAYB_H__
+#define __RAYB_H__
+
+#include <string>
+
+#include "../scene/scene.h"
+#include "../RenderOptions.h"
+
+// Parse rayName and write it out compiled as raybName.  Returns false, with
+// the reason printed, if either step fails.
+bool compileScene( const string& rayName, const string& raybName,
+	const RenderOptions& options = RenderOptions() );
+
+// Where readScene() looks for the compiled copy of rayName.
+string compiledSceneName( const string& rayName );
+
+// Does the name end in .rayb?
+bool isCompiledSceneName( const string& filename );
+
+// Is raybName a compiled copy of rayName as it is now, loaded with options?
+bool compiledSceneIsFresh( const string& raybName, const string& rayName,
+	const RenderOptions& options );
+
+// Load a compiled scene.  Returns NULL, with the reason printed, if the file
+// can't be read or isn't one this version understands.
+Scene *readCompiledScene( const string& raybName );
+
+#endif // __RAYB_H__
@@ -3,69 +3,112 @@
 #endif
 
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
-#include <fstream>
+#include <iterator>
 #include <strstream>
 
 #include <vector>
 
 #include "read.h"
 #include "parse.h"
+#include "rayb.h"
 
 #include "../scene/scene.h"
 #include "../SceneObjects/trimesh.h"
 #include "../SceneObjects/Box.h"
 #include "../SceneObjects/Cone.h"
 #include "../SceneObjects/Cylinder.h"
+#include "../SceneObjects/Instance.h"
 #include "../SceneObjects/Sphere.h"
 #include "../SceneObjects/Square.h"
 #include "../scene/light.h"
 
 typedef map<string,Material*> mmap;
 
-extern TraceUI* traceUI;
-static void processObject( Obj *obj, Scene *scene, mmap& materials );
+static void processObject( Obj *obj, Scene *scene, mmap& materials, const RenderOptions& options );
 static Obj *getColorField( Obj *obj );
 static Obj *getField( Obj *obj, const string& name );
 static bool hasField( Obj *obj, const string& name );
 static vec3f tupleToVec( Obj *obj );
 static void processGeometry( string name, Obj *child, Scene *scene,
 	const mmap& materials, TransformNode *transform );
-static void processTrimesh( string name, Obj *child, Scene *scene,
+static Trimesh *processTrimesh( string name, Obj *child, Scene *scene,
                                      const mmap& materials, TransformNode *transform );
+static string getName( Obj *field );
 static void processCamera( Obj *child, Scene *scene );
 static Material *getMaterial( Obj *child, const mmap& bindings );
 static Material *processMaterial( Obj *child, mmap *bindings = NULL );
 static void verifyTuple( const mytuple& tup, size_t size );
+static Scene *parseScene( const char *begin, const char *end, const RenderOptions& options );
 
-Scene *readScene( const string& filename )
+Scene *readScene( const string& filename, const RenderOptions& options )
 {
-	ifstream ifs( filename.c_str() );
-	if( !ifs ) {
+	if( isCompiledSceneName( filename ) ) {
+		return readCompiledScene( filename );
+	}
+
+	string compiled = compiledSceneName( filename );
+	if( compiledSceneIsFresh( compiled, filename, options ) ) {
+		Scene *scene = readCompiledScene( compiled );
+		if( scene ) {
+			return scene;
+		}
+	}
+
+	return readTextScene( filename, options );
+}
+
+Scene *readTextScene( const string& filename, const RenderOptions& options )
+{
+	// Read the whole file in one go; the parser works on the text in memory.
+	FILE *f = fopen( filename.c_str(), "rb" );
+	if( !f ) {
 		cerr << "Error: couldn't read scene file " << filename << endl;
 		return NULL;
 	}
 
+	vector<char> text;
+	fseek( f, 0, SEEK_END );
+	long size = ftell( f );
+	fseek( f, 0, SEEK_SET );
+	if( size > 0 ) {
+		text.resize( size );
+		size = (long) fread( &text[0], 1, size, f );
+	}
+	fclose( f );
+	if( size < 0 ) {
+		size = 0;
+	}
+	text.resize( size );
+	text.push_back( '\0' );
+
 	try {
-		return readScene( ifs );
+		return parseScene( &text[0], &text[0] + size, options );
 	} catch( ParseError& pe ) {
 		cout << "Parse error: " << pe << endl;
 		return NULL;
 	}
 }
 
-Scene *readScene( istream& is )
+Scene *readScene( istream& is, const RenderOptions& options )
+{
+	string text( (istreambuf_iterator<char>( is )), istreambuf_iterator<char>() );
+	return parseScene( text.c_str(), text.c_str() + text.size(), options );
+}
+
+// Parse the scene in [begin, end).  *end must be '\0'.
+static Scene *parseScene( const char *begin, const char *end, const RenderOptions& options )
 {
-	Scene *ret = new Scene;
-	
 	// Extract the file header
 	static const int MAXNAME = 80;
 	char buf[ MAXNAME ];
 	int ct = 0;
+	const char *pos = begin;
 
-	while( ct < MAXNAME - 1 ) {
-		char c;
-		is.get( c );
+	while( ct < MAXNAME - 1 && pos < end ) {
+		char c = *pos++;
 		if( c == ' ' || c == '\t' || c == '\n' ) {
 			break;
 		}
@@ -78,8 +121,9 @@ Scene *readScene( istream& is )
 		throw ParseError( string( "Input is not an SBT input file." ) );
 	}
 
-	float version;
-	is >> version;
+	char *versionEnd;
+	double version = strtod( pos, &versionEnd );
+	pos = versionEnd;
 
 	if( version != 1.0 ) {
 		ostrstream oss;
@@ -88,19 +132,26 @@ Scene *readScene( istream& is )
 		throw ParseError( string( oss.str() ) );
 	}
 
-	// vector<Obj*> result;
+	Scene *ret = new Scene;
 	mmap materials;
 
 	while( true ) {
-		Obj *cur = readFile( is );
+		Obj *cur = readFile( pos, end );
 		if( !cur ) {
 			break;
 		}
 
-		processObject( cur, ret, materials );
+		processObject( cur, ret, materials, options );
 		delete cur;
 	}
 
+	if( options.bakeMeshes ) {
+		for( Scene::cgiter g = ret->beginObjects(); g != ret->endObjects(); ++g ) {
+			if( Trimesh *mesh = dynamic_cast<Trimesh*>( *g ) )
+				mesh->bakeTransform( &ret->transformRoot );
+		}
+	}
+
 	return ret;
 }
 
@@ -158,11 +209,31 @@ static bool hasField( Obj *obj, const string& name )
 // Turn a parsed tuple into a 3D point.
 static vec3f tupleToVec( Obj *obj )
 {
+	const NumberTupleObj *numbers = obj->getNumbers();
+	if( numbers && !numbers->isNested() && numbers->rowSize( 0 ) == 3 ) {
+		const double *v = numbers->getRow( 0 );
+		return vec3f( v[0], v[1], v[2] );
+	}
+
 	const mytuple& t = obj->getTuple();
 	verifyTuple( t, 3 );
 	return vec3f( t[0]->getScalar(), t[1]->getScalar(), t[2]->getScalar() );
 }
 
+// Turn row r of a tuple of number tuples into a 3D point.
+static vec3f rowToVec( const NumberTupleObj *rows, int r )
+{
+	if( rows->rowSize( r ) != 3 ) {
+		ostrstream oss;
+		oss << "Bad tuple size " << rows->rowSize( r ) << ", expected 3" << ends;
+
+		throw ParseError( string( oss.str() ) );
+	}
+
+	const double *v = rows->getRow( r );
+	return vec3f( v[0], v[1], v[2] );
+}
+
 static void processGeometry( Obj *obj, Scene *scene,
 	const mmap& materials, TransformNode *transform )
 {
@@ -293,7 +364,17 @@ static void processGeometry( string name, Obj *child, Scene *scene,
                                                              l4[2]->getScalar(),
                                                              l4[3]->getScalar() ) ) ) );
 	} else if( name == "trimesh" || name == "polymesh" ) { // 'polymesh' is for backwards compatibility
-        processTrimesh( name, child, scene, materials, transform);
+        scene->add( processTrimesh( name, child, scene, materials, transform ) );
+	} else if( name == "instance" ) {
+		if( child == NULL || !hasField( child, "mesh" ) )
+			throw ParseError( "No mesh for instance" );
+
+		string meshName = getName( getField( child, "mesh" ) );
+		SceneObject *shared = scene->getShared( meshName );
+		if( !shared )
+			throw ParseError( "Instance of undefined mesh " + meshName );
+
+		scene->add( new Instance( scene, shared, transform ) );
     } else {
 		SceneObject *obj = NULL;
        	Material *mat;
@@ -332,7 +413,7 @@ static void processGeometry( string name, Obj *child, Scene *scene,
 	}
 }
 
-static void processTrimesh( string name, Obj *child, Scene *scene,
+static Trimesh *processTrimesh( string name, Obj *child, Scene *scene,
                                      const mmap& materials, TransformNode *transform )
 {
     Material *mat;
@@ -344,29 +425,67 @@ static void processTrimesh( string name, Obj *child, Scene *scene,
     
     Trimesh *tmesh = new Trimesh( scene, mat, transform);
 
-    const mytuple &points = getField( child, "points" )->getTuple();
-    for( mytuple::const_iterator pi = points.begin(); pi != points.end(); ++pi )
-        tmesh->addVertex( tupleToVec( *pi ) );
-                
-    const mytuple &faces = getField( child, "faces" )->getTuple();
-    for( mytuple::const_iterator fi = faces.begin(); fi != faces.end(); ++fi )
+    // Meshes of any size come out of the parser as flat arrays of numbers;
+    // read them straight from those and only walk the object tree when
+    // the lists hold something else.
+    Obj *points = getField( child, "points" );
+    const NumberTupleObj *pointRows = points->getNumbers();
+    if( pointRows && pointRows->isNested() )
     {
-        const mytuple &pointids = (*fi)->getTuple();
-
-        // triangulate here and now.  assume the poly is
-        // concave and we can triangulate using an arbitrary fan
-        if( pointids.size() < 3 )
-            throw ParseError( "Faces must have at least 3 vertices." );
+        for( int r = 0; r < pointRows->numRows(); ++r )
+            tmesh->addVertex( rowToVec( pointRows, r ) );
+    }
+    else
+    {
+        const mytuple &pts = points->getTuple();
+        for( mytuple::const_iterator pi = pts.begin(); pi != pts.end(); ++pi )
+            tmesh->addVertex( tupleToVec( *pi ) );
+    }
 
-        mytuple::const_iterator i = pointids.begin();
-        int a = (int) (*i++)->getScalar();
-        int b = (int) (*i++)->getScalar();
-        while( i != pointids.end() )
+    Obj *faces = getField( child, "faces" );
+    const NumberTupleObj *faceRows = faces->getNumbers();
+    if( faceRows && faceRows->isNested() )
+    {
+        for( int r = 0; r < faceRows->numRows(); ++r )
+        {
+            const double *ids = faceRows->getRow( r );
+            int count = faceRows->rowSize( r );
+            if( count < 3 )
+                throw ParseError( "Faces must have at least 3 vertices." );
+
+            int a = (int) ids[0];
+            int b = (int) ids[1];
+            for( int k = 2; k < count; ++k )
+            {
+                int c = (int) ids[k];
+                if( !tmesh->addFace(a,b,c) )
+                    throw ParseError( "Bad face in trimesh." );
+                b = c;
+            }
+        }
+    }
+    else
+    {
+        const mytuple &fcs = faces->getTuple();
+        for( mytuple::const_iterator fi = fcs.begin(); fi != fcs.end(); ++fi )
         {
-            int c = (int) (*i++)->getScalar();
-            if( !tmesh->addFace(a,b,c) )
-                throw ParseError( "Bad face in trimesh." );
-            b = c;
+            const mytuple &pointids = (*fi)->getTuple();
+
+            // triangulate here and now.  assume the poly is
+            // concave and we can triangulate using an arbitrary fan
+            if( pointids.size() < 3 )
+                throw ParseError( "Faces must have at least 3 vertices." );
+
+            mytuple::const_iterator i = pointids.begin();
+            int a = (int) (*i++)->getScalar();
+            int b = (int) (*i++)->getScalar();
+            while( i != pointids.end() )
+            {
+                int c = (int) (*i++)->getScalar();
+                if( !tmesh->addFace(a,b,c) )
+                    throw ParseError( "Bad face in trimesh." );
+                b = c;
+            }
         }
     }
 
@@ -383,16 +502,34 @@ static void processTrimesh( string name, Obj *child, Scene *scene,
     }
     if( hasField( child, "normals" ) )
     {
-        const mytuple &norms = getField( child, "normals" )->getTuple();
-        for( mytuple::const_iterator ni = norms.begin(); ni != norms.end(); ++ni )
-            tmesh->addNormal( tupleToVec( *ni ) );
+        Obj *normals = getField( child, "normals" );
+        const NumberTupleObj *normalRows = normals->getNumbers();
+        if( normalRows && normalRows->isNested() )
+        {
+            for( int r = 0; r < normalRows->numRows(); ++r )
+                tmesh->addNormal( rowToVec( normalRows, r ) );
+        }
+        else
+        {
+            const mytuple &norms = normals->getTuple();
+            for( mytuple::const_iterator ni = norms.begin(); ni != norms.end(); ++ni )
+                tmesh->addNormal( tupleToVec( *ni ) );
+        }
     }
 
     char *error;
     if( error = tmesh->doubleCheck() )
         throw ParseError( error );
 
-    scene->add(tmesh);
+    return tmesh;
+}
+
+// The name in a name field, which may be an identifier or a string.
+static string getName( Obj *field )
+{
+	if( field->getTypeName() == "id" )
+		return field->getID();
+	return field->getString();
 }
 
 static Material *getMaterial( Obj *child, const mmap& bindings )
@@ -448,7 +585,6 @@ static Material *processMaterial( Obj *child, mmap *bindings )
     }
     if( hasField( child, "shininess" ) ) {
         mat->shininess = getField( child, "shininess" )->getScalar();
-		printf("shininess: %f\n", getField(child, "shininess")->getScalar());
     }
 
     if( bindings != NULL ) {
@@ -500,7 +636,7 @@ processCamera( Obj *child, Scene *scene )
     }
 }
 
-static void processObject( Obj *obj, Scene *scene, mmap& materials )
+static void processObject( Obj *obj, Scene *scene, mmap& materials, const RenderOptions& options )
 {
 	// Assume the object is named.
 	string name;
@@ -536,7 +672,6 @@ static void processObject( Obj *obj, Scene *scene, mmap& materials )
 		vec3f color = tupleToVec(getColorField(child));
 		scene->add(new AmbientLight(scene, vec3f(1,1,1), color));
 		scene->setAmbient(color);
-		printf("Color: %f %f %f\n", color[0], color[1], color[2]);
 	}	
 	else if( name == "point_light" ) {
 		if( child == NULL ) {
@@ -560,9 +695,9 @@ static void processObject( Obj *obj, Scene *scene, mmap& materials )
 		else
 		{
 			light->setDistanceAttenuation(
-				traceUI->getConstantAttenuation(),
-				traceUI->getLinearAttenuation(),
-				traceUI->getQuadraticAttenuation()
+				options.constAtten,
+				options.linearAtten,
+				options.quadAtten
 				);
 		}
 	} else if( 	name == "sphere" ||
@@ -575,9 +710,21 @@ static void processObject( Obj *obj, Scene *scene, mmap& materials )
 				name == "scale" ||
 				name == "transform" ||
                 name == "trimesh" ||
-                name == "polymesh") { // polymesh is for backwards compatibility.
+                name == "polymesh" || // polymesh is for backwards compatibility.
+				name == "instance" ) {
 		processGeometry( name, child, scene, materials, &scene->transformRoot);
 		//scene->add( geo );
+	} else if( name == "mesh" ) {
+		// a mesh for instances to share, given as a trimesh is, which
+		// isn't in the scene until they put it there
+		if( child == NULL || !hasField( child, "name" ) )
+			throw ParseError( "Attempt to define mesh with no name" );
+
+		string meshName = getName( getField( child, "name" ) );
+		if( scene->getShared( meshName ) )
+			throw ParseError( "Mesh " + meshName + " defined twice" );
+		scene->addShared( meshName,
+			processTrimesh( name, child, scene, materials, &scene->transformRoot ) );
 	} else if( name == "material" ) {
 		processMaterial( child, &materials );
 	} else if( name == "camera" ) {
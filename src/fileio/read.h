@@ -5,9 +5,15 @@
 #include <iostream>
 
 #include "../scene/scene.h"
-#include "../ui/TraceUI.h"
+#include "../RenderOptions.h"
 
-Scene *readScene( const string& filename );
-Scene *readScene( istream& is );
+// options supplies the defaults for anything the scene leaves out.  A
+// compiled scene (see rayb.h) is loaded in place of filename when there is
+// an up to date one, or if filename names one itself.
+Scene *readScene( const string& filename, const RenderOptions& options = RenderOptions() );
+Scene *readScene( istream& is, const RenderOptions& options = RenderOptions() );
+
+// Parse the text of filename, compiled copy or not.
+Scene *readTextScene( const string& filename, const RenderOptions& options = RenderOptions() );
 
 #endif // __READ_H__
@@ -22,6 +22,17 @@
 #include <ctype.h>
 #include <string.h>
 
+// Only Windows has options start with '/' too; elsewhere that's how
+// absolute paths start.
+static bool isOptionStart(char ch)
+{
+#ifdef _WIN32
+    return ch == '-' || ch == '/';
+#else
+    return ch == '-';
+#endif
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //  FUNCTION: GetOption()
@@ -34,7 +45,7 @@
 //      argv - array of command line argument strings
 //      pszValidOpts - string of valid, case-sensitive option characters,
 //                     a colon ':' following a given character means that
-//                     option can take a parameter
+//                     option must have a parameter
 //      ppszParam - pointer to a pointer to a string for output
 //
 //  RETURNS:
@@ -44,8 +55,9 @@
 //          or is NULL if no param
 //      If standalone parameter (with no option) is found, 1 is returned,
 //          and *ppszParam points to the standalone parameter
-//      If option is found, but it is not in the list of valid options,
-//          -1 is returned, and *ppszParam points to the invalid argument
+//      If option is found, but it is not in the list of valid options
+//          or is missing its parameter, -1 is returned, and *ppszParam
+//          points to the invalid argument
 //      When end of argument list is reached, 0 is returned, and
 //          *ppszParam is NULL
 //
@@ -59,7 +71,7 @@ int optind, opterr, optopt;
 int GetOption (
     int argc,
     char** argv,
-    char* pszValidOpts,
+    const char* pszValidOpts,
     char** ppszParam)
 {
     static int iArg = 1;
@@ -70,18 +82,18 @@ int GetOption (
     if (iArg < argc)
     {
         psz = &(argv[iArg][0]);
-        if (*psz == '-' || *psz == '/')
+        if (isOptionStart(*psz))
         {
             // we have an option specifier
             chOpt = argv[iArg][1];
             if (isalnum(chOpt) || ispunct(chOpt))
             {
                 // we have an option character
-                psz = strchr(pszValidOpts, chOpt);
-                if (psz != NULL)
+                const char* pszOpt = strchr(pszValidOpts, chOpt);
+                if (pszOpt != NULL)
                 {
                     // option is valid, we want to return chOpt
-                    if (psz[1] == ':')
+                    if (pszOpt[1] == ':')
                     {
                         // option can have a parameter
                         psz = &(argv[iArg][2]);
@@ -91,10 +103,14 @@ int GetOption (
                             if (iArg+1 < argc)
                             {
                                 psz = &(argv[iArg+1][0]);
-                                if (*psz == '-' || *psz == '/')
+                                // a negative number is a param, not an option
+                                bool number = *psz == '-' && (isdigit(psz[1]) || psz[1] == '.');
+                                if (isOptionStart(*psz) && !number)
                                 {
                                     // next argv is a new option, so param
                                     // not given for current option
+                                    chOpt = -1;
+                                    pszParam = &(argv[iArg][0]);
                                 }
                                 else
                                 {
@@ -106,6 +122,8 @@ int GetOption (
                             else
                             {
                                 // reached end of args looking for param
+                                chOpt = -1;
+                                pszParam = &(argv[iArg][0]);
                             }
 
                         }
@@ -154,17 +172,14 @@ int GetOption (
     return (chOpt);
 }
 
-int getopt(int argc, char **argv, char *optstring)
+int getopt(int argc, char **argv, const char *optstring)
 {
 	int i;
 	
 	i = GetOption(argc, argv, optstring, &optarg);
 
 	if (i==0 || i==1) return EOF;
-	else if (i==-1) {
-		char c=*(optarg+1);
-		return c;
-	}
+	else if (i==-1) return '?';
 	else return i;
 }
 			
@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <vector>
+
+#include "heatmap.h"
+
+using namespace std;
+
+// the ramp, evenly spaced from 0 to 1
+static const unsigned char ramp[][3] = {
+	{   0,   0,   0 },
+	{   0,   0, 255 },
+	{   0, 255, 255 },
+	{   0, 255,   0 },
+	{ 255, 255,   0 },
+	{ 255,   0,   0 },
+};
+static const int rampSteps = sizeof( ramp ) / sizeof( ramp[0] ) - 1;
+
+double costHeatmap( const float *costs, int width, int height, unsigned char *rgb, double scale )
+{
+	int pixels = width * height;
+	if( scale <= 0.0 && pixels > 0 ) {
+		vector<float> sorted( costs, costs + pixels );
+		vector<float>::iterator p = sorted.begin() + (pixels - 1) * 99 / 100;
+		nth_element( sorted.begin(), p, sorted.end() );
+		scale = *p;
+	}
+	if( scale <= 0.0 ) {
+		// nothing cost anything, or the 99th percentile is free too
+		scale = 1.0;
+		for( int k = 0; k < pixels; ++k )
+			scale = max( scale, (double)costs[k] );
+	}
+
+	for( int k = 0; k < pixels; ++k, rgb += 3 ) {
+		double x = min( max( costs[k] / scale, 0.0 ), 1.0 ) * rampSteps;
+		int step = min( (int)x, rampSteps - 1 );
+		double f = x - step;
+		for( int c = 0; c < 3; ++c )
+			rgb[c] = (unsigned char)( ramp[step][c] + f * (ramp[step + 1][c] - ramp[step][c]) + 0.5 );
+	}
+
+	return scale;
+}
+
+const char *costUnits( CostMeasure measure )
+{
+	switch( measure ) {
+		case COST_TIME:		return "ns";
+		case COST_RAYS:		return "rays";
+		case COST_TESTS:	return "node visits and primitive tests";
+		default:			return "";
+	}
+}
@@ -0,0 +1,20 @@
+#ifndef __HEATMAP_H__
+#define __HEATMAP_H__
+
+#include "RenderOptions.h"
+
+// False-colour images of what each pixel cost to render, from
+// RayTracer::getCosts(), to show at a glance where the time goes.
+
+// Colour costs, one per pixel, on a ramp running from black for nothing
+// through blue, cyan, green and yellow to red for scale and above, into
+// rgb, three bytes a pixel.  With scale <= 0 the ramp tops out at the
+// 99th percentile of the costs, so that a few very costly pixels don't
+// leave the rest all blue.  Returns the scale used.
+double costHeatmap( const float *costs, int width, int height, unsigned char *rgb,
+	double scale = 0.0 );
+
+// The name of measure for messages, "ns" for COST_TIME and so on.
+const char *costUnits( CostMeasure measure );
+
+#endif // __HEATMAP_H__
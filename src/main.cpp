@@ -7,13 +7,17 @@
 // noted as such.  A quick explanation of the various methods follows the
 // diagram.
 //
-// main
+// main (renderCommandLine, in cli.cpp)
 //  |
 //  +- RayTracer::loadScene
 //  |
 //  +- RayTracer::traceSetup
 //  |
-//  +- RayTracer::traceLines
+//  +- RayTracer::traceTiles
+//        |
+//        +- RayTracer::traceTile
+//        |
+//        +- RayTracer::tracePacket (with -p)
 //        |
 //        +- RayTracer::tracePixel
 //              |
@@ -34,15 +38,16 @@
 //                          +- Material::shade
 //
 // The loadScene and traceSetup methods load a file and set up all the internal
-// buffers necessary to render the scene.  The traceLines method begins the
-// process of actually rendering the image, one scanline at a time.  It does
-// this by calling tracePixel for each pixel in the image.  tracePixel is given
-// a coordinate pair which is converted into an (x,y) screen coordinate and
-// passed to trace.  The trace method calculates a ray from the camera position
-// through the (x,y) coordinate and then calls traceRay to see if this ray
-// actually intersects any objects in the scene.  The intersect method in
-// Scene calls intersect on each object in the scene (part of your assignment
-// is an acceleration or culling process that cuts this down significantly).
+// buffers necessary to render the scene.  The traceTiles method begins the
+// process of actually rendering the image, handing out square tiles of it to
+// a pool of worker threads.  Each tile is rendered by calling tracePixel for
+// each of its pixels.  tracePixel is given a coordinate pair which is
+// converted into an (x,y) screen coordinate and passed to trace.  The trace
+// method calculates a ray from the camera position through the (x,y)
+// coordinate and then calls traceRay to see if this ray actually intersects
+// any objects in the scene.  The intersect method in Scene calls intersect on
+// each object in the scene (part of your assignment is an acceleration or
+// culling process that cuts this down significantly).
 // Each object in the scene is a descendant of Geometry and has its own
 // intersectLocal routine (you need to fill this method in for the Box class).
 // The intersect method actually converts the ray into the coordinate frame
@@ -55,7 +60,6 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 
 #include <FL/Fl.h>
 #include <FL/Fl_Window.H>
@@ -65,82 +69,25 @@
 
 #include "ui/TraceUI.h"
 #include "RayTracer.h"
-
-#include "fileio/bitmap.h"
-
-// ***********************************************************
-// from getopt.cpp 
-// it should be put in an include file.
-//
-extern int getopt(int argc, char **argv, char *optstring);
-extern char* optarg;
-extern int optind, opterr, optopt;
-// ***********************************************************
+#include "cli.h"
+#include "report.h"
 
 RayTracer* theRayTracer;
 TraceUI* traceUI;
 
-//
-// options from program parameters
-//
-int recursion_depth = 0;
-int g_height;
-int g_width = 150;
-bool bReport = false;
-char *progname, *rayName, *imgName;
+char *progname;
 
 void usage()
 {
 #ifdef WIN32
-	fl_alert( "usage: %s [-r <#> -w <#> -t] [input.ray output.bmp]\n", progname );
+	fl_alert( "usage: %s [-r <#> -w <#> -j <#> -p <#> -a <#> -A <#> -t -s <file> -S <#> -R -f <file> -e <#> -T <how>] [input.ray output.bmp]\n"
+		"       %s -H heatmap.bmp [-m time|rays|tests] [options] input.ray [output.bmp]\n"
+		"       %s -c input.ray [output.rayb]\n", progname, progname, progname );
 #else
-	fprintf( stderr, "usage: %s [options] [input.ray output.bmp]\n", progname );
-	fprintf( stderr, "  -r <#>      set recurssion level (default %d)\n", recursion_depth );
-	fprintf( stderr, "  -w <#>      set output image width (default %d)\n", g_width );
-	fprintf( stderr, "  -t			report time statistics\n" );
+	printUsage( stderr, progname );
 #endif
 }
 
-bool processArgs(int argc, char **argv) {
-	int i;
-
-    while ( (i = getopt( argc, argv, "tr:w:h:" )) != EOF )
-	{
-		switch ( i )
-		{
-			case 't':
-			bReport = true;
-			break;
-	    
-			case 'r':
-			recursion_depth = atoi( optarg );
-			break;
-	    
-			case 'w':
-			g_width = atoi( optarg );
-			break;
-	    
-			case 'h':
-			g_height = atoi( optarg );
-			break;
-
-			default:
-			return false;
-		}
-    }
-
-    if ( optind >= argc-1 )
-    {
-		fprintf( stderr, "no input and/or output name.\n" );
-		return false;
-    }
-
-    rayName = argv[optind];
-    imgName = argv[optind+1];
-
-	return true;
-}
-
 // usage : ray [option] in.ray out.bmp
 // Simply keying in ray will invoke a graphics mode version.
 // Use "ray --help" to see the detailed usage.
@@ -154,41 +101,23 @@ int main(int argc, char **argv) {
 
 	if (argc!=1) {
 		// text mode
-		if (!processArgs(argc, argv)) {
+		CommandLine cl;
+		if (!parseCommandLine(argc, argv, cl)) {
 			usage();
 			exit(1);
 		}
-		
-		theRayTracer=new RayTracer();
-		theRayTracer->loadScene(rayName);
-	
-		if (theRayTracer->sceneLoaded()) {
-			g_height = (int)(g_width / theRayTracer->aspectRatio() + 0.5);
-
-			theRayTracer->traceSetup(g_width, g_height);
-		
-			clock_t start, end;
-			start=clock();
 
-			theRayTracer->traceLines(0, g_height);
-		
-			end=clock();
-
-			// save image
-			unsigned char* buf;
-
-			theRayTracer->getBuffer(buf, g_width, g_height);
-			if (buf)
-				writeBMP(imgName, g_width, g_height, buf); 
+		if (cl.compile) {
+			compileCommandLine(cl);
+			return 1;
+		}
 
-			if (bReport) {
-				double t=(double)(end-start)/CLOCKS_PER_SEC;
+		RenderReport report;
+		if (renderCommandLine(cl, report) && cl.report) {
 #ifdef WIN32
-				fl_message( "total time = %.3f seconds\n", t); 
-#else
-				fprintf( stderr, "total time = %.3f seconds\n", t); 
+			// stderr goes nowhere without a console
+			fl_message( "total time = %.3f seconds\n", report.renderSeconds); 
 #endif
-			}
 		}
 
 		return 1;
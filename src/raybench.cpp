@@ -0,0 +1,379 @@
+// Benchmarks: renders a fixed set of the sample scenes at fixed sizes,
+// depths and thread counts, without writing any images, and reports how
+// fast each went.  Given the results of an earlier run it flags the cases
+// that got slower by more than a threshold and fails, so it can gate a
+// change.
+//
+// usage : ray-bench [options] [case ...]
+//
+// Naming cases runs only those whose names contain one of the arguments.
+// Results written with -o can be given back with -b as the baseline.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment( lib, "psapi.lib" )
+#else
+#include <sys/resource.h>
+#endif
+
+#include "RayTracer.h"
+#include "scene/counters.h"
+
+using namespace std;
+
+// from getopt.cpp
+extern int getopt( int argc, char **argv, const char *optstring );
+extern char* optarg;
+extern int optind, opterr, optopt;
+
+#ifndef RAY_SAMPLES_DIR
+#define RAY_SAMPLES_DIR "simpleSamples"
+#endif
+
+struct BenchCase
+{
+	const char *scene;
+	int width;
+	int depth;
+	int threads;		// 0 for one per hardware thread
+};
+
+// The meshes stress the hierarchies and are run on every core as well as
+// on one; the rest stress recursion and transparent shadows.  The images
+// are big enough that each render takes long enough to time steadily.
+static const BenchCase benchCases[] = {
+	{ "tentacles.ray",				1024, 5, 1 },
+	{ "tentacles.ray",				1024, 5, 0 },
+	{ "hitchcock.ray",				1024, 5, 1 },
+	{ "hitchcock.ray",				1024, 5, 0 },
+	{ "shell_easy.ray",				1024, 5, 1 },
+	{ "shell_easy.ray",				1024, 5, 0 },
+	{ "sphere_refract.ray",			1024, 2, 1 },
+	{ "sphere_refract.ray",			1024, 10, 1 },
+	{ "recurse_depth.ray",			1024, 2, 1 },
+	{ "recurse_depth.ray",			1024, 10, 1 },
+	{ "box_cyl_transp_shadow.ray",	1024, 5, 1 },
+};
+
+struct BenchResult
+{
+	string name;
+	double loadSeconds;		// parsing and preparing the scene
+	double seconds;			// the fastest render
+	double mraysPerSecond;
+	long long peakRSS;		// bytes, 0 if unknown
+	bool ok;
+};
+
+static string caseName( const BenchCase& c )
+{
+	string name = c.scene;
+	size_t dot = name.rfind( '.' );
+	if( dot != string::npos )
+		name.erase( dot );
+
+	char buf[64];
+	if( c.threads )
+		sprintf( buf, "-w%d-r%d-j%d", c.width, c.depth, c.threads );
+	else
+		sprintf( buf, "-w%d-r%d-jall", c.width, c.depth );
+	return name + buf;
+}
+
+// Start counting the peak resident set size again from here, from what is
+// resident now, where the system allows it; elsewhere peakRSS() gives the
+// process's peak so far.
+static void resetPeakRSS()
+{
+#ifdef __linux__
+	FILE *f = fopen( "/proc/self/clear_refs", "w" );
+	if( f ) {
+		fputs( "5", f );
+		fclose( f );
+	}
+#endif
+}
+
+static long long peakRSS()
+{
+#ifdef __linux__
+	// VmHWM is what resetPeakRSS() resets; getrusage()'s peak never comes
+	// down
+	FILE *f = fopen( "/proc/self/status", "r" );
+	if( f ) {
+		char line[256];
+		long long kb = -1;
+		while( kb < 0 && fgets( line, sizeof( line ), f ) ) {
+			if( !strncmp( line, "VmHWM:", 6 ) )
+				kb = atoll( line + 6 );
+		}
+		fclose( f );
+		if( kb >= 0 )
+			return kb * 1024;
+	}
+#endif
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if( GetProcessMemoryInfo( GetCurrentProcess(), &pmc, sizeof( pmc ) ) )
+		return (long long)pmc.PeakWorkingSetSize;
+	return 0;
+#else
+	struct rusage usage;
+	if( getrusage( RUSAGE_SELF, &usage ) != 0 )
+		return 0;
+#ifdef __APPLE__
+	return (long long)usage.ru_maxrss;
+#else
+	return (long long)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+static double secondsSince( chrono::steady_clock::time_point start )
+{
+	return chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+}
+
+static BenchResult runCase( const BenchCase& c, const string& dir, int repeats )
+{
+	BenchResult result;
+	result.name = caseName( c );
+	result.loadSeconds = result.seconds = result.mraysPerSecond = 0.0;
+	result.peakRSS = 0;
+	result.ok = false;
+
+	resetPeakRSS();
+
+	RenderOptions options;
+	options.depth = c.depth;
+
+	RayTracer tracer;
+	tracer.setOptions( options );
+
+	string path = dir + "/" + c.scene;
+	vector<char> fn( path.begin(), path.end() );
+	fn.push_back( '\0' );
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	if( !tracer.loadScene( &fn[0] ) ) {
+		fprintf( stderr, "couldn't load %s\n", path.c_str() );
+		return result;
+	}
+	result.loadSeconds = secondsSince( start );
+
+	int height = (int)(c.width / tracer.aspectRatio() + 0.5);
+	for( int k = 0; k < repeats; ++k ) {
+		tracer.traceSetup( c.width, height );
+		resetCounters();
+		start = chrono::steady_clock::now();
+		tracer.traceTiles( c.threads );
+		double seconds = secondsSince( start );
+
+		if( k == 0 || seconds < result.seconds ) {
+			result.seconds = seconds;
+			result.mraysPerSecond = seconds > 0.0 ? getCounters().rays() / seconds * 1.0e-6 : 0.0;
+		}
+	}
+
+	result.peakRSS = peakRSS();
+	result.ok = true;
+	return result;
+}
+
+static bool writeResults( const char *filename, const vector<BenchResult>& results )
+{
+	FILE *f = fopen( filename, "w" );
+	if( !f )
+		return false;
+
+	// one case to a line, which is what readBaseline() expects
+	fprintf( f, "{\n  \"cases\": [\n" );
+	for( size_t k = 0; k < results.size(); ++k ) {
+		const BenchResult& r = results[k];
+		fprintf( f, "    { \"name\": \"%s\", \"seconds\": %.6f, \"load_seconds\": %.6f, "
+			"\"mrays_per_second\": %.6g, \"peak_rss\": %lld }%s\n",
+			r.name.c_str(), r.seconds, r.loadSeconds, r.mraysPerSecond, r.peakRSS,
+			k + 1 < results.size() ? "," : "" );
+	}
+	fprintf( f, "  ]\n}\n" );
+
+	return fclose( f ) == 0;
+}
+
+// Read the names and render times of a file written by writeResults().
+// Cases that failed aren't written, so every one read has a time.
+static bool readBaseline( const char *filename, vector<BenchResult>& baseline )
+{
+	FILE *f = fopen( filename, "r" );
+	if( !f )
+		return false;
+
+	char line[1024];
+	while( fgets( line, sizeof( line ), f ) ) {
+		const char *name = strstr( line, "\"name\": \"" );
+		const char *seconds = strstr( line, "\"seconds\": " );
+		if( !name || !seconds )
+			continue;
+
+		name += strlen( "\"name\": \"" );
+		const char *end = strchr( name, '"' );
+		if( !end )
+			continue;
+
+		BenchResult r;
+		r.name.assign( name, end );
+		r.seconds = atof( seconds + strlen( "\"seconds\": " ) );
+		r.loadSeconds = r.mraysPerSecond = 0.0;
+		r.peakRSS = 0;
+		r.ok = true;
+		baseline.push_back( r );
+	}
+
+	fclose( f );
+	return true;
+}
+
+static const BenchResult *findResult( const vector<BenchResult>& results, const string& name )
+{
+	for( size_t k = 0; k < results.size(); ++k ) {
+		if( results[k].name == name )
+			return &results[k];
+	}
+	return NULL;
+}
+
+static bool selected( const string& name, int argc, char **argv )
+{
+	if( optind >= argc )
+		return true;
+	for( int k = optind; k < argc; ++k ) {
+		if( name.find( argv[k] ) != string::npos )
+			return true;
+	}
+	return false;
+}
+
+static void usage( const char *progname )
+{
+	fprintf( stderr, "usage: %s [options] [case ...]\n", progname );
+	fprintf( stderr, "  -d <dir>    where the scenes are (default %s)\n", RAY_SAMPLES_DIR );
+	fprintf( stderr, "  -n <#>      renders of each case, the fastest counts (default 5)\n" );
+	fprintf( stderr, "  -o <file>   write the results as JSON\n" );
+	fprintf( stderr, "  -b <file>   compare with the results of an earlier run\n" );
+	fprintf( stderr, "  -T <#>      fraction slower than the baseline that fails (default 0.1)\n" );
+	fprintf( stderr, "  -l          list the cases\n" );
+}
+
+int main( int argc, char **argv )
+{
+	string dir = RAY_SAMPLES_DIR;
+	int repeats = 5;
+	const char *outName = NULL;
+	const char *baselineName = NULL;
+	double threshold = 0.1;
+	bool list = false;
+
+	int i;
+	while( (i = getopt( argc, argv, "d:n:o:b:T:l" )) != EOF ) {
+		switch( i ) {
+			case 'd':
+			dir = optarg;
+			break;
+
+			case 'n':
+			repeats = atoi( optarg );
+			break;
+
+			case 'o':
+			outName = optarg;
+			break;
+
+			case 'b':
+			baselineName = optarg;
+			break;
+
+			case 'T':
+			threshold = atof( optarg );
+			break;
+
+			case 'l':
+			list = true;
+			break;
+
+			default:
+			usage( argv[0] );
+			return 1;
+		}
+	}
+	if( repeats < 1 || threshold < 0.0 ) {
+		usage( argv[0] );
+		return 1;
+	}
+
+	int cases = sizeof( benchCases ) / sizeof( benchCases[0] );
+	if( list ) {
+		for( int k = 0; k < cases; ++k )
+			printf( "%s\n", caseName( benchCases[k] ).c_str() );
+		return 0;
+	}
+
+	vector<BenchResult> baseline;
+	if( baselineName && !readBaseline( baselineName, baseline ) ) {
+		fprintf( stderr, "couldn't read %s\n", baselineName );
+		return 1;
+	}
+
+	printf( "%-32s %9s %9s %9s %9s %9s\n", "case", "load s", "render s", "Mrays/s", "peak MB", "baseline" );
+
+	vector<BenchResult> results;
+	int failed = 0, slower = 0;
+	for( int k = 0; k < cases; ++k ) {
+		const BenchCase& c = benchCases[k];
+		if( !selected( caseName( c ), argc, argv ) )
+			continue;
+
+		BenchResult r = runCase( c, dir, repeats );
+		if( !r.ok ) {
+			++failed;
+			continue;
+		}
+		results.push_back( r );
+
+		printf( "%-32s %9.3f %9.3f %9.2f %9.1f", r.name.c_str(), r.loadSeconds, r.seconds,
+			r.mraysPerSecond, r.peakRSS / (1024.0 * 1024.0) );
+
+		const BenchResult *base = findResult( baseline, r.name );
+		if( base && base->seconds > 0.0 ) {
+			double change = r.seconds / base->seconds - 1.0;
+			printf( " %+8.1f%%", 100.0 * change );
+			if( change > threshold ) {
+				printf( "  SLOWER" );
+				++slower;
+			}
+		}
+		printf( "\n" );
+		fflush( stdout );
+	}
+
+	if( outName && !writeResults( outName, results ) ) {
+		fprintf( stderr, "couldn't write %s\n", outName );
+		return 1;
+	}
+
+	if( failed )
+		fprintf( stderr, "%d case%s couldn't be run\n", failed, failed > 1 ? "s" : "" );
+	if( slower )
+		fprintf( stderr, "%d case%s more than %.0f%% slower than the baseline\n",
+			slower, slower > 1 ? "s are" : " is", 100.0 * threshold );
+
+	return failed || slower ? 1 : 0;
+}
@@ -0,0 +1,26 @@
+// The renderer without a user interface: reads a scene, renders it and
+// writes the image, taking the same options as the text mode of the UI
+// program.
+//
+// usage : ray-cli [options] in.ray out.bmp
+//         ray-cli -c in.ray [out.rayb]
+
+#include <stdio.h>
+
+#include "cli.h"
+#include "report.h"
+
+int main( int argc, char **argv )
+{
+	CommandLine cl;
+	if( !parseCommandLine( argc, argv, cl ) ) {
+		printUsage( stderr, argv[0] );
+		return 1;
+	}
+
+	if( cl.compile )
+		return compileCommandLine( cl ) ? 0 : 1;
+
+	RenderReport report;
+	return renderCommandLine( cl, report ) ? 0 : 1;
+}
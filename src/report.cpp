@@ -0,0 +1,171 @@
+#include "report.h"
+#include "SceneObjects/trimesh.h"
+
+RenderReport::RenderReport()
+	: width( 0 ), height( 0 ), threads( 0 ),
+	  parseSeconds( 0.0 ), prepareSeconds( 0.0 ), buildSeconds( 0.0 ),
+	  renderSeconds( 0.0 ), writeSeconds( 0.0 ), meshes( 0 )
+{
+	counters.clear();
+}
+
+// Add g's hierarchy to the meshes' totals, if it's a mesh.
+static void addMesh( const Geometry *g, RenderReport& report )
+{
+	const Trimesh *mesh = dynamic_cast<const Trimesh*>( g );
+	if( !mesh )
+		return;
+
+	BVHStats s = mesh->getFaceBVH().getStats();
+	BVHStats& m = report.meshBVH;
+	m.nodes += s.nodes;
+	m.leaves += s.leaves;
+	m.primitives += s.primitives;
+	m.maxLeafSize = max( m.maxLeafSize, s.maxLeafSize );
+	m.maxDepth = max( m.maxDepth, s.maxDepth );
+	m.sahCost += s.sahCost;
+	m.buildSeconds += s.buildSeconds;
+	++report.meshes;
+}
+
+void describeScene( const Scene *scene, RenderReport& report )
+{
+	report.sceneBVH = scene->getBVH() ? scene->getBVH()->getStats() : BVHStats();
+	report.meshBVH = BVHStats();
+	report.meshes = 0;
+
+	// shared meshes count once, however many instances there are
+	for( Scene::cgiter g = scene->beginObjects(); g != scene->endObjects(); ++g )
+		addMesh( *g, report );
+	const Scene::SharedObjects& shared = scene->getSharedObjects();
+	for( Scene::SharedObjects::const_iterator s = shared.begin(); s != shared.end(); ++s )
+		addMesh( s->second, report );
+
+	report.prepareSeconds = scene->getPrepareTime();
+	report.buildSeconds = report.sceneBVH.buildSeconds + report.meshBVH.buildSeconds;
+}
+
+// a / b, or 0 when there's nothing to divide by
+static double ratio( double a, double b )
+{
+	return b > 0.0 ? a / b : 0.0;
+}
+
+static void printBVH( FILE *f, const char *what, const BVHStats& s )
+{
+	fprintf( f, "%s: %d nodes, %d leaves, %.2f prims/leaf (max %d), depth %d, SAH cost %.2f, built in %.3f seconds\n",
+		what, s.nodes, s.leaves, ratio( s.primitives, s.leaves ), s.maxLeafSize, s.maxDepth,
+		s.sahCost, s.buildSeconds );
+}
+
+void printReport( FILE *f, const RenderReport& r )
+{
+	const RenderCounters& c = r.counters;
+	double rays = (double)c.rays();
+	double queries = (double)(c.intersectCalls + c.occlusionQueries);
+
+	fprintf( f, "%s, %d x %d\n", r.scene.c_str(), r.width, r.height );
+	fprintf( f, "time: parse %.3f, prepare %.3f (builds %.3f), render %.3f, write %.3f seconds\n",
+		r.parseSeconds, r.prepareSeconds, r.buildSeconds, r.renderSeconds, r.writeSeconds );
+
+	if( r.sceneBVH.nodes )
+		printBVH( f, "scene bvh", r.sceneBVH );
+	if( r.meshes ) {
+		char what[64];
+		sprintf( what, "mesh bvh (%d mesh%s)", r.meshes, r.meshes > 1 ? "es" : "" );
+		printBVH( f, what, r.meshBVH );
+	}
+
+	fprintf( f, "rays: %llu primary, %llu reflected, %llu refracted, %llu shadow; %.2f Mrays/s\n",
+		c.primaryRays, c.reflectedRays, c.refractedRays, c.shadowRays,
+		ratio( rays, r.renderSeconds ) * 1.0e-6 );
+	fprintf( f, "queries: %llu closest hit (%.1f%% hit), %llu occlusion\n",
+		c.intersectCalls, 100.0 * ratio( c.hits, c.intersectCalls ), c.occlusionQueries );
+	fprintf( f, "per query: %.1f nodes, %.1f primitive tests\n",
+		ratio( c.nodesVisited, queries ), ratio( c.primitiveTests, queries ) );
+	fprintf( f, "lights culled: %llu\n", c.lightsCulled );
+	fprintf( f, "materials allocated: %llu\n", c.materialAllocs );
+	fprintf( f, "total time = %.3f seconds\n", r.renderSeconds );
+}
+
+// Write s as a JSON string.
+static void writeString( FILE *f, const string& s )
+{
+	fputc( '"', f );
+	for( size_t k = 0; k < s.size(); ++k ) {
+		unsigned char ch = s[k];
+		if( ch == '"' || ch == '\\' )
+			fprintf( f, "\\%c", ch );
+		else if( ch < 0x20 )
+			fprintf( f, "\\u%04x", ch );
+		else
+			fputc( ch, f );
+	}
+	fputc( '"', f );
+}
+
+static void writeBVH( FILE *f, const char *name, const BVHStats& s, const char *end )
+{
+	fprintf( f, "    \"%s\": { \"nodes\": %d, \"leaves\": %d, \"primitives\": %d, \"max_leaf_size\": %d, "
+		"\"max_depth\": %d, \"sah_cost\": %.6g, \"build_seconds\": %.6f }%s\n",
+		name, s.nodes, s.leaves, s.primitives, s.maxLeafSize, s.maxDepth, s.sahCost,
+		s.buildSeconds, end );
+}
+
+bool writeReportJSON( const char *filename, const RenderReport& r )
+{
+	FILE *f = fopen( filename, "w" );
+	if( !f )
+		return false;
+
+	const RenderCounters& c = r.counters;
+	double rays = (double)c.rays();
+	double queries = (double)(c.intersectCalls + c.occlusionQueries);
+
+	fprintf( f, "{\n" );
+	fprintf( f, "  \"scene\": " );
+	writeString( f, r.scene );
+	fprintf( f, ",\n" );
+	fprintf( f, "  \"width\": %d,\n  \"height\": %d,\n  \"threads\": %d,\n", r.width, r.height, r.threads );
+	fprintf( f, "  \"options\": { \"depth\": %d, \"threshold\": %g, \"packet_size\": %d, "
+		"\"aa_samples\": %d, \"aa_threshold\": %g },\n",
+		r.options.depth, r.options.threshold, r.options.packetSize,
+		r.options.aaSamples, r.options.aaThreshold );
+
+	fprintf( f, "  \"seconds\": {\n" );
+	fprintf( f, "    \"parse\": %.6f,\n    \"prepare\": %.6f,\n    \"build\": %.6f,\n"
+		"    \"render\": %.6f,\n    \"write\": %.6f\n",
+		r.parseSeconds, r.prepareSeconds, r.buildSeconds, r.renderSeconds, r.writeSeconds );
+	fprintf( f, "  },\n" );
+
+	fprintf( f, "  \"bvh\": {\n" );
+	writeBVH( f, "scene", r.sceneBVH, "," );
+	writeBVH( f, "meshes", r.meshBVH, "," );
+	fprintf( f, "    \"mesh_count\": %d\n", r.meshes );
+	fprintf( f, "  },\n" );
+
+	fprintf( f, "  \"counters\": {\n" );
+	fprintf( f, "    \"primary_rays\": %llu,\n", c.primaryRays );
+	fprintf( f, "    \"reflected_rays\": %llu,\n", c.reflectedRays );
+	fprintf( f, "    \"refracted_rays\": %llu,\n", c.refractedRays );
+	fprintf( f, "    \"shadow_rays\": %llu,\n", c.shadowRays );
+	fprintf( f, "    \"intersect_calls\": %llu,\n", c.intersectCalls );
+	fprintf( f, "    \"hits\": %llu,\n", c.hits );
+	fprintf( f, "    \"occlusion_queries\": %llu,\n", c.occlusionQueries );
+	fprintf( f, "    \"nodes_visited\": %llu,\n", c.nodesVisited );
+	fprintf( f, "    \"primitive_tests\": %llu,\n", c.primitiveTests );
+	fprintf( f, "    \"material_allocs\": %llu,\n", c.materialAllocs );
+	fprintf( f, "    \"lights_culled\": %llu\n", c.lightsCulled );
+	fprintf( f, "  },\n" );
+
+	fprintf( f, "  \"derived\": {\n" );
+	fprintf( f, "    \"rays\": %.0f,\n", rays );
+	fprintf( f, "    \"mrays_per_second\": %.6g,\n", ratio( rays, r.renderSeconds ) * 1.0e-6 );
+	fprintf( f, "    \"hit_rate\": %.6g,\n", ratio( c.hits, c.intersectCalls ) );
+	fprintf( f, "    \"nodes_per_query\": %.6g,\n", ratio( c.nodesVisited, queries ) );
+	fprintf( f, "    \"primitive_tests_per_query\": %.6g\n", ratio( c.primitiveTests, queries ) );
+	fprintf( f, "  }\n" );
+	fprintf( f, "}\n" );
+
+	return fclose( f ) == 0;
+}
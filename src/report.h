@@ -0,0 +1,50 @@
+#ifndef __REPORT_H__
+#define __REPORT_H__
+
+// What a render cost: how long each phase took, what the hierarchies look
+// like and what the counters (scene/counters.h) added up to.  Printed for
+// people by -t and written as JSON by -s, so that runs can be compared.
+
+#include <stdio.h>
+
+#include <string>
+
+#include "scene/bvh.h"
+#include "scene/counters.h"
+#include "RenderOptions.h"
+
+using namespace std;
+
+struct RenderReport
+{
+	RenderReport();
+
+	string scene;
+	int width;
+	int height;
+	int threads;			// as asked for; 0 is one per hardware thread
+	RenderOptions options;
+
+	// phases, in seconds of wall time
+	double parseSeconds;	// reading the scene file
+	double prepareSeconds;	// Scene::initScene, builds included
+	double buildSeconds;	// building the scene's and the meshes' hierarchies
+	double renderSeconds;
+	double writeSeconds;	// writing the image
+
+	BVHStats sceneBVH;
+	BVHStats meshBVH;		// summed over all the meshes
+	int meshes;
+
+	RenderCounters counters;
+};
+
+// Fill in the hierarchy statistics and the build time from scene.
+void describeScene( const Scene *scene, RenderReport& report );
+
+void printReport( FILE *f, const RenderReport& report );
+
+// Returns false if the file can't be written.
+bool writeReportJSON( const char *filename, const RenderReport& report );
+
+#endif // __REPORT_H__
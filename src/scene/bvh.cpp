@@ -0,0 +1,335 @@
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "bvh.h"
+#include "parallel.h"
+
+// Cost model for the surface area heuristic, relative to the cost of
+// testing a single primitive.
+static const double TRAVERSAL_COST = 1.0;
+static const int SAH_BINS = 16;
+static const int MAX_LEAF_SIZE = 4;
+
+// Which of the SAH_BINS equal slices of [lo, lo+extent] holds c.
+static inline int binOf( double c, double lo, double extent )
+{
+	int b = (int)( SAH_BINS * (c - lo) / extent );
+	return b < SAH_BINS ? b : SAH_BINS - 1;
+}
+
+// Primitive counts above which the build splits its work between threads:
+// a node this big bins its primitives in parallel chunks, and one this big
+// hands its second child to another thread to build.
+static const int PARALLEL_BIN_MIN = 65536;
+static const int PARALLEL_BIN_GRAIN = 16384;
+static const int PARALLEL_SUBTREE_MIN = 4096;
+
+// Bounds of a set of primitives and of their centroids.
+struct BVH::RangeBounds
+{
+	BoundingBox bounds;
+	BoundingBox centroids;
+	bool empty;
+
+	RangeBounds() : empty( true ) {}
+
+	void add( const BuildPrim& p )
+	{
+		if( empty ) {
+			bounds = p.box;
+			centroids.min = centroids.max = p.centroid;
+			empty = false;
+		} else {
+			bounds.merge( p.box );
+			centroids.min = minimum( centroids.min, p.centroid );
+			centroids.max = maximum( centroids.max, p.centroid );
+		}
+	}
+
+	void add( const RangeBounds& r )
+	{
+		if( r.empty )
+			return;
+		if( empty ) {
+			*this = r;
+		} else {
+			bounds.merge( r.bounds );
+			centroids.merge( r.centroids );
+		}
+	}
+};
+
+// The primitives of a node sorted into SAH_BINS slices along each axis of
+// its centroid bounds.
+struct BVH::Bins
+{
+	int count[3][ SAH_BINS ];
+	BoundingBox bounds[3][ SAH_BINS ];
+
+	Bins() { memset( count, 0, sizeof( count ) ); }
+
+	void add( const BuildPrim& p, const BoundingBox& centroids )
+	{
+		for( int axis = 0; axis < 3; ++axis ) {
+			double lo = centroids.min[axis];
+			double extent = centroids.max[axis] - lo;
+			if( extent <= 0.0 )
+				continue;
+
+			int b = binOf( p.centroid[axis], lo, extent );
+			if( count[axis][b]++ == 0 )
+				bounds[axis][b] = p.box;
+			else
+				bounds[axis][b].merge( p.box );
+		}
+	}
+
+	void add( const Bins& other )
+	{
+		for( int axis = 0; axis < 3; ++axis ) {
+			for( int b = 0; b < SAH_BINS; ++b ) {
+				if( other.count[axis][b] == 0 )
+					continue;
+				if( count[axis][b] == 0 )
+					bounds[axis][b] = other.bounds[axis][b];
+				else
+					bounds[axis][b].merge( other.bounds[axis][b] );
+				count[axis][b] += other.count[axis][b];
+			}
+		}
+	}
+};
+
+void BVH::build( const vector<BoundingBox>& boxes )
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	nodes.clear();
+	indices.clear();
+
+	if( !boxes.empty() ) {
+		vector<BuildPrim> prims( boxes.size() );
+		parallelFor( (int)boxes.size(), PARALLEL_BIN_GRAIN, [&]( int first, int last ) {
+			for( int k = first; k < last; ++k ) {
+				prims[k].box = boxes[k];
+				prims[k].centroid = 0.5 * (boxes[k].min + boxes[k].max);
+				prims[k].index = k;
+			}
+		} );
+
+		nodes.reserve( 2 * boxes.size() );
+		indices.reserve( boxes.size() );
+		buildRecursive( prims, 0, (int)prims.size(), 0 );
+	}
+
+	buildSeconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// Partition prims[start,end) with the binned surface area heuristic and
+// return the index of the node that was created for them.  Big ranges are
+// binned in parallel and have their second child built on another thread;
+// the tree comes out the same either way.
+int BVH::buildRecursive( vector<BuildPrim>& prims, int start, int end, int depth )
+{
+	int nodeIndex = (int)nodes.size();
+	nodes.push_back( BVHNode() );
+
+	int count = end - start;
+	bool parallel = count >= PARALLEL_BIN_MIN;
+
+	RangeBounds range;
+	if( parallel ) {
+		int chunks = (count + PARALLEL_BIN_GRAIN - 1) / PARALLEL_BIN_GRAIN;
+		vector<RangeBounds> parts( chunks );
+		parallelFor( count, PARALLEL_BIN_GRAIN, [&]( int first, int last ) {
+			RangeBounds& part = parts[ first / PARALLEL_BIN_GRAIN ];
+			for( int k = start + first; k < start + last; ++k )
+				part.add( prims[k] );
+		} );
+		for( int c = 0; c < chunks; ++c )
+			range.add( parts[c] );
+	} else {
+		for( int k = start; k < end; ++k )
+			range.add( prims[k] );
+	}
+
+	const BoundingBox& bounds = range.bounds;
+	const BoundingBox& centroidBounds = range.centroids;
+
+	Bins bins;
+	if( count > 1 ) {
+		if( parallel ) {
+			int chunks = (count + PARALLEL_BIN_GRAIN - 1) / PARALLEL_BIN_GRAIN;
+			vector<Bins> parts( chunks );
+			parallelFor( count, PARALLEL_BIN_GRAIN, [&]( int first, int last ) {
+				Bins& part = parts[ first / PARALLEL_BIN_GRAIN ];
+				for( int k = start + first; k < start + last; ++k )
+					part.add( prims[k], centroidBounds );
+			} );
+			for( int c = 0; c < chunks; ++c )
+				bins.add( parts[c] );
+		} else {
+			for( int k = start; k < end; ++k )
+				bins.add( prims[k], centroidBounds );
+		}
+	}
+
+	// find the cheapest bin boundary over all three axes
+	int bestAxis = -1;
+	int bestSplit = 0;
+	double bestCost = 1.0e308;
+	double invArea = bounds.area() > 0.0 ? 1.0 / bounds.area() : 0.0;
+
+	for( int axis = 0; axis < 3 && count > 1; ++axis ) {
+		if( centroidBounds.max[axis] - centroidBounds.min[axis] <= 0.0 )
+			continue;
+
+		const int *binCount = bins.count[axis];
+		const BoundingBox *binBounds = bins.bounds[axis];
+
+		// sweep from the right to get the cost of everything above each boundary
+		double rightArea[ SAH_BINS ];
+		int rightCount[ SAH_BINS ];
+		BoundingBox acc;
+		int n = 0;
+		for( int b = SAH_BINS - 1; b > 0; --b ) {
+			if( binCount[b] ) {
+				if( n == 0 )
+					acc = binBounds[b];
+				else
+					acc.merge( binBounds[b] );
+				n += binCount[b];
+			}
+			rightArea[b] = n ? acc.area() : 0.0;
+			rightCount[b] = n;
+		}
+
+		n = 0;
+		for( int b = 0; b < SAH_BINS - 1; ++b ) {
+			if( binCount[b] ) {
+				if( n == 0 )
+					acc = binBounds[b];
+				else
+					acc.merge( binBounds[b] );
+				n += binCount[b];
+			}
+			if( n == 0 || rightCount[b + 1] == 0 )
+				continue;
+
+			double cost = TRAVERSAL_COST + invArea *
+				(acc.area() * n + rightArea[b + 1] * rightCount[b + 1]);
+			if( cost < bestCost ) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b;
+			}
+		}
+	}
+
+	// Make a leaf when splitting doesn't pay off, unless the leaf would be
+	// too big and a split exists at all.
+	bool makeLeaf = bestAxis < 0 || depth >= BVH_MAX_DEPTH ||
+		( count <= MAX_LEAF_SIZE && bestCost >= count );
+
+	if( makeLeaf ) {
+		BVHNode& leaf = nodes[ nodeIndex ];
+		leaf.bounds = NodeBox( bounds );
+		leaf.offset = (int)indices.size();
+		leaf.count = count;
+		leaf.axis = 0;
+		for( int k = start; k < end; ++k )
+			indices.push_back( prims[k].index );
+		return nodeIndex;
+	}
+
+	double lo = centroidBounds.min[ bestAxis ];
+	double extent = centroidBounds.max[ bestAxis ] - lo;
+	int mid = start;
+	for( int k = start; k < end; ++k ) {
+		if( binOf( prims[k].centroid[bestAxis], lo, extent ) <= bestSplit )
+			std::swap( prims[k], prims[mid++] );
+	}
+
+	int second;
+	if( end - mid >= PARALLEL_SUBTREE_MIN && claimThreads( 1 ) ) {
+		// The children touch disjoint ranges of prims, so the second can be
+		// built into a tree of its own meanwhile and appended afterwards,
+		// which leaves the nodes just where a serial build puts them.
+		BVH other;
+		std::thread task( [&]() { other.buildRecursive( prims, mid, end, depth + 1 ); } );
+		buildRecursive( prims, start, mid, depth + 1 );
+		task.join();
+		releaseThreads( 1 );
+		second = append( other );
+	} else {
+		buildRecursive( prims, start, mid, depth + 1 );
+		second = buildRecursive( prims, mid, end, depth + 1 );
+	}
+
+	// nodes may have been reallocated by the recursive calls
+	BVHNode& node = nodes[ nodeIndex ];
+	node.bounds = NodeBox( bounds );
+	node.offset = second;
+	node.count = 0;
+	node.axis = bestAxis;
+	return nodeIndex;
+}
+
+// Add other's nodes and indices after our own, fixing up the offsets, and
+// return where its root ended up.
+int BVH::append( const BVH& other )
+{
+	int nodeBase = (int)nodes.size();
+	int indexBase = (int)indices.size();
+
+	for( size_t k = 0; k < other.nodes.size(); ++k ) {
+		BVHNode node = other.nodes[k];
+		node.offset += node.count > 0 ? indexBase : nodeBase;
+		nodes.push_back( node );
+	}
+	indices.insert( indices.end(), other.indices.begin(), other.indices.end() );
+	return nodeBase;
+}
+
+BVHStats BVH::getStats() const
+{
+	BVHStats stats;
+	stats.nodes = (int)nodes.size();
+	stats.buildSeconds = buildSeconds;
+	if( nodes.empty() )
+		return stats;
+
+	double rootArea = nodes[0].bounds.area();
+	double invRootArea = rootArea > 0.0 ? 1.0 / rootArea : 0.0;
+
+	// (node, depth) pairs still to visit
+	vector< pair<int, int> > stack;
+	stack.push_back( make_pair( 0, 0 ) );
+
+	while( !stack.empty() ) {
+		int k = stack.back().first;
+		int depth = stack.back().second;
+		stack.pop_back();
+
+		const BVHNode& node = nodes[k];
+		double weight = node.bounds.area() * invRootArea;
+		if( depth > stats.maxDepth )
+			stats.maxDepth = depth;
+
+		if( node.count > 0 ) {
+			++stats.leaves;
+			stats.primitives += node.count;
+			if( node.count > stats.maxLeafSize )
+				stats.maxLeafSize = node.count;
+			stats.sahCost += weight * node.count;
+		} else {
+			stats.sahCost += weight * TRAVERSAL_COST;
+			stack.push_back( make_pair( node.offset, depth + 1 ) );
+			stack.push_back( make_pair( k + 1, depth + 1 ) );
+		}
+	}
+	return stats;
+}
@@ -0,0 +1,334 @@
+//
+// bvh.h
+//
+// A bounding volume hierarchy over a set of axis-aligned boxes, built
+// with the surface area heuristic.  The hierarchy only deals in primitive
+// indices; the owner maps those back onto its own objects when it walks
+// the tree.
+//
+
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#include <vector>
+
+#include "scene.h"
+#include "kernels.h"
+#include "packet.h"
+#include "counters.h"
+
+using namespace std;
+
+// One node of the flattened tree.  Nodes are stored depth-first, so the
+// first child of an interior node always immediately follows it.  The
+// bounds are kept in traversal precision (see kernels.h).
+struct BVHNode
+{
+	NodeBox bounds;
+	int offset;		// leaf: first entry in BVH::indices, interior: second child
+	int count;		// number of primitives in a leaf, 0 for interior nodes
+	int axis;		// split axis of an interior node
+};
+
+// What a tree looks like, for reporting on it.
+struct BVHStats
+{
+	BVHStats()
+		: nodes( 0 ), leaves( 0 ), primitives( 0 ), maxLeafSize( 0 ), maxDepth( 0 ),
+		  sahCost( 0.0 ), buildSeconds( 0.0 ) {}
+
+	int nodes;
+	int leaves;
+	int primitives;			// summed over the leaves
+	int maxLeafSize;
+	int maxDepth;			// of the deepest leaf; the root is at depth 0
+	double sahCost;			// expected cost of a ray through the root, in
+							// primitive tests, by the surface area heuristic
+	double buildSeconds;	// 0 for a tree that was assign()ed rather than built
+};
+
+class BVH
+{
+public:
+	BVH() : buildSeconds( 0.0 ) {}
+
+	// Build the tree over boxes; primitive k is the one bounded by boxes[k].
+	// Large builds use whatever threads are idle (see parallel.h), but the
+	// tree is the same however many that is.
+	void build( const vector<BoundingBox>& boxes );
+
+	// Put items (one per box passed to build) into leaf order and make the
+	// leaves refer to them by position, so the primitives of a leaf are
+	// also neighbours in memory.
+	template <class T>
+	void reorder( vector<T>& items );
+
+	bool empty() const { return nodes.empty(); }
+	BoundingBox getBounds() const { return toBoundingBox( nodes[0].bounds ); }
+
+	// The flattened tree, for saving it with a compiled scene.  assign()
+	// puts a saved tree back, taking over the contents of both vectors.
+	const vector<BVHNode>& getNodes() const { return nodes; }
+	const vector<int>& getIndices() const { return indices; }
+	void assign( vector<BVHNode>& savedNodes, vector<int>& savedIndices )
+	{
+		nodes.swap( savedNodes );
+		indices.swap( savedIndices );
+		buildSeconds = 0.0;
+	}
+
+	BVHStats getStats() const;
+
+	// Walk the leaves that the ray enters before tMax, nearest child first.
+	// For each leaf prims( index, count, r, tMax ) is called with the leaf's
+	// count primitive indices; it returns true on a hit and may shrink tMax
+	// to cull farther nodes.
+	template <class Prims>
+	bool intersect( const ray& r, double tMax, Prims& prims ) const;
+
+	// Like intersect(), but stop as soon as prims reports a hit.  For
+	// queries that only ask whether anything is there.
+	template <class Prims>
+	bool occluded( const ray& r, double tMax, Prims& prims ) const;
+
+	// Walk the tree once for a whole packet, with each ray limited to its
+	// own tMax.  For each leaf that ray k enters, prims( k, index, count, r,
+	// tMax ) is called as above.  Once the rays still hitting a subtree are
+	// down to one, that ray finishes the subtree on its own.
+	template <class Prims>
+	void intersectPacket( RayPacket& packet, Prims& prims ) const;
+
+	// Like intersectPacket(), but each ray stops as soon as prims reports a
+	// hit for it, which sets its entry in packet.hit.  Rays already marked
+	// as hit aren't walked at all.
+	template <class Prims>
+	void occludedPacket( RayPacket& packet, Prims& prims ) const;
+
+private:
+	struct BuildPrim
+	{
+		BoundingBox box;
+		vec3f centroid;
+		int index;
+	};
+	struct RangeBounds;
+	struct Bins;
+
+	int buildRecursive( vector<BuildPrim>& prims, int start, int end, int depth );
+	int append( const BVH& other );
+
+	template <class Prims>
+	bool intersectFrom( int root, const ray& r, double& tMax, Prims& prims, bool anyHit ) const;
+	template <class Prims>
+	void walkPacket( RayPacket& packet, Prims& prims, bool anyHit ) const;
+
+	// Adapts a packet callback to a single ray of the packet.
+	template <class Prims>
+	struct SingleRay
+	{
+		SingleRay( Prims& prims, int k )
+			: prims( prims ), k( k ) {}
+
+		bool operator()( const int *index, int count, const ray& r, double& tMax )
+		{
+			return prims( k, index, count, r, tMax );
+		}
+
+		Prims& prims;
+		int k;
+	};
+
+	vector<BVHNode> nodes;
+	vector<int> indices;
+	double buildSeconds;
+};
+
+// The tree depth is capped at this during the build, which bounds the
+// traversal stack.
+const int BVH_MAX_DEPTH = 64;
+
+template <class T>
+void BVH::reorder( vector<T>& items )
+{
+	vector<T> sorted;
+	sorted.reserve( items.size() );
+	for( size_t k = 0; k < indices.size(); ++k ) {
+		sorted.push_back( items[ indices[k] ] );
+		indices[k] = (int)k;
+	}
+	items.swap( sorted );
+}
+
+template <class Prims>
+bool BVH::intersect( const ray& r, double tMax, Prims& prims ) const
+{
+	if( nodes.empty() )
+		return false;
+	return intersectFrom( 0, r, tMax, prims, false );
+}
+
+template <class Prims>
+bool BVH::occluded( const ray& r, double tMax, Prims& prims ) const
+{
+	if( nodes.empty() )
+		return false;
+	return intersectFrom( 0, r, tMax, prims, true );
+}
+
+template <class Prims>
+bool BVH::intersectFrom( int root, const ray& r, double& tMax, Prims& prims, bool anyHit ) const
+{
+	double tNear, tFar;
+	if( !nodes[root].bounds.intersect( r, tNear, tFar ) || tNear > tMax )
+		return false;
+
+	// Children are tested in pairs before descending, so every node on the
+	// stack has been hit already; its entry distance is kept so that it can
+	// be dropped if a closer hit turns up in the meantime.
+	struct Entry
+	{
+		int node;
+		double tNear;
+	};
+	Entry stack[ BVH_MAX_DEPTH + 1 ];
+	int sp = 0;
+	int cur = root;
+	bool have_one = false;
+	NodeSlabs slabs( r );
+
+	while( true ) {
+		const BVHNode& node = nodes[cur];
+		RAY_COUNT( nodesVisited, 1 );
+
+		if( node.count > 0 ) {
+			RAY_COUNT( primitiveTests, node.count );
+			if( prims( &indices[ node.offset ], node.count, r, tMax ) ) {
+				if( anyHit )
+					return true;
+				have_one = true;
+			}
+		} else {
+			double tChild[2];
+			int hit = intersectBoxPair( slabs, nodes[cur + 1].bounds, nodes[ node.offset ].bounds,
+				tMax, tChild );
+
+			if( hit == 3 ) {
+				// visit the nearer child first
+				int nearSide = tChild[1] < tChild[0] ? 1 : 0;
+				stack[ sp ].node = nearSide ? cur + 1 : node.offset;
+				stack[ sp ].tNear = tChild[ 1 - nearSide ];
+				++sp;
+				cur = nearSide ? node.offset : cur + 1;
+				continue;
+			} else if( hit ) {
+				cur = hit == 1 ? cur + 1 : node.offset;
+				continue;
+			}
+		}
+
+		do {
+			if( sp == 0 )
+				return have_one;
+			--sp;
+		} while( stack[ sp ].tNear > tMax );
+		cur = stack[ sp ].node;
+	}
+}
+
+template <class Prims>
+void BVH::intersectPacket( RayPacket& packet, Prims& prims ) const
+{
+	walkPacket( packet, prims, false );
+}
+
+template <class Prims>
+void BVH::occludedPacket( RayPacket& packet, Prims& prims ) const
+{
+	walkPacket( packet, prims, true );
+}
+
+template <class Prims>
+void BVH::walkPacket( RayPacket& packet, Prims& prims, bool anyHit ) const
+{
+	if( nodes.empty() || packet.count == 0 )
+		return;
+
+	// Each node on the stack carries the range of rays that may still hit
+	// it.  A node is first checked against the whole packet with the
+	// interval test, then the range is narrowed from both ends to the first
+	// and last rays that really hit it; rays in between are only tested
+	// again at the leaves.  For anyHit, rays that have found their hit
+	// already count as missing everything.
+	struct Entry
+	{
+		int node;
+		int first;
+		int last;
+	};
+	Entry stack[ BVH_MAX_DEPTH + 1 ];
+	int sp = 0;
+	int cur = 0;
+	int first = 0;
+	int last = packet.count - 1;
+	PacketSlabs slabs( packet );
+
+	while( true ) {
+		const BVHNode& node = nodes[cur];
+		RAY_COUNT( nodesVisited, 1 );
+
+		if( !slabs.missesAll( node.bounds ) ) {
+			while( first <= last && ( ( anyHit && packet.hit[first] ) ||
+					!slabs.hits( first, node.bounds ) ) )
+				++first;
+			while( last > first && ( ( anyHit && packet.hit[last] ) ||
+					!slabs.hits( last, node.bounds ) ) )
+				--last;
+		} else {
+			first = last + 1;
+		}
+
+		if( first == last ) {
+			// the packet has diverged; no point carrying it any further
+			SingleRay<Prims> one( prims, first );
+			if( intersectFrom( cur, packet.getRay( first ), packet.tMax[first], one, anyHit ) &&
+					anyHit )
+				packet.hit[first] = true;
+		} else if( first < last ) {
+			if( node.count > 0 ) {
+				for( int k = first; k <= last; ++k ) {
+					if( anyHit && packet.hit[k] )
+						continue;
+					if( k == first || k == last || slabs.hits( k, node.bounds ) ) {
+						RAY_COUNT( primitiveTests, node.count );
+						if( prims( k, &indices[ node.offset ], node.count, packet.getRay( k ),
+								packet.tMax[k] ) && anyHit )
+							packet.hit[k] = true;
+					}
+				}
+			} else {
+				// order the children by the direction of the first ray
+				int nearChild = cur + 1;
+				int farChild = node.offset;
+				if( packet.dir[first][ node.axis ] < 0.0 ) {
+					nearChild = node.offset;
+					farChild = cur + 1;
+				}
+				stack[ sp ].node = farChild;
+				stack[ sp ].first = first;
+				stack[ sp ].last = last;
+				++sp;
+				cur = nearChild;
+				continue;
+			}
+		}
+
+		if( sp == 0 )
+			return;
+		--sp;
+		cur = stack[ sp ].node;
+		first = stack[ sp ].first;
+		last = stack[ sp ].last;
+	}
+}
+
+#endif // __BVH_H__
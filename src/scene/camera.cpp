@@ -83,6 +83,16 @@ Camera::setAspectRatio( double ar )
     update();
 }
 
+void
+Camera::setView( const vec3f &eye, const mat3f &rotation, double normalizedHeight, double aspectRatio )
+{
+    this->eye = eye;
+    m = rotation;
+    this->normalizedHeight = normalizedHeight;
+    this->aspectRatio = aspectRatio;
+    update();
+}
+
 void
 Camera::update()
 {
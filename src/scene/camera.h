@@ -18,6 +18,13 @@ public:
 	vec3f getLook() { return look; }
 
     double getAspectRatio() { return aspectRatio; }
+
+    // Everything the camera is set from, for saving it with a compiled
+    // scene and putting it back.
+    const vec3f& getEye() const { return eye; }
+    const mat3f& getRotation() const { return m; }
+    double getNormalizedHeight() const { return normalizedHeight; }
+    void setView( const vec3f &eye, const mat3f &rotation, double normalizedHeight, double aspectRatio );
 private:
     mat3f m;                     // rotation matrix
     double normalizedHeight;    // dimensions of image place at unit dist from eye
@@ -0,0 +1,70 @@
+#include <string.h>
+
+#include <mutex>
+
+#include "counters.h"
+
+#ifndef RAY_NO_COUNTERS
+thread_local RenderCounters threadCounters;
+#endif
+
+static std::mutex totalsLock;
+static RenderCounters totals;
+
+void RenderCounters::clear()
+{
+	memset( this, 0, sizeof( *this ) );
+}
+
+void RenderCounters::add( const RenderCounters& other )
+{
+	primaryRays += other.primaryRays;
+	reflectedRays += other.reflectedRays;
+	refractedRays += other.refractedRays;
+	shadowRays += other.shadowRays;
+	intersectCalls += other.intersectCalls;
+	hits += other.hits;
+	occlusionQueries += other.occlusionQueries;
+	nodesVisited += other.nodesVisited;
+	primitiveTests += other.primitiveTests;
+	materialAllocs += other.materialAllocs;
+	lightsCulled += other.lightsCulled;
+}
+
+const RenderCounters& getThreadCounters()
+{
+#ifdef RAY_NO_COUNTERS
+	static const RenderCounters none = RenderCounters();
+	return none;
+#else
+	return threadCounters;
+#endif
+}
+
+void flushCounters()
+{
+#ifndef RAY_NO_COUNTERS
+	std::lock_guard<std::mutex> lock( totalsLock );
+	totals.add( threadCounters );
+	threadCounters.clear();
+#endif
+}
+
+RenderCounters getCounters()
+{
+	std::lock_guard<std::mutex> lock( totalsLock );
+	RenderCounters result = totals;
+#ifndef RAY_NO_COUNTERS
+	result.add( threadCounters );
+#endif
+	return result;
+}
+
+void resetCounters()
+{
+	std::lock_guard<std::mutex> lock( totalsLock );
+	totals.clear();
+#ifndef RAY_NO_COUNTERS
+	threadCounters.clear();
+#endif
+}
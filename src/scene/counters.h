@@ -0,0 +1,64 @@
+//
+// counters.h
+//
+// Counts of the work the renderer does.  Each thread counts into its own
+// RenderCounters, so counting costs an add to thread-local memory and no
+// locking; a thread hands its counts over to the totals with
+// flushCounters() when it's done.  Building with RAY_NO_COUNTERS defined
+// compiles the counting out altogether.
+//
+
+#ifndef __COUNTERS_H__
+#define __COUNTERS_H__
+
+// No constructor, so that the thread-local copies need no run-time
+// initialisation; use clear() on any other.
+struct RenderCounters
+{
+	unsigned long long primaryRays;
+	unsigned long long reflectedRays;
+	unsigned long long refractedRays;
+	unsigned long long shadowRays;
+
+	unsigned long long intersectCalls;		// closest-hit queries, one per ray of a packet
+	unsigned long long hits;				// closest-hit queries that hit something
+	unsigned long long occlusionQueries;	// any-hit queries for shadows
+	unsigned long long nodesVisited;		// BVH nodes, in the scene's and the meshes' trees
+	unsigned long long primitiveTests;		// objects or faces tested in the leaves reached
+	unsigned long long materialAllocs;		// Material objects allocated on the heap
+	unsigned long long lightsCulled;		// lights shading left out without a shadow ray
+
+	void clear();
+	void add( const RenderCounters& other );
+	unsigned long long rays() const
+		{ return primaryRays + reflectedRays + refractedRays + shadowRays; }
+};
+
+#ifdef RAY_NO_COUNTERS
+#define RAY_COUNT( field, n ) ((void)0)
+#else
+extern thread_local RenderCounters threadCounters;
+#define RAY_COUNT( field, n ) (threadCounters.field += (n))
+#endif
+
+// The calling thread's counts since it last flushed them; all zero with
+// RAY_NO_COUNTERS.
+const RenderCounters& getThreadCounters();
+
+// Whether anything is counted at all.
+#ifdef RAY_NO_COUNTERS
+inline bool countersEnabled() { return false; }
+#else
+inline bool countersEnabled() { return true; }
+#endif
+
+// Add the calling thread's counts to the totals and start it again from 0.
+void flushCounters();
+
+// The totals, plus whatever the calling thread hasn't flushed yet.
+RenderCounters getCounters();
+
+// Zero the totals and the calling thread's counts.
+void resetCounters();
+
+#endif // __COUNTERS_H__
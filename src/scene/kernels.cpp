@@ -0,0 +1,680 @@
+#include <cmath>
+#include <float.h>
+
+#include "kernels.h"
+#include "scene.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define RAY_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSE2
+#define TARGET_AVX
+#else
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX __attribute__((target("avx")))
+#endif
+#endif
+
+SimdLevel detectSimdLevel()
+{
+#if !defined(RAY_SIMD_X86)
+	return SIMD_NONE;
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid( info, 1 );
+	bool sse2 = ( info[3] & (1 << 26) ) != 0;
+	bool osxsave = ( info[2] & (1 << 27) ) != 0;
+	bool avx = ( info[2] & (1 << 28) ) != 0;
+
+	// the OS also has to save the upper halves of the ymm registers
+	if( avx && osxsave && ( _xgetbv( 0 ) & 6 ) == 6 )
+		return SIMD_AVX;
+	return sse2 ? SIMD_SSE2 : SIMD_NONE;
+#else
+	if( __builtin_cpu_supports( "avx" ) )
+		return SIMD_AVX;
+	return __builtin_cpu_supports( "sse2" ) ? SIMD_SSE2 : SIMD_NONE;
+#endif
+}
+
+static SimdLevel supportedLevel = detectSimdLevel();
+static SimdLevel currentLevel = supportedLevel;
+
+SimdLevel getSimdLevel()
+{
+	return currentLevel;
+}
+
+void setSimdLevel( SimdLevel level )
+{
+	currentLevel = level < supportedLevel ? level : supportedLevel;
+}
+
+RaySlabs::RaySlabs( const ray& r )
+{
+	vec3f p = r.getPosition();
+	vec3f d = r.getDirection();
+
+	for( int k = 0; k < 3; ++k ) {
+		org[k] = p[k];
+		// A huge finite value instead of infinity for axis-parallel rays
+		// keeps (plane - org) * invDir from ever becoming 0 * inf = NaN.
+		invDir[k] = d[k] != 0.0 ? 1.0 / d[k] : 1.0e300;
+	}
+}
+
+// x as a float no greater, or no less, than it.  Magnitudes beyond the
+// float range go to the largest float on the side that keeps that true,
+// and to infinity on the other.  The nearest float is always stepped out
+// by a relative FLT_EPSILON, a little more than the one ulp it can be off
+// by, since checking which way it was rounded costs a branch that's hard
+// to predict.
+static inline float roundDown( double x )
+{
+	if( x > FLT_MAX )
+		return FLT_MAX;
+	float f = (float)x;
+	return f - ( fabsf( f ) * FLT_EPSILON + FLT_MIN );
+}
+
+static inline float roundUp( double x )
+{
+	if( x < -FLT_MAX )
+		return -FLT_MAX;
+	float f = (float)x;
+	return f + ( fabsf( f ) * FLT_EPSILON + FLT_MIN );
+}
+
+FloatBox::FloatBox( const BoundingBox& box )
+{
+	for( int k = 0; k < 3; ++k ) {
+		min[k] = roundDown( box.min[k] );
+		max[k] = roundUp( box.max[k] );
+	}
+}
+
+BoundingBox toBoundingBox( const FloatBox& box )
+{
+	BoundingBox result;
+	result.min = vec3f( box.min );
+	result.max = vec3f( box.max );
+	return result;
+}
+
+bool FloatBox::intersect( const ray& r, double& tMin, double& tMax ) const
+{
+	return toBoundingBox( *this ).intersect( r, tMin, tMax );
+}
+
+double FloatBox::area() const
+{
+	return toBoundingBox( *this ).area();
+}
+
+FloatRaySlabs::FloatRaySlabs( const ray& r )
+{
+	vec3f p = r.getPosition();
+	vec3f d = r.getDirection();
+
+	for( int k = 0; k < 3; ++k ) {
+		orgDown[k] = roundDown( p[k] );
+		orgUp[k] = roundUp( p[k] );
+		// as in RaySlabs; an overflowing product is infinite, not NaN
+		double inv = d[k] != 0.0 ? 1.0 / d[k] : 1.0e30;
+		invDir[k] = inv > FLT_MAX ? FLT_MAX : inv < -FLT_MAX ? -FLT_MAX : (float)inv;
+	}
+	orgDown[3] = orgUp[3] = invDir[3] = 0.0f;
+}
+
+//---------------------------------- Box pairs ----------------------------------
+
+static int intersectBoxPairScalar( const RaySlabs& rs, const BoundingBox& a, const BoundingBox& b,
+	double tMax, double tNear[2] )
+{
+	const BoundingBox *boxes[2] = { &a, &b };
+	int mask = 0;
+
+	for( int k = 0; k < 2; ++k ) {
+		double t0 = 0.0;
+		double t1 = tMax;
+		for( int axis = 0; axis < 3; ++axis ) {
+			double tA = ( boxes[k]->min[axis] - rs.org[axis] ) * rs.invDir[axis];
+			double tB = ( boxes[k]->max[axis] - rs.org[axis] ) * rs.invDir[axis];
+			if( tA > tB ) {
+				double tmp = tA;
+				tA = tB;
+				tB = tmp;
+			}
+			if( tA > t0 )
+				t0 = tA;
+			if( tB < t1 )
+				t1 = tB;
+		}
+		tNear[k] = t0;
+		if( t0 <= t1 )
+			mask |= 1 << k;
+	}
+
+	return mask;
+}
+
+#ifdef RAY_SIMD_X86
+TARGET_SSE2
+static int intersectBoxPairSSE2( const RaySlabs& rs, const BoundingBox& a, const BoundingBox& b,
+	double tMax, double tNear[2] )
+{
+	// lane 0 holds box a, lane 1 box b
+	__m128d t0 = _mm_setzero_pd();
+	__m128d t1 = _mm_set1_pd( tMax );
+
+	for( int axis = 0; axis < 3; ++axis ) {
+		__m128d org = _mm_set1_pd( rs.org[axis] );
+		__m128d inv = _mm_set1_pd( rs.invDir[axis] );
+		__m128d tA = _mm_mul_pd( _mm_sub_pd( _mm_set_pd( b.min[axis], a.min[axis] ), org ), inv );
+		__m128d tB = _mm_mul_pd( _mm_sub_pd( _mm_set_pd( b.max[axis], a.max[axis] ), org ), inv );
+		t0 = _mm_max_pd( t0, _mm_min_pd( tA, tB ) );
+		t1 = _mm_min_pd( t1, _mm_max_pd( tA, tB ) );
+	}
+
+	_mm_storeu_pd( tNear, t0 );
+	return _mm_movemask_pd( _mm_cmple_pd( t0, t1 ) );
+}
+#endif
+
+int intersectBoxPair( const RaySlabs& rs, const BoundingBox& a, const BoundingBox& b,
+	double tMax, double tNear[2] )
+{
+#ifdef RAY_SIMD_X86
+	if( currentLevel >= SIMD_SSE2 )
+		return intersectBoxPairSSE2( rs, a, b, tMax, tNear );
+#endif
+	return intersectBoxPairScalar( rs, a, b, tMax, tNear );
+}
+
+// Each float slab distance is off by a few roundings at most: of the
+// reciprocal, the subtraction and the product.  Growing the exit distance
+// and shrinking the entry distance by a little more than that keeps the
+// tests from missing a box the ray really hits (Ize, "Robust BVH Ray
+// Traversal", 2013).
+static const float SLAB_EXIT_GROWTH = 1.0f + 4 * FLT_EPSILON;
+static const double SLAB_ENTRY_SHRINK = 1.0 - 4 * FLT_EPSILON;
+
+static int intersectBoxPairScalar( const FloatRaySlabs& rs, const FloatBox& a, const FloatBox& b,
+	double tMax, double tNear[2] )
+{
+	const FloatBox *boxes[2] = { &a, &b };
+	int mask = 0;
+
+	for( int k = 0; k < 2; ++k ) {
+		float t0 = 0.0f;
+		float t1 = roundUp( tMax );
+		for( int axis = 0; axis < 3; ++axis ) {
+			float tA = ( boxes[k]->min[axis] - rs.orgUp[axis] ) * rs.invDir[axis];
+			float tB = ( boxes[k]->max[axis] - rs.orgDown[axis] ) * rs.invDir[axis];
+			if( tA > tB ) {
+				float tmp = tA;
+				tA = tB;
+				tB = tmp;
+			}
+			if( tA > t0 )
+				t0 = tA;
+			if( tB < t1 )
+				t1 = tB;
+		}
+		tNear[k] = t0 * SLAB_ENTRY_SHRINK;
+		if( t0 <= t1 * SLAB_EXIT_GROWTH )
+			mask |= 1 << k;
+	}
+
+	return mask;
+}
+
+#ifdef RAY_SIMD_X86
+// The SIMD kernels below load a box's three axes into one register from
+// min, reading on into max, and its max from two floats before max, so
+// that they never read outside the box.  Lane 3 of each is then junk and
+// is masked out.
+static_assert( sizeof( FloatBox ) == 6 * sizeof( float ), "FloatBox must be six packed floats" );
+
+TARGET_SSE2
+static inline void slabsSSE2( const FloatRaySlabs& rs, const FloatBox& box, __m128 tLimit,
+	__m128& t0, __m128& t1 )
+{
+	const __m128 xyz = _mm_castsi128_ps( _mm_set_epi32( 0, -1, -1, -1 ) );
+	__m128 lo = _mm_loadu_ps( &box.min.n[0] );
+	__m128 hi = _mm_loadu_ps( &box.min.n[2] );		// min.z, max.x, max.y, max.z
+	hi = _mm_shuffle_ps( hi, hi, _MM_SHUFFLE( 3, 3, 2, 1 ) );
+
+	__m128 inv = _mm_loadu_ps( rs.invDir );
+	__m128 tA = _mm_mul_ps( _mm_sub_ps( lo, _mm_loadu_ps( rs.orgUp ) ), inv );
+	__m128 tB = _mm_mul_ps( _mm_sub_ps( hi, _mm_loadu_ps( rs.orgDown ) ), inv );
+
+	// lane 3 becomes 0 for the entry and tLimit for the exit, which the
+	// reductions ignore
+	t0 = _mm_and_ps( _mm_min_ps( tA, tB ), xyz );
+	t1 = _mm_or_ps( _mm_and_ps( _mm_max_ps( tA, tB ), xyz ), _mm_andnot_ps( xyz, tLimit ) );
+	t0 = _mm_max_ps( t0, _mm_shuffle_ps( t0, t0, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	t0 = _mm_max_ps( t0, _mm_shuffle_ps( t0, t0, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	t1 = _mm_min_ps( t1, _mm_shuffle_ps( t1, t1, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	t1 = _mm_min_ps( t1, _mm_shuffle_ps( t1, t1, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+}
+
+TARGET_SSE2
+static int intersectBoxPairSSE2( const FloatRaySlabs& rs, const FloatBox& a, const FloatBox& b,
+	double tMax, double tNear[2] )
+{
+	// each box has a register to itself, with one lane per axis
+	__m128 tLimit = _mm_set1_ps( roundUp( tMax ) );
+	__m128 a0, a1, b0, b1;
+	slabsSSE2( rs, a, tLimit, a0, a1 );
+	slabsSSE2( rs, b, tLimit, b0, b1 );
+
+	// lane 0 holds box a, lane 1 box b
+	__m128 t0 = _mm_max_ps( _mm_unpacklo_ps( a0, b0 ), _mm_setzero_ps() );
+	__m128 t1 = _mm_min_ps( _mm_unpacklo_ps( a1, b1 ), tLimit );
+	tNear[0] = _mm_cvtss_f32( t0 ) * SLAB_ENTRY_SHRINK;
+	tNear[1] = _mm_cvtss_f32( _mm_shuffle_ps( t0, t0, _MM_SHUFFLE( 1, 1, 1, 1 ) ) ) * SLAB_ENTRY_SHRINK;
+	t1 = _mm_mul_ps( t1, _mm_set1_ps( SLAB_EXIT_GROWTH ) );
+	return _mm_movemask_ps( _mm_cmple_ps( t0, t1 ) ) & 3;
+}
+
+TARGET_AVX
+static int intersectBoxPairAVX( const FloatRaySlabs& rs, const FloatBox& a, const FloatBox& b,
+	double tMax, double tNear[2] )
+{
+	// box a in the low half, box b in the high half, one lane per axis
+	const __m256 xyz = _mm256_castsi256_ps( _mm256_set_epi32( 0, -1, -1, -1, 0, -1, -1, -1 ) );
+	const __m256 tLimit = _mm256_set1_ps( roundUp( tMax ) );
+
+	__m256 lo = _mm256_insertf128_ps( _mm256_castps128_ps256( _mm_loadu_ps( &a.min.n[0] ) ),
+		_mm_loadu_ps( &b.min.n[0] ), 1 );
+	__m256 hi = _mm256_insertf128_ps( _mm256_castps128_ps256( _mm_loadu_ps( &a.min.n[2] ) ),
+		_mm_loadu_ps( &b.min.n[2] ), 1 );			// min.z, max.x, max.y, max.z
+	hi = _mm256_permute_ps( hi, _MM_SHUFFLE( 3, 3, 2, 1 ) );
+
+	__m256 inv = _mm256_broadcast_ps( (const __m128 *)rs.invDir );
+	__m256 tA = _mm256_mul_ps( _mm256_sub_ps( lo, _mm256_broadcast_ps( (const __m128 *)rs.orgUp ) ), inv );
+	__m256 tB = _mm256_mul_ps( _mm256_sub_ps( hi, _mm256_broadcast_ps( (const __m128 *)rs.orgDown ) ), inv );
+
+	__m256 t0 = _mm256_and_ps( _mm256_min_ps( tA, tB ), xyz );
+	__m256 t1 = _mm256_blendv_ps( tLimit, _mm256_max_ps( tA, tB ), xyz );
+	t0 = _mm256_max_ps( t0, _mm256_permute_ps( t0, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	t0 = _mm256_max_ps( t0, _mm256_permute_ps( t0, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	t1 = _mm256_min_ps( t1, _mm256_permute_ps( t1, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	t1 = _mm256_min_ps( t1, _mm256_permute_ps( t1, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	t0 = _mm256_max_ps( t0, _mm256_setzero_ps() );
+	t1 = _mm256_min_ps( t1, tLimit );
+
+	float near[8];
+	_mm256_storeu_ps( near, t0 );
+	tNear[0] = near[0] * SLAB_ENTRY_SHRINK;
+	tNear[1] = near[4] * SLAB_ENTRY_SHRINK;
+	t1 = _mm256_mul_ps( t1, _mm256_set1_ps( SLAB_EXIT_GROWTH ) );
+	int mask = _mm256_movemask_ps( _mm256_cmp_ps( t0, t1, _CMP_LE_OQ ) );
+	return ( mask & 1 ) | ( ( mask >> 3 ) & 2 );
+}
+#endif
+
+int intersectBoxPair( const FloatRaySlabs& rs, const FloatBox& a, const FloatBox& b,
+	double tMax, double tNear[2] )
+{
+#ifdef RAY_SIMD_X86
+	if( currentLevel >= SIMD_AVX )
+		return intersectBoxPairAVX( rs, a, b, tMax, tNear );
+	if( currentLevel >= SIMD_SSE2 )
+		return intersectBoxPairSSE2( rs, a, b, tMax, tNear );
+#endif
+	return intersectBoxPairScalar( rs, a, b, tMax, tNear );
+}
+
+//---------------------------------- Triangles ----------------------------------
+
+template <class T>
+void PackedTrianglesT<T>::clear()
+{
+	for( int c = 0; c < 3; ++c ) {
+		v0[c].clear();
+		e1[c].clear();
+		e2[c].clear();
+		n[c].clear();
+	}
+}
+
+template <class T>
+void PackedTrianglesT<T>::push_back( const vec3f& a, const vec3f& b, const vec3f& c )
+{
+	vec3f ab = b - a;
+	vec3f ac = c - a;
+	vec3f cv = ab.cross( ac );
+
+	// degenerate faces get a zero normal, which the back face test rejects
+	vec3f normal = cv.iszero() ? vec3f() : cv.normalize();
+
+	for( int k = 0; k < 3; ++k ) {
+		v0[k].push_back( (T)a[k] );
+		e1[k].push_back( (T)ab[k] );
+		e2[k].push_back( (T)ac[k] );
+		n[k].push_back( (T)normal[k] );
+	}
+}
+
+template struct PackedTrianglesT<float>;
+template struct PackedTrianglesT<double>;
+
+// Float triangles are widened to double here, which holds them exactly.
+template <class T>
+static int intersectTrianglesScalar( const ray& r, const PackedTrianglesT<T>& tris, int first, int count,
+	double tMax, double& tHit, double& uHit, double& vHit )
+{
+	const vec3f p = r.getPosition();
+	const vec3f d = r.getDirection();
+	int best = -1;
+
+	for( int k = first; k < first + count; ++k ) {
+		const vec3f n( tris.n[0][k], tris.n[1][k], tris.n[2][k] );
+		if( -(d * n) < NORMAL_EPSILON )
+			continue;
+
+		const vec3f e1( tris.e1[0][k], tris.e1[1][k], tris.e1[2][k] );
+		const vec3f e2( tris.e2[0][k], tris.e2[1][k], tris.e2[2][k] );
+		const vec3f tvec = p - vec3f( tris.v0[0][k], tris.v0[1][k], tris.v0[2][k] );
+
+		vec3f pvec = d.cross( e2 );
+		double invDet = 1.0 / ( e1 * pvec );
+
+		double u = ( tvec * pvec ) * invDet;
+		if( u < 0.0 || u > 1.0 )
+			continue;
+
+		vec3f qvec = tvec.cross( e1 );
+		double v = ( d * qvec ) * invDet;
+		if( v < 0.0 || u + v > 1.0 )
+			continue;
+
+		double t = ( e2 * qvec ) * invDet;
+		if( t < RAY_EPSILON || t >= tMax )
+			continue;
+
+		tMax = tHit = t;
+		uHit = u;
+		vHit = v;
+		best = k;
+	}
+
+	return best;
+}
+
+#ifdef RAY_SIMD_X86
+TARGET_AVX
+static inline __m256d dot4( __m256d ax, __m256d ay, __m256d az, __m256d bx, __m256d by, __m256d bz )
+{
+	return _mm256_add_pd( _mm256_add_pd( _mm256_mul_pd( ax, bx ), _mm256_mul_pd( ay, by ) ),
+		_mm256_mul_pd( az, bz ) );
+}
+
+TARGET_AVX
+static inline __m256d cross4( __m256d ay, __m256d az, __m256d by, __m256d bz )
+{
+	// one component of a x b: ay * bz - az * by
+	return _mm256_sub_pd( _mm256_mul_pd( ay, bz ), _mm256_mul_pd( az, by ) );
+}
+
+TARGET_AVX
+static int intersectTrianglesAVX( const ray& r, const PackedTrianglesT<double>& tris, int first, int count,
+	double tMax, double& tHit, double& uHit, double& vHit )
+{
+	const vec3f p = r.getPosition();
+	const vec3f d = r.getDirection();
+
+	const __m256d ox = _mm256_set1_pd( p[0] );
+	const __m256d oy = _mm256_set1_pd( p[1] );
+	const __m256d oz = _mm256_set1_pd( p[2] );
+	const __m256d dx = _mm256_set1_pd( d[0] );
+	const __m256d dy = _mm256_set1_pd( d[1] );
+	const __m256d dz = _mm256_set1_pd( d[2] );
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d one = _mm256_set1_pd( 1.0 );
+	const __m256d normalEps = _mm256_set1_pd( NORMAL_EPSILON );
+	const __m256d rayEps = _mm256_set1_pd( RAY_EPSILON );
+
+	int best = -1;
+	int end = first + count;
+
+	for( int k = first; k < end; k += 4 ) {
+		// masked-off lanes load as zero, so their zero normal fails the
+		// back face test below
+		int lanes = end - k < 4 ? end - k : 4;
+		const __m256i mask = _mm256_set_epi64x( lanes > 3 ? -1 : 0, lanes > 2 ? -1 : 0,
+			lanes > 1 ? -1 : 0, -1 );
+
+		__m256d nx = _mm256_maskload_pd( &tris.n[0][k], mask );
+		__m256d ny = _mm256_maskload_pd( &tris.n[1][k], mask );
+		__m256d nz = _mm256_maskload_pd( &tris.n[2][k], mask );
+		__m256d valid = _mm256_cmp_pd( _mm256_sub_pd( zero, dot4( dx, dy, dz, nx, ny, nz ) ),
+			normalEps, _CMP_GE_OQ );
+		if( !_mm256_movemask_pd( valid ) )
+			continue;
+
+		__m256d e1x = _mm256_maskload_pd( &tris.e1[0][k], mask );
+		__m256d e1y = _mm256_maskload_pd( &tris.e1[1][k], mask );
+		__m256d e1z = _mm256_maskload_pd( &tris.e1[2][k], mask );
+		__m256d e2x = _mm256_maskload_pd( &tris.e2[0][k], mask );
+		__m256d e2y = _mm256_maskload_pd( &tris.e2[1][k], mask );
+		__m256d e2z = _mm256_maskload_pd( &tris.e2[2][k], mask );
+		__m256d tx = _mm256_sub_pd( ox, _mm256_maskload_pd( &tris.v0[0][k], mask ) );
+		__m256d ty = _mm256_sub_pd( oy, _mm256_maskload_pd( &tris.v0[1][k], mask ) );
+		__m256d tz = _mm256_sub_pd( oz, _mm256_maskload_pd( &tris.v0[2][k], mask ) );
+
+		// pvec = d x e2
+		__m256d px = cross4( dy, dz, e2y, e2z );
+		__m256d py = cross4( dz, dx, e2z, e2x );
+		__m256d pz = cross4( dx, dy, e2x, e2y );
+		__m256d invDet = _mm256_div_pd( one, dot4( e1x, e1y, e1z, px, py, pz ) );
+
+		__m256d u = _mm256_mul_pd( dot4( tx, ty, tz, px, py, pz ), invDet );
+		valid = _mm256_and_pd( valid, _mm256_cmp_pd( u, zero, _CMP_GE_OQ ) );
+		valid = _mm256_and_pd( valid, _mm256_cmp_pd( u, one, _CMP_LE_OQ ) );
+
+		// qvec = tvec x e1
+		__m256d qx = cross4( ty, tz, e1y, e1z );
+		__m256d qy = cross4( tz, tx, e1z, e1x );
+		__m256d qz = cross4( tx, ty, e1x, e1y );
+
+		__m256d v = _mm256_mul_pd( dot4( dx, dy, dz, qx, qy, qz ), invDet );
+		valid = _mm256_and_pd( valid, _mm256_cmp_pd( v, zero, _CMP_GE_OQ ) );
+		valid = _mm256_and_pd( valid, _mm256_cmp_pd( _mm256_add_pd( u, v ), one, _CMP_LE_OQ ) );
+
+		__m256d t = _mm256_mul_pd( dot4( e2x, e2y, e2z, qx, qy, qz ), invDet );
+		valid = _mm256_and_pd( valid, _mm256_cmp_pd( t, rayEps, _CMP_GE_OQ ) );
+		valid = _mm256_and_pd( valid, _mm256_cmp_pd( t, _mm256_set1_pd( tMax ), _CMP_LT_OQ ) );
+
+		int hits = _mm256_movemask_pd( valid );
+		if( !hits )
+			continue;
+
+		double ts[4], us[4], vs[4];
+		_mm256_storeu_pd( ts, t );
+		_mm256_storeu_pd( us, u );
+		_mm256_storeu_pd( vs, v );
+		for( int lane = 0; lane < lanes; ++lane ) {
+			if( ( hits & (1 << lane) ) && ts[lane] < tMax ) {
+				tMax = tHit = ts[lane];
+				uHit = us[lane];
+				vHit = vs[lane];
+				best = k + lane;
+			}
+		}
+	}
+
+	return best;
+}
+#endif
+
+int intersectTriangles( const ray& r, const PackedTrianglesT<double>& tris, int first, int count,
+	double tMax, double& t, double& u, double& v )
+{
+#ifdef RAY_SIMD_X86
+	if( currentLevel >= SIMD_AVX )
+		return intersectTrianglesAVX( r, tris, first, count, tMax, t, u, v );
+#endif
+	return intersectTrianglesScalar( r, tris, first, count, tMax, t, u, v );
+}
+
+#ifdef RAY_SIMD_X86
+// The hit of ray r on triangle k, worked out in double without any of the
+// tests.  For the winner of the float kernel.
+static void hitTriangle( const ray& r, const PackedTrianglesT<float>& tris, int k,
+	double& t, double& u, double& v )
+{
+	const vec3f p = r.getPosition();
+	const vec3f d = r.getDirection();
+	const vec3f e1( tris.e1[0][k], tris.e1[1][k], tris.e1[2][k] );
+	const vec3f e2( tris.e2[0][k], tris.e2[1][k], tris.e2[2][k] );
+	const vec3f tvec = p - vec3f( tris.v0[0][k], tris.v0[1][k], tris.v0[2][k] );
+
+	vec3f pvec = d.cross( e2 );
+	vec3f qvec = tvec.cross( e1 );
+	double invDet = 1.0 / ( e1 * pvec );
+	u = ( tvec * pvec ) * invDet;
+	v = ( d * qvec ) * invDet;
+	t = ( e2 * qvec ) * invDet;
+}
+
+// How far outside its edges, in barycentric terms, a float kernel still
+// counts a hit on a triangle.  A few roundings' worth, enough that a ray
+// through an edge that two triangles share can't slip between them.
+static const float EDGE_SLACK = 16 * FLT_EPSILON;
+
+// laneMasks + 8 - n is a mask of the first n of 8 lanes
+static const int laneMasks[16] = { -1, -1, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+TARGET_AVX
+static inline __m256 dot8( __m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz )
+{
+	return _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( ax, bx ), _mm256_mul_ps( ay, by ) ),
+		_mm256_mul_ps( az, bz ) );
+}
+
+TARGET_AVX
+static inline __m256 cross8( __m256 ay, __m256 az, __m256 by, __m256 bz )
+{
+	return _mm256_sub_ps( _mm256_mul_ps( ay, bz ), _mm256_mul_ps( az, by ) );
+}
+
+TARGET_AVX
+static int intersectTrianglesAVX( const ray& r, const PackedTrianglesT<float>& tris, int first, int count,
+	double tMax, double& tHit, double& uHit, double& vHit )
+{
+	const vec3f p = r.getPosition();
+	const vec3f d = r.getDirection();
+
+	// The distance to a triangle is only known to within a few roundings
+	// of the origin's coordinates, so the near limit grows with them, to
+	// keep rays leaving a surface from hitting it again.
+	double scale = fabs( p[0] ) > fabs( p[1] ) ? fabs( p[0] ) : fabs( p[1] );
+	scale = fabs( p[2] ) > scale ? fabs( p[2] ) : scale;
+	double nearLimit = 4 * FLT_EPSILON * scale;
+
+	const __m256 ox = _mm256_set1_ps( (float)p[0] );
+	const __m256 oy = _mm256_set1_ps( (float)p[1] );
+	const __m256 oz = _mm256_set1_ps( (float)p[2] );
+	const __m256 dx = _mm256_set1_ps( (float)d[0] );
+	const __m256 dy = _mm256_set1_ps( (float)d[1] );
+	const __m256 dz = _mm256_set1_ps( (float)d[2] );
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps( 1.0f );
+	const __m256 low = _mm256_set1_ps( -EDGE_SLACK );
+	const __m256 high = _mm256_set1_ps( 1.0f + EDGE_SLACK );
+	const __m256 normalEps = _mm256_set1_ps( (float)NORMAL_EPSILON );
+	const __m256 rayEps = _mm256_set1_ps( (float)( nearLimit > RAY_EPSILON ? nearLimit : RAY_EPSILON ) );
+
+	float tLimit = roundUp( tMax );
+	int best = -1;
+	int end = first + count;
+
+	for( int k = first; k < end; k += 8 ) {
+		// masked-off lanes load as zero, so their zero normal fails the
+		// back face test below
+		int lanes = end - k < 8 ? end - k : 8;
+		const __m256i mask = _mm256_loadu_si256( (const __m256i *)( laneMasks + 8 - lanes ) );
+
+		__m256 nx = _mm256_maskload_ps( &tris.n[0][k], mask );
+		__m256 ny = _mm256_maskload_ps( &tris.n[1][k], mask );
+		__m256 nz = _mm256_maskload_ps( &tris.n[2][k], mask );
+		__m256 valid = _mm256_cmp_ps( _mm256_sub_ps( zero, dot8( dx, dy, dz, nx, ny, nz ) ),
+			normalEps, _CMP_GE_OQ );
+		if( !_mm256_movemask_ps( valid ) )
+			continue;
+
+		__m256 e1x = _mm256_maskload_ps( &tris.e1[0][k], mask );
+		__m256 e1y = _mm256_maskload_ps( &tris.e1[1][k], mask );
+		__m256 e1z = _mm256_maskload_ps( &tris.e1[2][k], mask );
+		__m256 e2x = _mm256_maskload_ps( &tris.e2[0][k], mask );
+		__m256 e2y = _mm256_maskload_ps( &tris.e2[1][k], mask );
+		__m256 e2z = _mm256_maskload_ps( &tris.e2[2][k], mask );
+		__m256 tx = _mm256_sub_ps( ox, _mm256_maskload_ps( &tris.v0[0][k], mask ) );
+		__m256 ty = _mm256_sub_ps( oy, _mm256_maskload_ps( &tris.v0[1][k], mask ) );
+		__m256 tz = _mm256_sub_ps( oz, _mm256_maskload_ps( &tris.v0[2][k], mask ) );
+
+		// pvec = d x e2
+		__m256 px = cross8( dy, dz, e2y, e2z );
+		__m256 py = cross8( dz, dx, e2z, e2x );
+		__m256 pz = cross8( dx, dy, e2x, e2y );
+		__m256 invDet = _mm256_div_ps( one, dot8( e1x, e1y, e1z, px, py, pz ) );
+
+		__m256 u = _mm256_mul_ps( dot8( tx, ty, tz, px, py, pz ), invDet );
+		valid = _mm256_and_ps( valid, _mm256_cmp_ps( u, low, _CMP_GE_OQ ) );
+		valid = _mm256_and_ps( valid, _mm256_cmp_ps( u, high, _CMP_LE_OQ ) );
+
+		// qvec = tvec x e1
+		__m256 qx = cross8( ty, tz, e1y, e1z );
+		__m256 qy = cross8( tz, tx, e1z, e1x );
+		__m256 qz = cross8( tx, ty, e1x, e1y );
+
+		__m256 v = _mm256_mul_ps( dot8( dx, dy, dz, qx, qy, qz ), invDet );
+		valid = _mm256_and_ps( valid, _mm256_cmp_ps( v, low, _CMP_GE_OQ ) );
+		valid = _mm256_and_ps( valid, _mm256_cmp_ps( _mm256_add_ps( u, v ), high, _CMP_LE_OQ ) );
+
+		__m256 t = _mm256_mul_ps( dot8( e2x, e2y, e2z, qx, qy, qz ), invDet );
+		valid = _mm256_and_ps( valid, _mm256_cmp_ps( t, rayEps, _CMP_GE_OQ ) );
+		valid = _mm256_and_ps( valid, _mm256_cmp_ps( t, _mm256_set1_ps( tLimit ), _CMP_LT_OQ ) );
+
+		int hits = _mm256_movemask_ps( valid );
+		if( !hits )
+			continue;
+
+		float ts[8];
+		_mm256_storeu_ps( ts, t );
+		for( int lane = 0; lane < lanes; ++lane ) {
+			if( ( hits & (1 << lane) ) && ts[lane] < tLimit ) {
+				tLimit = ts[lane];
+				best = k + lane;
+			}
+		}
+	}
+
+	if( best < 0 )
+		return -1;
+
+	// The float tests can pass a hit whose t, worked out again in double,
+	// is a rounding outside [RAY_EPSILON, tMax).  Dropping it here keeps
+	// the caller's tMax from growing, and gives occlusion queries the same
+	// answer.
+	hitTriangle( r, tris, best, tHit, uHit, vHit );
+	if( tHit < RAY_EPSILON || tHit >= tMax )
+		return -1;
+	return best;
+}
+#endif
+
+int intersectTriangles( const ray& r, const PackedTrianglesT<float>& tris, int first, int count,
+	double tMax, double& t, double& u, double& v )
+{
+#ifdef RAY_SIMD_X86
+	if( currentLevel >= SIMD_AVX )
+		return intersectTrianglesAVX( r, tris, first, count, tMax, t, u, v );
+#endif
+	return intersectTrianglesScalar( r, tris, first, count, tMax, t, u, v );
+}
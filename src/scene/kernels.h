@@ -0,0 +1,128 @@
+//
+// kernels.h
+//
+// Intersection kernels that test one ray against several boxes or
+// triangles at once.  Each has a scalar version and, on x86, SSE2/AVX
+// versions picked at run time from what the CPU supports.
+//
+
+#ifndef __KERNELS_H__
+#define __KERNELS_H__
+
+#include <vector>
+
+#include "ray.h"
+
+using namespace std;
+
+class BoundingBox;
+
+enum SimdLevel
+{
+	SIMD_NONE,		// plain scalar code
+	SIMD_SSE2,		// 2 doubles or 4 floats per instruction
+	SIMD_AVX		// 4 doubles or 8 floats per instruction
+};
+
+// The widest level the CPU supports, and the one the kernels use.  The
+// latter can be lowered (e.g. to compare against the scalar path) but is
+// never raised above the former.
+SimdLevel detectSimdLevel();
+SimdLevel getSimdLevel();
+void setSimdLevel( SimdLevel level );
+
+// A ray set up for slab tests.
+struct RaySlabs
+{
+	RaySlabs( const ray& r );
+
+	double org[3];
+	double invDir[3];
+};
+
+// Test the ray against boxes a and b, both clipped to [0, tMax].  Returns
+// a bit mask of the boxes that were hit (1 for a, 2 for b) and their entry
+// distances in tNear.
+int intersectBoxPair( const RaySlabs& rs, const BoundingBox& a, const BoundingBox& b,
+	double tMax, double tNear[2] );
+
+// A BoundingBox kept in floats, rounded outwards so that it still encloses
+// everything the original did.
+struct FloatBox
+{
+	FloatBox() {}
+	explicit FloatBox( const BoundingBox& box );
+
+	// As BoundingBox's, worked out in double.
+	bool intersect( const ray& r, double& tMin, double& tMax ) const;
+	double area() const;
+
+	vec3t<float> min;
+	vec3t<float> max;
+};
+
+// Either kind of box as a BoundingBox, which holds a FloatBox exactly.
+BoundingBox toBoundingBox( const FloatBox& box );
+inline const BoundingBox& toBoundingBox( const BoundingBox& box ) { return box; }
+
+// A ray set up for slab tests against FloatBoxes.  The origin is kept
+// rounded both ways, each box plane being measured from the rounding that
+// makes the box look bigger, and the kernel allows for the rounding of its
+// own float arithmetic, so no box the ray really hits is ever missed.
+struct FloatRaySlabs
+{
+	FloatRaySlabs( const ray& r );
+
+	// the fourth entries are padding, so that the SIMD kernels can load
+	// all three axes at once
+	float orgDown[4];
+	float orgUp[4];
+	float invDir[4];
+};
+
+int intersectBoxPair( const FloatRaySlabs& rs, const FloatBox& a, const FloatBox& b,
+	double tMax, double tNear[2] );
+
+// Moller-Trumbore-ready triangles: the first vertex, the two edges leaving
+// it and the unit face normal, stored one component per array so that
+// neighbouring triangles can be loaded together.
+template <class T>
+struct PackedTrianglesT
+{
+	vector<T> v0[3];
+	vector<T> e1[3];
+	vector<T> e2[3];
+	vector<T> n[3];
+
+	size_t size() const { return v0[0].size(); }
+	void clear();
+	void push_back( const vec3f& a, const vec3f& b, const vec3f& c );
+};
+
+// Find the nearest hit before tMax among triangles [first, first+count).
+// Triangles seen from behind are culled.  Returns the index of the hit
+// triangle, or -1, and its distance and barycentric u, v.  The float
+// kernels give a little on the edges so that rounding can't open cracks
+// between neighbouring triangles, and work the winner's hit out again in
+// double.
+int intersectTriangles( const ray& r, const PackedTrianglesT<double>& tris, int first, int count,
+	double tMax, double& t, double& u, double& v );
+int intersectTriangles( const ray& r, const PackedTrianglesT<float>& tris, int first, int count,
+	double tMax, double& t, double& u, double& v );
+
+// What acceleration structures and mesh vertices are stored and intersected
+// in.  Building with RAY_FLOAT_TRAVERSAL makes that float, which halves
+// their memory and doubles the SIMD lanes; shading is in double either way.
+#ifdef RAY_FLOAT_TRAVERSAL
+typedef float TraversalReal;
+typedef FloatBox NodeBox;
+typedef FloatRaySlabs NodeSlabs;
+#else
+typedef double TraversalReal;
+typedef BoundingBox NodeBox;
+typedef RaySlabs NodeSlabs;
+#endif
+
+typedef PackedTrianglesT<TraversalReal> PackedTriangles;
+
+#endif // __KERNELS_H__
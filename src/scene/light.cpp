@@ -1,6 +1,56 @@
 #include <cmath>
 
 #include "light.h"
+#include "counters.h"
+
+// The packet shadowAttenuationPacket() traces, kept for each thread.
+static RayPacket& threadShadowPacket()
+{
+	static thread_local RayPacket packet;
+	return packet;
+}
+
+void Light::shadowAttenuationPacket( const vec3f *P, int count, vec3f *result ) const
+{
+	for( int k = 0; k < count; ++k )
+		result[k] = shadowAttenuation( P[k] );
+}
+
+vec3f Light::shadowAlong( const vec3f& P, const vec3f& dir, double tMax ) const
+{
+	ray R( P, dir );
+	vec3f resultColor = getColor( P );
+
+	if( !scene->hasTransparency() ) {
+		if( scene->occluded( R, tMax ) )
+			return vec3f( 0.0, 0.0, 0.0 );
+		return resultColor;
+	}
+
+	vector<TransparentHit> hits;
+	if( !scene->transparentHits( R, tMax, hits ) )
+		return vec3f( 0.0, 0.0, 0.0 );
+
+	// each pass through an object attenuates the light once
+	for( size_t k = 0; k < hits.size(); ++k )
+		resultColor = prod( resultColor, hits[k].kt );
+	return resultColor;
+}
+
+void Light::resolveShadowPacket( RayPacket& packet, const vec3f *P, vec3f *result ) const
+{
+	bool through[ MAX_PACKET_SIZE ];
+	scene->occluded( packet, through );
+
+	for( int k = 0; k < packet.count; ++k ) {
+		if( packet.hit[k] )
+			result[k] = vec3f( 0.0, 0.0, 0.0 );
+		else if( through[k] )
+			result[k] = shadowAlong( P[k], packet.dir[k], packet.tMax[k] );
+		else
+			result[k] = getColor( P[k] );
+	}
+}
 
 double DirectionalLight::distanceAttenuation( const vec3f& P ) const
 {
@@ -11,33 +61,21 @@ double DirectionalLight::distanceAttenuation( const vec3f& P ) const
 
 vec3f DirectionalLight::shadowAttenuation( const vec3f& P ) const
 {
-	vec3f dir = getDirection(P);
-	isect i;
-	vec3f resultColor = getColor(P);
-
-	vec3f iP = P;
-	ray R = ray(iP, dir);
-	bool isSecondIntersect = false;	// second intersection of the same scene object
-	while (scene->intersect(R, i))	// handle transparent object intersection case
-	{
-		if (i.getMaterial().kt.iszero()) {
-			// if there is a non-transparent object along a path to the light source
-			return vec3f(0.0, 0.0, 0.0);
-		}
-		// set new ray
-		iP = R.at(i.t);
-		R = ray(iP, dir);
-
-		if (!isSecondIntersect) {
-			// attenuate the result to the transmissive coef
-			resultColor = prod(resultColor, i.getMaterial().kt);
-			isSecondIntersect = true;
-		}
-		else {
-			isSecondIntersect = false;
-		}
+	RAY_COUNT( shadowRays, 1 );
+	return shadowAlong( P, getDirection(P), 1.0e308 );
+}
+
+void DirectionalLight::shadowAttenuationPacket( const vec3f *P, int count, vec3f *result ) const
+{
+	for( int first = 0; first < count; first += MAX_PACKET_SIZE ) {
+		int n = min( count - first, MAX_PACKET_SIZE );
+		RayPacket& packet = threadShadowPacket();
+		packet.clear();
+		for( int k = 0; k < n; ++k )
+			packet.add( P[ first + k ], getDirection( P[ first + k ] ) );
+		RAY_COUNT( shadowRays, n );
+		resolveShadowPacket( packet, P + first, result + first );
 	}
-	return resultColor;
 }
 
 vec3f DirectionalLight::getColor( const vec3f& P ) const
@@ -84,39 +122,25 @@ void PointLight::setDistanceAttenuation(const double constant, const double line
 
 vec3f PointLight::shadowAttenuation(const vec3f& P) const
 {
-	vec3f dir = getDirection(P);
-	isect i;
-	vec3f resultColor = getColor(P);
-	double light_t = (position - P).length();
-	
-	vec3f iP = P;
-	ray R = ray(iP, dir);
-	bool isSecondIntersect = false;	// second intersection of the same scene object
-	while (scene->intersect(R, i))	// handle transparent object intersection case
-	{
-		light_t -= i.t;
-		if (light_t < RAY_EPSILON) {
-			// if the intersected object locates behind the point light
-			return resultColor;
-		}
-		if (i.getMaterial().kt.iszero()) {
-			// if there is a non-transparent object along a path to the light source
-			return vec3f(0.0, 0.0, 0.0);
-		}
-		// set new ray
-		iP = R.at(i.t);
-		R = ray(iP, dir);
-		
-		if (!isSecondIntersect) {
-			// attenuate the result to the transmissive coef
-			resultColor = prod(resultColor, i.getMaterial().kt);
-			isSecondIntersect = true;
-		}
-		else {
-			isSecondIntersect = false;
+	// objects behind the light don't shadow
+	RAY_COUNT( shadowRays, 1 );
+	return shadowAlong( P, getDirection(P), (position - P).length() - RAY_EPSILON );
+}
+
+void PointLight::shadowAttenuationPacket( const vec3f *P, int count, vec3f *result ) const
+{
+	for( int first = 0; first < count; first += MAX_PACKET_SIZE ) {
+		int n = min( count - first, MAX_PACKET_SIZE );
+		RayPacket& packet = threadShadowPacket();
+		packet.clear();
+		for( int k = 0; k < n; ++k ) {
+			// objects behind the light don't shadow, as in shadowAttenuation()
+			const vec3f& p = P[ first + k ];
+			packet.add( p, getDirection( p ), (position - p).length() - RAY_EPSILON );
 		}
+		RAY_COUNT( shadowRays, n );
+		resolveShadowPacket( packet, P + first, result + first );
 	}
-	return resultColor;
 }
 
 double AmbientLight::distanceAttenuation(const vec3f& P) const
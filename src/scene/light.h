@@ -2,6 +2,7 @@
 #define __LIGHT_H__
 
 #include "scene.h"
+#include "packet.h"
 
 class Light
 	: public SceneElement
@@ -12,10 +13,29 @@ public:
 	virtual vec3f getColor( const vec3f& P ) const = 0;
 	virtual vec3f getDirection( const vec3f& P ) const = 0;
 
+	// The most shadowAttenuation() can be at P, with nothing in the way.
+	virtual vec3f getUnshadowedColor( const vec3f& P ) const { return getColor( P ); }
+
+	// shadowAttenuation() at count points at once.  Lights that cast
+	// shadows trace the shadow rays toward themselves as packets.
+	virtual void shadowAttenuationPacket( const vec3f *P, int count, vec3f *result ) const;
+
 protected:
 	Light( Scene *scene, const vec3f& col )
 		: SceneElement( scene ), color( col ) {}
 
+	// Color of the light that reaches P along dir: none if something
+	// opaque is in the way before tMax, otherwise filtered by every
+	// transparent object in between.  The callers count the shadow ray.
+	vec3f shadowAlong( const vec3f& P, const vec3f& dir, double tMax ) const;
+
+	// Trace a packet of shadow rays from the points P and work out their
+	// attenuation: rays that hit nothing before their tMax get the light's
+	// full color and rays stopped by an opaque object get none.  Rays that
+	// reach a transparent object and nothing opaque are followed through it
+	// one at a time by shadowAlong().
+	void resolveShadowPacket( RayPacket& packet, const vec3f *P, vec3f *result ) const;
+
 	vec3f 		color;
 };
 
@@ -29,6 +49,9 @@ public:
 	virtual double distanceAttenuation( const vec3f& P ) const;
 	virtual vec3f getColor( const vec3f& P ) const;
 	virtual vec3f getDirection( const vec3f& P ) const;
+	virtual void shadowAttenuationPacket( const vec3f *P, int count, vec3f *result ) const;
+
+	const vec3f& getOrientation() const { return orientation; }
 
 protected:
 	vec3f 		orientation;
@@ -44,8 +67,17 @@ public:
 	virtual double distanceAttenuation( const vec3f& P ) const;
 	virtual vec3f getColor( const vec3f& P ) const;
 	virtual vec3f getDirection( const vec3f& P ) const;
+	virtual void shadowAttenuationPacket( const vec3f *P, int count, vec3f *result ) const;
 	void setDistanceAttenuation(const double constant, const double linear, const double quadratic);
 
+	const vec3f& getPosition() const { return position; }
+	void getDistanceAttenuation( double& constant, double& linear, double& quadratic ) const
+	{
+		constant = m_const_atten_coeff;
+		linear = m_linear_atten_coeff;
+		quadratic = m_quadratic_atten_coeff;
+	}
+
 protected:
 	vec3f position;
 	double m_const_atten_coeff, m_linear_atten_coeff, m_quadratic_atten_coeff;
@@ -59,6 +91,7 @@ public:
 	virtual double distanceAttenuation(const vec3f& P) const;
 	virtual vec3f getColor(const vec3f& P) const;
 	virtual vec3f getDirection(const vec3f& P) const;
+	virtual vec3f getUnshadowedColor(const vec3f& P) const { return vec3f(1, 1, 1); }
 private:
 	vec3f color;
 };
@@ -1,10 +1,83 @@
+#include <algorithm>
+#include <vector>
+
 #include "ray.h"
 #include "material.h"
 #include "light.h"
 
+// Up to this many lights shade() just traces them in the scene's order.
+static const int FEW_LIGHTS = 4;
+
+// The lights that shade() traces shadow rays toward, reused from one call
+// to the next so that they aren't allocated every time, and the order it
+// traces them in.
+struct ShadeState
+{
+	std::vector<LightTerm> terms;
+	std::vector<int> order;
+};
+
+static ShadeState& threadShadeState()
+{
+	static thread_local ShadeState state;
+	return state;
+}
+
+// The largest channel of v, whichever its sign.
+static double largest( const vec3f& v )
+{
+	return maximum(maximum(fabs(v[0]), fabs(v[1])), fabs(v[2]));
+}
+
+// Work out term for light at P, with V the direction toward the eye and
+// trans how much of the diffuse light isn't transmitted instead.  Returns
+// false, with term incomplete, if the light can't add more than cutoff to
+// any channel.
+static bool lightTerm( const Material& m, const Light *light, const vec3f& P, const vec3f& normal,
+	const vec3f& V, const vec3f& trans, double cutoff, LightTerm& term )
+{
+	term.light = light;
+	term.atten = light->distanceAttenuation(P);
+
+	// diffuse and specular are at most kd and ks, so most lights too faint
+	// to matter are found before the exponent of the specular is worked out
+	vec3f color = light->getUnshadowedColor(P);
+	vec3f bound;
+	for (int c = 0; c < 3; ++c)
+		bound[c] = fabs(color[c]) * (fabs(m.kd[c] * trans[c]) + fabs(m.ks[c]));
+	if (fabs(term.atten) * largest(bound) <= cutoff)
+		return false;
+
+	vec3f Lj = (light->getDirection(P)).normalize();
+	vec3f diffuse = prod(m.kd * maximum(normal.dot(Lj), 0.0), trans);
+	vec3f R = ((2.0 * (normal.dot(Lj)) * normal) - Lj).normalize();
+	vec3f specular = m.ks * (pow(maximum(R * V, 0.0), m.shininess * 128.0));
+	term.reflected = diffuse + specular;
+	term.most = prod(term.atten * color, term.reflected);
+	return largest(term.most) > cutoff;
+}
+
+void Material::lightTerms( Scene *scene, const ray& r, const isect& i, std::vector<LightTerm>& terms ) const
+{
+	vec3f P = r.at(i.t);
+	vec3f V = -r.getDirection();
+	vec3f trans = vec3f(1, 1, 1) - kt;
+	double cutoff = scene->getLightCutoff();
+	int l = 0;
+	for (Scene::cliter j = scene->beginLights(); j != scene->endLights(); ++j, ++l) {
+		LightTerm term;
+		if (!lightTerm(*this, *j, P, i.N, V, trans, cutoff, term)) {
+			RAY_COUNT( lightsCulled, 1 );
+			continue;
+		}
+		term.index = l;
+		terms.push_back(term);
+	}
+}
+
 // Apply the phong model to this point on the surface of the object, returning
 // the color of that point.
-vec3f Material::shade(Scene *scene, const ray& r, const isect& i) const
+vec3f Material::shade(Scene *scene, const ray& r, const isect& i, const TracedLights *traced) const
 {
 	vec3f result = ke;	// iter 0
 	vec3f ambient = prod(ka, scene->getAmbient()); // iter 1
@@ -15,15 +88,80 @@ vec3f Material::shade(Scene *scene, const ray& r, const isect& i) const
 	result += prod(trans, ambient);
 
 	// iter 2 & 3
-	vec3f normal = i.N;
+	// Lights that couldn't add more than the cutoff even unshadowed get
+	// no shadow ray and add nothing.
+	if (traced) {
+		for (int k = 0; k < traced->count; ++k) {
+			const LightTerm& term = traced->terms[k];
+			vec3f atten = term.atten * term.shadow;
+			result += prod(atten, term.reflected);
+		}
+		result = result.clamp();
+		return result;
+	}
+
 	vec3f P = r.at(i.t);
-	for (Scene::cliter j = scene->beginLights(); j != scene->endLights(); ++j) {
-		vec3f atten = (*j)->distanceAttenuation(P) * (*j)->shadowAttenuation(P + i.N * RAY_EPSILON);
-		vec3f Lj = ((*j)->getDirection(P)).normalize();
-		vec3f diffuse = prod(kd * maximum(normal.dot(Lj), 0.0), trans);
-		vec3f R = ((2.0 * (normal.dot(Lj)) * normal) - Lj).normalize();
-		vec3f specular = ks * (pow(maximum(R * (-r.getDirection()), 0.0), shininess * 128.0));
-		result += prod(atten, diffuse + specular);
+	if (scene->getLightCount() <= FEW_LIGHTS) {
+		vec3f V = -r.getDirection();
+		double cutoff = scene->getLightCutoff();
+		for (Scene::cliter j = scene->beginLights(); j != scene->endLights(); ++j) {
+			LightTerm term;
+			if (!lightTerm(*this, *j, P, i.N, V, trans, cutoff, term)) {
+				RAY_COUNT( lightsCulled, 1 );
+				continue;
+			}
+			vec3f shadowAtten = (*j)->shadowAttenuation(P + i.N * RAY_EPSILON);
+			vec3f atten = term.atten * shadowAtten;
+			result += prod(atten, term.reflected);
+		}
+		result = result.clamp();
+		return result;
+	}
+
+	ShadeState& state = threadShadeState();
+	std::vector<LightTerm>& terms = state.terms;
+	terms.clear();
+	lightTerms(scene, r, i, terms);
+	bool monotonic = true;
+	vec3f most = result;
+	for (size_t k = 0; k < terms.size(); ++k) {
+		const vec3f& m = terms[k].most;
+		monotonic = monotonic && m[0] >= 0.0 && m[1] >= 0.0 && m[2] >= 0.0;
+		most += m;
+	}
+
+	if (!monotonic || most[0] < 1.0 || most[1] < 1.0 || most[2] < 1.0) {
+		for (size_t k = 0; k < terms.size(); ++k)
+			terms[k].shadow = terms[k].light->shadowAttenuation(P + i.N * RAY_EPSILON);
+	} else {
+		// With many lights the colour may well come out white, and once
+		// it's white the rest can't change it, so trace the brightest first.
+		std::vector<int>& order = state.order;
+		order.resize(terms.size());
+		for (size_t k = 0; k < terms.size(); ++k)
+			order[k] = (int)k;
+		std::sort(order.begin(), order.end(), [&terms]( int a, int b ) {
+			double wa = largest(terms[a].most), wb = largest(terms[b].most);
+			return wa > wb || (wa == wb && a < b);
+		});
+
+		vec3f lit = result;
+		for (size_t k = 0; k < order.size(); ++k) {
+			if (lit[0] >= 1.0 && lit[1] >= 1.0 && lit[2] >= 1.0) {
+				RAY_COUNT( lightsCulled, order.size() - k );
+				return vec3f(1, 1, 1);
+			}
+			LightTerm& term = terms[order[k]];
+			term.shadow = term.light->shadowAttenuation(P + i.N * RAY_EPSILON);
+			lit += prod(term.atten * term.shadow, term.reflected);
+		}
+	}
+
+	// add them up in the scene's order whichever order they were traced in
+	for (size_t k = 0; k < terms.size(); ++k) {
+		const LightTerm& term = terms[k];
+		vec3f atten = term.atten * term.shadow;
+		result += prod(atten, term.reflected);
 	}
 	result = result.clamp();
 	return result;
@@ -7,11 +7,34 @@
 #ifndef __MATERIAL_H__
 #define __MATERIAL_H__
 
+#include <vector>
+
 #include "../vecmath/vecmath.h"
+#include "counters.h"
 
 class Scene;
 class ray;
 class isect;
+class Light;
+
+// One light's share of the phong sum at a hit, all but its shadow.
+struct LightTerm
+{
+	const Light *light;
+	int index;			// the light's place in the scene's list
+	double atten;		// distance attenuation
+	vec3f reflected;	// diffuse plus specular
+	vec3f most;			// what it adds unshadowed
+	vec3f shadow;		// its shadow attenuation, once traced
+};
+
+// Lights of a hit whose shadows have been traced already: the terms
+// Material::lightTerms() gave, with their shadows filled in.
+struct TracedLights
+{
+	const LightTerm *terms;
+	int count;
+};
 
 class Material
 {
@@ -28,9 +51,25 @@ public:
 
     Material( const vec3f& e, const vec3f& a, const vec3f& s, 
               const vec3f& d, const vec3f& r, const vec3f& t, double sh, double in)
-        : ke( e ), ka( a ), ks( s ), kd( d ), kr( r ), kt( t ), shininess( sh ), index( in ) {}
+        : ke( e ), ka( a ), ks( s ), kd( d ), kr( r ), kt( t ), shininess( sh ), index( in )
+        {}
+
+	// Materials on the heap are counted as they're allocated; the scratch
+	// ones that hits and shading keep on the stack aren't.
+	static void *operator new( size_t size )
+		{ RAY_COUNT( materialAllocs, 1 ); return ::operator new( size ); }
+	static void operator delete( void *p ) { ::operator delete( p ); }
+
+	// traced, if given, holds the lights of this hit with their shadows
+	// already traced; otherwise shade() traces them itself.
+	virtual vec3f shade( Scene *scene, const ray& r, const isect& i,
+		const TracedLights *traced = NULL ) const;
 
-	virtual vec3f shade( Scene *scene, const ray& r, const isect& i ) const;
+	// Add the terms of the lights shade() needs shadows of at this hit to
+	// terms, in the scene's order.  Lights that couldn't add more than the
+	// scene's light cutoff to any channel of the colour even unshadowed
+	// are left out.
+	void lightTerms( Scene *scene, const ray& r, const isect& i, std::vector<LightTerm>& terms ) const;
 
     vec3f ke;                    // emissive
     vec3f ka;                    // ambient
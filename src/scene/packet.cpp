@@ -0,0 +1,109 @@
+#include "packet.h"
+#include "scene.h"
+#include "kernels.h"
+
+PacketSlabs::PacketSlabs( const RayPacket& packet )
+	: packet( packet )
+{
+	maxT = 0.0;
+	for( int axis = 0; axis < 3; ++axis ) {
+		useAxis[axis] = packet.count > 0;
+		orgMin[axis] = invMin[axis] = 1.0e308;
+		orgMax[axis] = invMax[axis] = -1.0e308;
+	}
+
+	for( int k = 0; k < packet.count; ++k ) {
+		if( packet.tMax[k] > maxT )
+			maxT = packet.tMax[k];
+
+		for( int axis = 0; axis < 3; ++axis ) {
+			double o = packet.org[k][axis];
+			double d = packet.dir[k][axis];
+
+			// same guard against 0 * inf as RaySlabs
+			invDir[k][axis] = d != 0.0 ? 1.0 / d : 1.0e300;
+
+			if( d == 0.0 || ( d > 0.0 ) != ( packet.dir[0][axis] > 0.0 ) )
+				useAxis[axis] = false;
+
+			orgMin[axis] = o < orgMin[axis] ? o : orgMin[axis];
+			orgMax[axis] = o > orgMax[axis] ? o : orgMax[axis];
+			invMin[axis] = invDir[k][axis] < invMin[axis] ? invDir[k][axis] : invMin[axis];
+			invMax[axis] = invDir[k][axis] > invMax[axis] ? invDir[k][axis] : invMax[axis];
+		}
+	}
+}
+
+// Bounds of the product of the intervals [a0, a1] and [b0, b1].
+static void intervalProduct( double a0, double a1, double b0, double b1,
+	double& lo, double& hi )
+{
+	double p[4] = { a0 * b0, a0 * b1, a1 * b0, a1 * b1 };
+	lo = hi = p[0];
+	for( int k = 1; k < 4; ++k ) {
+		lo = p[k] < lo ? p[k] : lo;
+		hi = p[k] > hi ? p[k] : hi;
+	}
+}
+
+template <class Box>
+bool PacketSlabs::missesAll( const Box& box ) const
+{
+	// Every ray enters the box no earlier than the smallest entry distance
+	// any ray could have on any one axis, and leaves it no later than the
+	// largest exit distance.  If even those bounds don't overlap, nothing
+	// in the packet can hit it.
+	double entry = 0.0;
+	double exit = maxT;
+
+	for( int axis = 0; axis < 3; ++axis ) {
+		if( !useAxis[axis] )
+			continue;
+
+		double loMin, loMax, hiMin, hiMax;
+		intervalProduct( box.min[axis] - orgMax[axis], box.min[axis] - orgMin[axis],
+			invMin[axis], invMax[axis], loMin, loMax );
+		intervalProduct( box.max[axis] - orgMax[axis], box.max[axis] - orgMin[axis],
+			invMin[axis], invMax[axis], hiMin, hiMax );
+
+		// rays going the negative way enter through the max plane
+		bool positive = invMin[axis] > 0.0;
+		double axisEntry = positive ? loMin : hiMin;
+		double axisExit = positive ? hiMax : loMax;
+
+		if( axisEntry > entry )
+			entry = axisEntry;
+		if( axisExit < exit )
+			exit = axisExit;
+	}
+
+	return entry > exit;
+}
+
+template <class Box>
+bool PacketSlabs::hits( int k, const Box& box ) const
+{
+	double t0 = 0.0;
+	double t1 = packet.tMax[k];
+
+	for( int axis = 0; axis < 3; ++axis ) {
+		double tA = ( box.min[axis] - packet.org[k][axis] ) * invDir[k][axis];
+		double tB = ( box.max[axis] - packet.org[k][axis] ) * invDir[k][axis];
+		if( tA > tB ) {
+			double tmp = tA;
+			tA = tB;
+			tB = tmp;
+		}
+		if( tA > t0 )
+			t0 = tA;
+		if( tB < t1 )
+			t1 = tB;
+	}
+
+	return t0 <= t1;
+}
+
+template bool PacketSlabs::missesAll( const BoundingBox& box ) const;
+template bool PacketSlabs::missesAll( const FloatBox& box ) const;
+template bool PacketSlabs::hits( int k, const BoundingBox& box ) const;
+template bool PacketSlabs::hits( int k, const FloatBox& box ) const;
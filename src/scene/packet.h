@@ -0,0 +1,82 @@
+//
+// packet.h
+//
+// Bundles of rays that are traced through the scene together.  Rays in a
+// packet are expected to be coherent (neighbouring primary rays, or shadow
+// rays toward one light), so a single walk of the BVH serves all of them.
+//
+
+#ifndef __PACKET_H__
+#define __PACKET_H__
+
+#include "ray.h"
+
+// enough for an 8x8 block of pixels
+const int MAX_PACKET_SIZE = 64;
+
+class BoundingBox;
+struct FloatBox;
+
+class RayPacket
+{
+public:
+	RayPacket()
+		: count( 0 ) {}
+
+	// Append a ray that only looks for hits closer than tMax.
+	void add( const vec3f& p, const vec3f& d, double tMax = 1.0e308 )
+	{
+		org[count] = p;
+		dir[count] = d;
+		this->tMax[count] = tMax;
+		hit[count] = false;
+		++count;
+	}
+
+	// Empty the packet to fill it again.  Much cheaper than making a new
+	// one, whose isects each have a material to construct.
+	void clear() { count = 0; }
+
+	ray getRay( int k ) const { return ray( org[k], dir[k] ); }
+
+	int count;
+	vec3f org[ MAX_PACKET_SIZE ];
+	vec3f dir[ MAX_PACKET_SIZE ];
+	double tMax[ MAX_PACKET_SIZE ];
+
+	// results: whether ray k hit anything, and if so where
+	bool hit[ MAX_PACKET_SIZE ];
+	isect isects[ MAX_PACKET_SIZE ];
+};
+
+// A packet set up for slab tests.  Besides each ray's reciprocal direction
+// it keeps bounds on the origins and reciprocal directions of the whole
+// packet, so that a box can be culled for every ray at once with a single
+// interval slab test.  Axes along which the directions don't all share a
+// sign give no such bound and are left out of that test.
+class PacketSlabs
+{
+public:
+	PacketSlabs( const RayPacket& packet );
+
+	// True if no ray of the packet can hit the box.  Conservative: a false
+	// answer doesn't mean that any ray does.  Box is a BoundingBox or a
+	// FloatBox, which is tested in double like the other.
+	template <class Box>
+	bool missesAll( const Box& box ) const;
+
+	// Does ray k hit the box before its tMax?
+	template <class Box>
+	bool hits( int k, const Box& box ) const;
+
+private:
+	const RayPacket& packet;
+	double invDir[ MAX_PACKET_SIZE ][3];
+
+	bool useAxis[3];
+	double orgMin[3], orgMax[3];
+	double invMin[3], invMax[3];
+	double maxT;		// largest tMax in the packet when it was set up
+};
+
+#endif // __PACKET_H__
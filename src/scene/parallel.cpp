@@ -0,0 +1,25 @@
+#include "parallel.h"
+
+// Threads beyond the one that's always running.
+static std::atomic<int>& idleThreads()
+{
+	static std::atomic<int> idle( std::max( (int)std::thread::hardware_concurrency(), 1 ) - 1 );
+	return idle;
+}
+
+int claimThreads( int wanted )
+{
+	std::atomic<int>& idle = idleThreads();
+	int have = idle.load();
+	while( have > 0 && wanted > 0 ) {
+		int take = std::min( have, wanted );
+		if( idle.compare_exchange_weak( have, have - take ) )
+			return take;
+	}
+	return 0;
+}
+
+void releaseThreads( int count )
+{
+	idleThreads() += count;
+}
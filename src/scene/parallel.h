@@ -0,0 +1,52 @@
+//
+// parallel.h
+//
+// Loops spread over whichever hardware threads are idle.  A loop only
+// gets the threads that no other loop is using, so loops nested inside
+// each other (objects whose bounds build a hierarchy over their faces,
+// say) share the machine instead of each starting a thread per core.
+//
+
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Claim up to wanted of the idle threads; returns how many it got, which
+// may be none.  Give them back with releaseThreads() when done.
+int claimThreads( int wanted );
+void releaseThreads( int count );
+
+// Call body( first, last ) on consecutive ranges [first, last) of at most
+// grain items that together cover [0, count).  The calls are shared
+// between the calling thread and any idle threads, and may happen in any
+// order; returns once all of them have.
+template <class Body>
+void parallelFor( int count, int grain, const Body& body )
+{
+	int chunks = (count + grain - 1) / grain;
+	int helpers = chunks > 1 ? claimThreads( chunks - 1 ) : 0;
+
+	std::atomic<int> next( 0 );
+	auto work = [&]() {
+		int c;
+		while( (c = next++) < chunks ) {
+			int first = c * grain;
+			body( first, std::min( first + grain, count ) );
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for( int k = 0; k < helpers; ++k )
+		pool.push_back( std::thread( work ) );
+	work();
+
+	for( size_t k = 0; k < pool.size(); ++k )
+		pool[k].join();
+	releaseThreads( helpers );
+}
+
+#endif // __PARALLEL_H__
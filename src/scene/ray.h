@@ -43,38 +43,24 @@ class isect
 {
 public:
     isect()
-        : obj( NULL ), t( 0.0 ), N(), material(0) {}
+        : obj( NULL ), t( 0.0 ), N(), face( -1 ), bary() {}
+
+    isect( const isect& other )
+        : obj( other.obj ), t( other.t ), N( other.N ), face( other.face ), bary( other.bary ) {}
 
-    ~isect()
-    {
-        delete material;
-    }
-    
     void setObject( SceneObject *o ) { obj = o; }
     void setT( double tt ) { t = tt; }
     void setN( const vec3f& n ) { N = n; }
-    void setMaterial( Material *m ) { delete material; material = m; }
-        
+
+    // Only the hit itself is copied; the material is worked out again from
+    // it whenever it's asked for.
     isect& operator =( const isect& other )
     {
-        if( this != &other )
-        {
-            obj = other.obj;
-            t = other.t;
-            N = other.N;
-//            material = other.material ? new Material( *(other.material) ) : 0;
-			if( other.material )
-            {
-                if( material )
-                    *material = *other.material;
-                else
-                    material = new Material(*other.material );
-            }
-            else
-            {
-                material = 0;
-            }
-        }
+        obj = other.obj;
+        t = other.t;
+        N = other.N;
+        face = other.face;
+        bary = other.bary;
         return *this;
     }
 
@@ -82,12 +68,16 @@ public:
     const SceneObject 	*obj;
     double t;
     vec3f N;
-    Material *material;         // if this intersection has its own material
-                                // (as opposed to one in its associated object)
-                                // as in the case where the material was interpolated
+    int face;                   // for meshes, the face that was hit
+    vec3f bary;                 // and the barycentric coordinates on it
 
+    // The material at the hit.  Where it varies over the object (as with
+    // per-vertex materials on a mesh) it's interpolated on every call, so
+    // keep the reference rather than asking again.
     const Material &getMaterial() const;
-    // Other info here.
+
+private:
+    mutable Material material;  // holds an interpolated material
 };
 
 const double RAY_EPSILON = 0.00001;
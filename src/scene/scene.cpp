@@ -1,9 +1,12 @@
+#include <algorithm>
 #include <cmath>
+#include <chrono>
 
 #include "scene.h"
+#include "bvh.h"
 #include "light.h"
-#include "../ui/TraceUI.h"
-extern TraceUI* traceUI;
+#include "counters.h"
+#include "parallel.h"
 
 void BoundingBox::operator=(const BoundingBox& target)
 {
@@ -73,20 +76,98 @@ bool BoundingBox::intersect(const ray& r, double& tMin, double& tMax) const
 	return true; // it made it past all 3 axes.
 }
 
+void BoundingBox::merge(const BoundingBox& target)
+{
+	min = minimum(min, target.min);
+	max = maximum(max, target.max);
+}
+
+double BoundingBox::area() const
+{
+	vec3f d = max - min;
+	return 2.0 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+}
+
+
+void TransformNode::classify()
+{
+	const mat3f m = xform.upper33();
+	offset = vec3f( xform[0][3], xform[1][3], xform[2][3] );
+	invScale = 1.0;
+
+	mirrored = m[0] * m[1].cross( m[2] ) < 0.0;
+
+	// the scale and the move are exact in the matrix as the scene gave them
+	bool diagonal = m[0][1] == 0.0 && m[0][2] == 0.0 && m[1][0] == 0.0
+		&& m[1][2] == 0.0 && m[2][0] == 0.0 && m[2][1] == 0.0;
+	if( diagonal && m[0][0] == 1.0 && m[1][1] == 1.0 && m[2][2] == 1.0 ) {
+		kind = offset.iszero() ? IDENTITY : TRANSLATE;
+		return;
+	}
+	if( diagonal && m[0][0] > 0.0 && m[0][0] == m[1][1] && m[1][1] == m[2][2] ) {
+		kind = UNIFORM_SCALE;
+		invScale = 1.0 / m[0][0];
+		return;
+	}
+
+	// rotations come out of sin and cos, so they're only orthonormal to
+	// within rounding
+	const double tolerance = 1e-12;
+	kind = RIGID;
+	for( int row = 0; row < 3; ++row ) {
+		for( int col = 0; col < 3; ++col ) {
+			double expected = row == col ? 1.0 : 0.0;
+			if( fabs( m[row] * m[col] - expected ) > tolerance )
+				kind = GENERAL;
+		}
+	}
+}
+
+ray TransformNode::globalToLocalRay( const ray& r, double& scale ) const
+{
+	switch( kind ) {
+		case IDENTITY:
+			scale = 1.0;
+			return r;
+
+		case TRANSLATE:
+			scale = 1.0;
+			return ray( r.getPosition() - offset, r.getDirection() );
+
+		case UNIFORM_SCALE:
+			scale = invScale;
+			return ray( (r.getPosition() - offset) * invScale, r.getDirection() );
+
+		case RIGID:
+		{
+			// lengths are kept, so the direction stays a unit vector
+			const vec3f d = r.getDirection();
+			scale = 1.0;
+			return ray( inverse * r.getPosition(),
+				vec3f( inverse[0][0] * d[0] + inverse[0][1] * d[1] + inverse[0][2] * d[2],
+					   inverse[1][0] * d[0] + inverse[1][1] * d[1] + inverse[1][2] * d[2],
+					   inverse[2][0] * d[0] + inverse[2][1] * d[1] + inverse[2][2] * d[2] ) );
+		}
+
+		default:
+		{
+			vec3f pos = inverse * r.getPosition();
+			vec3f dir = inverse * (r.getPosition() + r.getDirection()) - pos;
+			scale = dir.length();
+			dir /= scale;
+			return ray( pos, dir );
+		}
+	}
+}
 
 bool Geometry::intersect(const ray&r, isect&i) const
 {
     // Transform the ray into the object's local coordinate space
-    vec3f pos = transform->globalToLocalCoords(r.getPosition());
-    vec3f dir = transform->globalToLocalCoords(r.getPosition() + r.getDirection()) - pos;
-    double length = dir.length();
-    dir /= length;
-
-    ray localRay( pos, dir );
+    double length;
+    ray localRay = transform->globalToLocalRay( r, length );
 
     if (intersectLocal(localRay, i)) {
-        // Transform the intersection point & normal returned back into global space.
-		i.N = transform->localToGlobalCoordsNormal(i.N);
+        // Transform the intersection distance back into global space.
 		i.t /= length;
 
 		return true;
@@ -96,11 +177,32 @@ bool Geometry::intersect(const ray&r, isect&i) const
     
 }
 
+void Geometry::finishHit( isect& i ) const
+{
+	i.N = transform->localToGlobalCoordsNormal( getLocalNormal( i ) );
+}
+
 bool Geometry::intersectLocal( const ray& r, isect& i ) const
 {
 	return false;
 }
 
+bool Geometry::occluded( const ray& r, double tMax ) const
+{
+	// same transformation as intersect(); distances scale by length
+	double length;
+	ray localRay = transform->globalToLocalRay( r, length );
+
+	return occludedLocal( localRay, tMax * length );
+}
+
+bool Geometry::occludedLocal( const ray& r, double tMax ) const
+{
+	// by default, whatever the closest hit is made of decides
+	isect i;
+	return intersectLocal( r, i ) && i.t < tMax && i.getMaterial().kt.iszero();
+}
+
 bool Geometry::hasBoundingBoxCapability() const
 {
 	// by default, primitives do not have to specify a bounding box.
@@ -120,23 +222,51 @@ Scene::~Scene()
     giter g;
     liter l;
     
+	// boundedobjects and nonboundedobjects only partition the entries
+	// of objects, so deleting those is enough.
 	for( g = objects.begin(); g != objects.end(); ++g ) {
 		delete (*g);
 	}
-
-	for( g = boundedobjects.begin(); g != boundedobjects.end(); ++g ) {
-		delete (*g);
+	for( SharedObjects::iterator s = shared.begin(); s != shared.end(); ++s ) {
+		delete s->second;
 	}
 
-	for( g = nonboundedobjects.begin(); g != boundedobjects.end(); ++g ) {
-		delete (*g);
-	}
+	delete bvh;
 
 	for( l = lights.begin(); l != lights.end(); ++l ) {
 		delete (*l);
 	}
 }
 
+// Callback for BVH::intersect that tests the bounded objects of a leaf
+// and keeps the closest hit in the caller's isect.
+struct BoundedHit
+{
+	BoundedHit( const vector<Geometry*>& objs, isect& i, bool have_one )
+		: objs( objs ), i( i ), have_one( have_one ) {}
+
+	bool operator()( const int *index, int count, const ray& r, double& tMax )
+	{
+		bool hit = false;
+		for( int k = 0; k < count; ++k ) {
+			if( objs[ index[k] ]->intersect( r, cur ) ) {
+				if( !have_one || (cur.t < i.t) ) {
+					i = cur;
+					have_one = true;
+					tMax = cur.t;
+					hit = true;
+				}
+			}
+		}
+		return hit;
+	}
+
+	const vector<Geometry*>& objs;
+	isect& i;
+	isect cur;
+	bool have_one;
+};
+
 // Get any intersection with an object.  Return information about the 
 // intersection through the reference parameter.
 bool Scene::intersect( const ray& r, isect& i ) const
@@ -146,6 +276,7 @@ bool Scene::intersect( const ray& r, isect& i ) const
 
 	isect cur;
 	bool have_one = false;
+	RAY_COUNT( intersectCalls, 1 );
 
 	// try the non-bounded objects
 	for( j = nonboundedobjects.begin(); j != nonboundedobjects.end(); ++j ) {
@@ -157,24 +288,277 @@ bool Scene::intersect( const ray& r, isect& i ) const
 		}
 	}
 
-	// try the bounded objects
-	for( j = boundedobjects.begin(); j != boundedobjects.end(); ++j ) {
-		if( (*j)->intersect( r, cur ) ) {
-			if( !have_one || (cur.t < i.t) ) {
-				i = cur;
-				have_one = true;
+	// try the bounded objects, letting the hierarchy cull everything
+	// beyond the closest hit found so far
+	if( bvh ) {
+		BoundedHit hit( boundedobjects, i, have_one );
+		if( bvh->intersect( r, have_one ? i.t : 1.0e308, hit ) )
+			have_one = true;
+	}
+
+	// only the winner needs its normal
+	if( have_one ) {
+		i.obj->finishHit( i );
+		RAY_COUNT( hits, 1 );
+	}
+
+	return have_one;
+}
+
+// Callback for BVH::intersectPacket; like BoundedHit, but the closest hit
+// of each ray goes into the packet.
+struct BoundedPacketHit
+{
+	BoundedPacketHit( const vector<Geometry*>& objs, RayPacket& packet )
+		: objs( objs ), packet( packet ) {}
+
+	bool operator()( int ray_k, const int *index, int count, const ray& r, double& tMax )
+	{
+		bool hit = false;
+		for( int k = 0; k < count; ++k ) {
+			if( objs[ index[k] ]->intersect( r, cur ) && cur.t < tMax ) {
+				packet.isects[ ray_k ] = cur;
+				packet.hit[ ray_k ] = true;
+				tMax = cur.t;
+				hit = true;
 			}
 		}
+		return hit;
 	}
 
+	const vector<Geometry*>& objs;
+	RayPacket& packet;
+	isect cur;
+};
 
-	return have_one;
+// Find the closest hit of every ray in the packet, ignoring hits at or
+// beyond each ray's tMax, and finish them as the single-ray version does.
+// The packet's tMax entries are left at the distances of the hits.
+void Scene::intersect( RayPacket& packet ) const
+{
+	typedef list<Geometry*>::const_iterator iter;
+
+	isect cur;
+	RAY_COUNT( intersectCalls, packet.count );
+	for( iter j = nonboundedobjects.begin(); j != nonboundedobjects.end(); ++j ) {
+		for( int k = 0; k < packet.count; ++k ) {
+			if( (*j)->intersect( packet.getRay( k ), cur ) && cur.t < packet.tMax[k] ) {
+				packet.isects[k] = cur;
+				packet.hit[k] = true;
+				packet.tMax[k] = cur.t;
+			}
+		}
+	}
+
+	if( bvh ) {
+		BoundedPacketHit hit( boundedobjects, packet );
+		bvh->intersectPacket( packet, hit );
+	}
+
+	for( int k = 0; k < packet.count; ++k ) {
+		if( packet.hit[k] ) {
+			packet.isects[k].obj->finishHit( packet.isects[k] );
+			RAY_COUNT( hits, 1 );
+		}
+	}
+}
+
+// Callback for BVH::occluded over the bounded objects.
+struct BoundedOcclusion
+{
+	BoundedOcclusion( const vector<Geometry*>& objs )
+		: objs( objs ) {}
+
+	bool operator()( const int *index, int count, const ray& r, double& tMax )
+	{
+		for( int k = 0; k < count; ++k ) {
+			if( objs[ index[k] ]->occluded( r, tMax ) )
+				return true;
+		}
+		return false;
+	}
+
+	const vector<Geometry*>& objs;
+};
+
+bool Scene::occluded( const ray& r, double tMax ) const
+{
+	typedef list<Geometry*>::const_iterator iter;
+	RAY_COUNT( occlusionQueries, 1 );
+
+	for( iter j = nonboundedobjects.begin(); j != nonboundedobjects.end(); ++j ) {
+		if( (*j)->occluded( r, tMax ) )
+			return true;
+	}
+
+	if( bvh ) {
+		BoundedOcclusion occlusion( boundedobjects );
+		return bvh->occluded( r, tMax, occlusion );
+	}
+	return false;
+}
+
+// Does r meet obj anywhere before tMax, whatever it's made of?
+static bool meets( const Geometry *obj, const ray& r, double tMax )
+{
+	isect i;
+	return obj->intersect( r, i ) && i.t < tMax;
+}
+
+// Callback for BVH::occludedPacket; BoundedOcclusion for one ray of the
+// packet.  With through given, transparent objects don't stop the ray but
+// mark it in through instead.
+struct BoundedPacketOcclusion
+{
+	BoundedPacketOcclusion( const vector<Geometry*>& objs, bool *through )
+		: objs( objs ), through( through ) {}
+
+	bool operator()( int ray_k, const int *index, int count, const ray& r, double& tMax )
+	{
+		for( int k = 0; k < count; ++k ) {
+			const Geometry *obj = objs[ index[k] ];
+			if( through && obj->hasTransparency() ) {
+				if( !through[ ray_k ] && meets( obj, r, tMax ) )
+					through[ ray_k ] = true;
+			} else if( obj->occluded( r, tMax ) ) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	const vector<Geometry*>& objs;
+	bool *through;
+};
+
+void Scene::occluded( RayPacket& packet, bool *through ) const
+{
+	typedef list<Geometry*>::const_iterator iter;
+	RAY_COUNT( occlusionQueries, packet.count );
+
+	if( through )
+		std::fill( through, through + packet.count, false );
+	for( iter j = nonboundedobjects.begin(); j != nonboundedobjects.end(); ++j ) {
+		bool transparent = through && (*j)->hasTransparency();
+		for( int k = 0; k < packet.count; ++k ) {
+			if( packet.hit[k] )
+				continue;
+			ray r = packet.getRay( k );
+			if( transparent ) {
+				if( !through[k] && meets( *j, r, packet.tMax[k] ) )
+					through[k] = true;
+			} else if( (*j)->occluded( r, packet.tMax[k] ) ) {
+				packet.hit[k] = true;
+			}
+		}
+	}
+
+	if( bvh ) {
+		BoundedPacketOcclusion occlusion( boundedobjects, through );
+		bvh->occludedPacket( packet, occlusion );
+	}
+}
+
+// Most objects can be hit more than once along a ray, but intersect() only
+// reports the closest hit.  The rest are found by starting again from each
+// hit, up to this many times per object.
+const int MAX_HITS_PER_OBJECT = 16;
+
+// Add each pass of r through the transparent object obj before tMax: its
+// first hit, third, and so on.  A last hit without a partner, leaving the
+// object r started in or going through a single surface, is a pass too.
+static void objectHits( const Geometry *obj, const ray& r, double tMax, vector<TransparentHit>& hits )
+{
+	ray R = r;
+	isect i;
+	double t = 0.0;
+	for( int n = 0; n < MAX_HITS_PER_OBJECT && obj->intersect( R, i ); ++n ) {
+		// a hit that doesn't move the ray along would repeat forever
+		if( i.t <= 0.0 )
+			break;
+		t += i.t;
+		if( t >= tMax )
+			break;
+		if( n % 2 == 0 )
+			hits.push_back( TransparentHit( t, i.getMaterial().kt ) );
+		R = ray( r.at( t ), r.getDirection() );
+	}
+}
+
+// Callback for BVH::occluded that collects the hits of the transparent
+// objects of a leaf and stops at the first opaque one.  It never shrinks
+// tMax, so every leaf along the ray is visited otherwise.
+struct BoundedShadowHits
+{
+	BoundedShadowHits( const vector<Geometry*>& objs, vector<TransparentHit>& hits )
+		: objs( objs ), hits( hits ) {}
+
+	bool operator()( const int *index, int count, const ray& r, double& tMax )
+	{
+		for( int k = 0; k < count; ++k ) {
+			const Geometry *obj = objs[ index[k] ];
+			if( obj->hasTransparency() )
+				objectHits( obj, r, tMax, hits );
+			else if( obj->occluded( r, tMax ) )
+				return true;
+		}
+		return false;
+	}
+
+	const vector<Geometry*>& objs;
+	vector<TransparentHit>& hits;
+};
+
+bool Scene::transparentHits( const ray& r, double tMax, vector<TransparentHit>& hits ) const
+{
+	typedef list<Geometry*>::const_iterator iter;
+	RAY_COUNT( occlusionQueries, 1 );
+
+	hits.clear();
+	for( iter j = nonboundedobjects.begin(); j != nonboundedobjects.end(); ++j ) {
+		if( (*j)->hasTransparency() )
+			objectHits( *j, r, tMax, hits );
+		else if( (*j)->occluded( r, tMax ) )
+			return false;
+	}
+
+	if( bvh ) {
+		BoundedShadowHits collect( boundedobjects, hits );
+		if( bvh->occluded( r, tMax, collect ) )
+			return false;
+	}
+
+	std::sort( hits.begin(), hits.end() );
+	return true;
 }
 
 void Scene::initScene()
 {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// Objects' bounds don't depend on each other, so they are worked out
+	// in parallel.  Meshes build their face hierarchies here too, which is
+	// where most of the time goes in big scenes.  Instances' bounds come
+	// from what they share, so that's done first.
+	vector<Geometry*> all;
+	for( SharedObjects::const_iterator s = shared.begin(); s != shared.end(); ++s )
+		all.push_back( s->second );
+	parallelFor( (int)all.size(), 1, [&]( int first, int last ) {
+		for( int k = first; k < last; ++k )
+			all[k]->ComputeBoundingBox();
+	} );
+
+	all.assign( objects.begin(), objects.end() );
+	parallelFor( (int)all.size(), 1, [&]( int first, int last ) {
+		for( int k = first; k < last; ++k )
+			all[k]->ComputeBoundingBox();
+	} );
+
 	bool first_boundedobject = true;
 	BoundingBox b;
+	transparent = false;
+	nonboundedobjects.clear();
+	boundedobjects.clear();
 	
 	typedef list<Geometry*>::const_iterator iter;
 	// split the objects into two categories: bounded and non-bounded
@@ -197,5 +581,26 @@ void Scene::initScene()
 		}
 		else
 			nonboundedobjects.push_back(*j);
+
+		if( (*j)->hasTransparency() )
+			transparent = true;
+	}
+
+	// build the hierarchy over everything that has a bounding box
+	if( !bvh && !boundedobjects.empty() ) {
+		vector<BoundingBox> boxes( boundedobjects.size() );
+		for( size_t k = 0; k < boundedobjects.size(); ++k )
+			boxes[k] = boundedobjects[k]->getBoundingBox();
+
+		bvh = new BVH;
+		bvh->build( boxes );
 	}
+
+	prepareSeconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
+
+void Scene::setBVH( BVH *saved )
+{
+	delete bvh;
+	bvh = saved;
 }
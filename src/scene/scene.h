@@ -8,6 +8,9 @@
 #define __SCENE_H__
 
 #include <list>
+#include <vector>
+#include <map>
+#include <string>
 #include <algorithm>
 
 using namespace std;
@@ -19,6 +22,8 @@ using namespace std;
 
 class Light;
 class Scene;
+class BVH;
+class RayPacket;
 
 class SceneElement
 {
@@ -52,6 +57,12 @@ public:
 	// closest to the origin in tMin and the "t" value of the far intersection
 	// in tMax and return true, else return false.
 	bool intersect(const ray& r, double& tMin, double& tMax) const;
+
+	// grow this box so that it also encloses the target
+	void merge(const BoundingBox& target);
+
+	// total surface area of the box's six faces
+	double area() const;
 };
 
 class TransformNode
@@ -68,6 +79,18 @@ protected:
     list<TransformNode*> children;
     
 public:
+    // What the transformation amounts to, worked out once when the node is
+    // made so that rays through the common kinds needn't go through the
+    // whole of inverse.
+    enum Kind
+    {
+        IDENTITY,
+        TRANSLATE,          // a move and nothing else
+        UNIFORM_SCALE,      // the same positive scale on every axis, and a move
+        RIGID,              // a rotation or reflection, and a move
+        GENERAL
+    };
+
    	typedef list<TransformNode*>::iterator          child_iter;
 	typedef list<TransformNode*>::const_iterator    child_citer;
 
@@ -85,26 +108,42 @@ public:
     }
     
     // Coordinate-Space transformation
-    vec3f globalToLocalCoords(const vec3f &v)
+    vec3f globalToLocalCoords(const vec3f &v) const
     {
         return inverse * v;
     }
 
-    vec3f localToGlobalCoords(const vec3f &v)
+    vec3f localToGlobalCoords(const vec3f &v) const
     {
         return xform * v;
     }
 
-    vec4f localToGlobalCoords(const vec4f &v)
+    vec4f localToGlobalCoords(const vec4f &v) const
     {
         return xform * v;
     }
 
-    vec3f localToGlobalCoordsNormal(const vec3f &v)
+    vec3f localToGlobalCoordsNormal(const vec3f &v) const
     {
+        // normi is the identity, or a multiple of it, for the first three
+        if( kind == IDENTITY || kind == TRANSLATE || kind == UNIFORM_SCALE )
+            return v.normalize();
         return (normi * v).normalize();
     }
 
+    // Bring r, whose direction must be a unit vector as every ray the
+    // tracer makes is, into local space.  The local ray's direction is a
+    // unit vector too; a distance along it is scale times the distance
+    // along r.
+    ray globalToLocalRay( const ray& r, double& scale ) const;
+
+    // the whole local to global transformation, parents included
+    const mat4f& getXform() const { return xform; }
+    Kind getKind() const { return kind; }
+
+    // Does the transformation turn things inside out?
+    bool isMirrored() const { return mirrored; }
+
 protected:
     // protected so that users can't directly construct one of these...
     // force them to use the createChild() method.  Note that they CAN
@@ -120,7 +159,16 @@ protected:
         
         inverse = this->xform.inverse();
         normi = this->xform.upper33().inverse().transpose();
+        classify();
     }
+
+private:
+    Kind     kind;
+    bool     mirrored;
+    vec3f    offset;        // where the local origin goes
+    double   invScale;      // 1 over the scale, for UNIFORM_SCALE
+
+    void classify();
 };
 
 class TransformRoot : public TransformNode
@@ -137,13 +185,32 @@ class Geometry
 	: public SceneElement
 {
 public:
-    // intersections performed in the global coordinate space.
+    // intersections performed in the global coordinate space.  Only t is
+    // in global terms; the rest of i stays as intersectLocal left it until
+    // finishHit() is called, which is left for the closest hit alone.
     virtual bool intersect(const ray&r, isect&i) const;
+
+    // Bring the normal of a hit found by intersect() into global space.
+    void finishHit( isect& i ) const;
+
+    // The unit normal of hit i in local space.  Most objects compute it in
+    // intersectLocal and leave it in i.N; others put it off until here.
+    virtual vec3f getLocalNormal( const isect& i ) const { return i.N; }
     
     // intersections performed in the object's local coordinate space
     // do not call directly - this should only be called by intersect()
 	virtual bool intersectLocal( const ray& r, isect& i ) const;
 
+	// Does an opaque part of the object block the ray before tMax?  Shadow
+	// rays only need a yes or no, so this needn't find the closest hit.
+	virtual bool occluded( const ray& r, double tMax ) const;
+
+	// occluded() in the object's local coordinate space, with tMax in
+	// local units.  Same rules as intersectLocal.
+	virtual bool occludedLocal( const ray& r, double tMax ) const;
+
+	// Can any light pass through the object?
+	virtual bool hasTransparency() const { return false; }
 
 	virtual bool hasBoundingBoxCapability() const;
 	const BoundingBox& getBoundingBox() const { return bounds; }
@@ -193,6 +260,7 @@ public:
     virtual BoundingBox ComputeLocalBoundingBox() { return BoundingBox(); }
 
     void setTransform(TransformNode *transform) { this->transform = transform; };
+    TransformNode *getTransform() const { return transform; }
     
 	Geometry( Scene *scene ) 
 		: SceneElement( scene ) {}
@@ -212,7 +280,14 @@ class SceneObject
 public:
 	virtual const Material& getMaterial() const = 0;
 	virtual void setMaterial( Material *m ) = 0;
+
+	// The material at hit i.  Objects whose material varies over the
+	// surface work it out into scratch and return that.
+	virtual const Material& getHitMaterial( const isect& i, Material& scratch ) const
+	{ return getMaterial(); }
+
 	virtual bool hasInterior() const { return true; }
+	virtual bool hasTransparency() const { return !getMaterial().kt.iszero(); }
 	virtual void setOrder(int ord) = 0;
 	virtual int getOrder() const { return order; }
 
@@ -246,6 +321,19 @@ protected:
 	int order;
 };
 
+// A shadow ray passing through a transparent object, where it first
+// meets the object's surface.
+struct TransparentHit
+{
+	TransparentHit( double t, const vec3f& kt )
+		: t( t ), kt( kt ) {}
+
+	bool operator<( const TransparentHit& other ) const { return t < other.t; }
+
+	double t;
+	vec3f kt;
+};
+
 class Scene
 {
 public:
@@ -259,17 +347,31 @@ public:
 
 public:
 	Scene() 
-		: transformRoot(), objects(), lights() {}
+		: transformRoot(), objects(), lights(), bvh( NULL ), transparent( false ),
+		  prepareSeconds( 0.0 ), lightCutoff( 0.0 ) {}
 	virtual ~Scene();
 
+	// The object's bounds are worked out by initScene(), so it must be
+	// complete by then but needn't be yet.
 	void add( Geometry* obj )
-	{
-		obj->ComputeBoundingBox();
-		objects.push_back( obj );
-	}
+	{ objects.push_back( obj ); }
 	void add( Light* light )
 	{ lights.push_back( light ); }
 
+	// Objects that instances (SceneObjects/Instance.h) share, by name.
+	// They aren't traced themselves, but the scene owns them and
+	// initScene() gets them ready before the objects that refer to them.
+	// Their own transformations must be the identity.
+	typedef map<string, SceneObject*> SharedObjects;
+	void addShared( const string& name, SceneObject* obj )
+	{ shared[ name ] = obj; }
+	SceneObject *getShared( const string& name ) const
+	{
+		SharedObjects::const_iterator s = shared.find( name );
+		return s == shared.end() ? NULL : s->second;
+	}
+	const SharedObjects& getSharedObjects() const { return shared; }
+
 	vec3f getAmbient() const {
 		return m_AmbientLight;
 	}
@@ -281,10 +383,55 @@ public:
 	}
 
 	bool intersect( const ray& r, isect& i ) const;
+	void intersect( RayPacket& packet ) const;
+
+	// Is there anything opaque along r before tMax?  Stops at the first
+	// opaque hit found, which need not be the closest one.
+	bool occluded( const ray& r, double tMax ) const;
+
+	// occluded() for every ray of a packet in one walk of the hierarchy:
+	// hit is set for each ray with something opaque before its tMax.  The
+	// packet's isects are left alone.  If through is given, through[k] is
+	// set for each ray that meets a transparent object before its tMax,
+	// which only transparentHits() can follow.
+	void occluded( RayPacket& packet, bool *through = NULL ) const;
+
+	// Collect each pass of r through a transparent object before tMax into
+	// hits, nearest first, in one walk of the scene.  An object's hits are
+	// paired up as entering and leaving it, on its own, so objects can
+	// overlap, have only one surface or have r start inside them.  Returns
+	// false, with hits incomplete, as soon as an opaque object is found in
+	// the way.
+	bool transparentHits( const ray& r, double tMax, vector<TransparentHit>& hits ) const;
+
+	// Does any object in the scene let light through?  Set by initScene().
+	bool hasTransparency() const { return transparent; }
+
+	// Get the scene ready to trace: work out the objects' bounds, building
+	// any hierarchies of their own along the way, then build the one over
+	// the objects.  Both steps use whatever threads are idle.
 	void initScene();
 
+	// How long the last initScene() took, in seconds.
+	double getPrepareTime() const { return prepareSeconds; }
+
+	// Material::shade() skips lights that couldn't add more than this to
+	// any channel of a hit's colour, tracing no shadow ray toward them.
+	double getLightCutoff() const { return lightCutoff; }
+	void setLightCutoff( double cutoff ) { lightCutoff = cutoff; }
+
+	int getLightCount() const { return (int)lights.size(); }
 	list<Light*>::const_iterator beginLights() const { return lights.begin(); }
 	list<Light*>::const_iterator endLights() const { return lights.end(); }
+
+	list<Geometry*>::const_iterator beginObjects() const { return objects.begin(); }
+	list<Geometry*>::const_iterator endObjects() const { return objects.end(); }
+
+	// The hierarchy over the bounded objects, once initScene() has run.  A
+	// scene loaded from a compiled file is handed the saved one before
+	// initScene(), which then keeps it instead of building another.
+	const BVH *getBVH() const { return bvh; }
+	void setBVH( BVH *saved );
         
 	Camera *getCamera() { return &camera; }
 
@@ -292,8 +439,9 @@ public:
 
 private:
     list<Geometry*> objects;
+	SharedObjects shared;
 	list<Geometry*> nonboundedobjects;
-	list<Geometry*> boundedobjects;
+	vector<Geometry*> boundedobjects;
     list<Light*> lights;
     Camera camera;
 	vec3f m_AmbientLight;
@@ -302,6 +450,14 @@ private:
 	// must fall within this bounding box.  Objects that don't have hasBoundingBoxCapability()
 	// are exempt from this requirement.
 	BoundingBox sceneBounds;
+
+	// Hierarchy over boundedobjects, built by initScene().  Leaves refer to
+	// objects by their position in boundedobjects.
+	BVH *bvh;
+
+	bool transparent;
+	double prepareSeconds;
+	double lightCutoff;
 };
 
 #endif // __SCENE_H__
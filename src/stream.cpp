@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "stream.h"
+#include "fileio/bitmap.h"
+
+// What a checkpoint records.
+struct Checkpoint
+{
+	string scene;
+	int width;
+	int height;
+	string options;
+	int rows;			// rows on disk, from the bottom
+};
+
+static const char checkpointMagic[] = "ray checkpoint 1";
+
+// The options and tone mapping that change the image, as text to compare;
+// the rest only change how it is computed.
+static string describeOptions( const RenderOptions& o, const ToneMap& t )
+{
+	char buf[256];
+	sprintf( buf, "%d %.17g %.17g %.17g %.17g %d %.17g %d %.17g %d", o.depth, o.threshold,
+		o.constAtten, o.linearAtten, o.quadAtten, o.aaSamples, o.aaThreshold,
+		o.hdr ? 1 : 0, t.exposure, (int)t.op );
+	return buf;
+}
+
+string checkpointName( const char *imgName )
+{
+	return string( imgName ) + ".ckpt";
+}
+
+// Write the checkpoint to a new file and rename it over the old one, so
+// that there is always a whole checkpoint on disk.
+static bool writeCheckpoint( const string& filename, const Checkpoint& c )
+{
+	string temp = filename + ".new";
+	FILE *f = fopen( temp.c_str(), "w" );
+	if( !f )
+		return false;
+
+	fprintf( f, "%s\n", checkpointMagic );
+	fprintf( f, "scene %s\n", c.scene.c_str() );
+	fprintf( f, "image %d %d\n", c.width, c.height );
+	fprintf( f, "options %s\n", c.options.c_str() );
+	fprintf( f, "rows %d\n", c.rows );
+	if( fclose( f ) != 0 )
+		return false;
+
+#ifdef _WIN32
+	// rename won't replace a file here
+	remove( filename.c_str() );
+#endif
+	return rename( temp.c_str(), filename.c_str() ) == 0;
+}
+
+// Read the rest of the line after the keyword, which must start it.
+static bool readField( FILE *f, const char *keyword, string& value )
+{
+	char line[4096];
+	if( !fgets( line, sizeof( line ), f ) )
+		return false;
+
+	size_t n = strlen( keyword );
+	if( strncmp( line, keyword, n ) || line[n] != ' ' )
+		return false;
+
+	value = line + n + 1;
+	while( !value.empty() && (value[value.size() - 1] == '\n' || value[value.size() - 1] == '\r') )
+		value.erase( value.size() - 1 );
+	return true;
+}
+
+static bool readCheckpoint( const string& filename, Checkpoint& c )
+{
+	FILE *f = fopen( filename.c_str(), "r" );
+	if( !f )
+		return false;
+
+	char magic[64];
+	string image, rows;
+	bool ok = fgets( magic, sizeof( magic ), f )
+		&& !strncmp( magic, checkpointMagic, strlen( checkpointMagic ) )
+		&& readField( f, "scene", c.scene )
+		&& readField( f, "image", image )
+		&& readField( f, "options", c.options )
+		&& readField( f, "rows", rows )
+		&& sscanf( image.c_str(), "%d %d", &c.width, &c.height ) == 2
+		&& sscanf( rows.c_str(), "%d", &c.rows ) == 1;
+
+	fclose( f );
+	return ok;
+}
+
+static double secondsSince( std::chrono::steady_clock::time_point start )
+{
+	return std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
+
+bool renderStreaming( RayTracer& tracer, const char *sceneName, char *imgName,
+	int width, int height, int stripRows, int threads, bool resume, StreamTimes& times )
+{
+	Checkpoint c;
+	c.scene = sceneName;
+	c.width = width;
+	c.height = height;
+	c.options = describeOptions( tracer.getOptions(), tracer.getToneMap() );
+	c.rows = 0;
+
+	string ckptName = checkpointName( imgName );
+	FILE *image;
+	if( resume ) {
+		Checkpoint saved;
+		if( !readCheckpoint( ckptName, saved ) ) {
+			fprintf( stderr, "couldn't read the checkpoint %s\n", ckptName.c_str() );
+			return false;
+		}
+		if( saved.scene != c.scene || saved.width != c.width || saved.height != c.height
+			|| saved.options != c.options || saved.rows < 0 || saved.rows > c.height ) {
+			fprintf( stderr, "%s is of a different render; start it again without resuming\n",
+				ckptName.c_str() );
+			return false;
+		}
+
+		c.rows = saved.rows;
+		image = resumeBMP( imgName, width, height, c.rows );
+		if( !image ) {
+			fprintf( stderr, "couldn't resume %s\n", imgName );
+			return false;
+		}
+	} else {
+		image = beginBMP( imgName, width, height );
+		if( !image || fflush( image ) != 0 || !writeCheckpoint( ckptName, c ) ) {
+			fprintf( stderr, "couldn't write %s\n", image ? ckptName.c_str() : imgName );
+			if( image )
+				fclose( image );
+			return false;
+		}
+	}
+
+	times.firstRow = c.rows;
+	tracer.traceStripSetup( width, height, stripRows );
+	while( c.rows < height ) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		tracer.traceStrip( c.rows, threads );
+		times.renderSeconds += secondsSince( start );
+
+		// the rows have to be on disk before the checkpoint says so
+		start = std::chrono::steady_clock::now();
+		int y0, rows;
+		const unsigned char *strip = tracer.getStrip( y0, rows );
+		c.rows += rows;
+		if( !writeBMPRows( image, width, rows, strip ) || fflush( image ) != 0
+			|| !writeCheckpoint( ckptName, c ) ) {
+			fprintf( stderr, "couldn't write %s\n", imgName );
+			fclose( image );
+			return false;
+		}
+		times.writeSeconds += secondsSince( start );
+	}
+
+	if( fclose( image ) != 0 ) {
+		fprintf( stderr, "couldn't write %s\n", imgName );
+		return false;
+	}
+	remove( ckptName.c_str() );
+	return true;
+}
@@ -0,0 +1,42 @@
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+// Rendering straight to disk a strip of rows at a time, so that memory is
+// bounded by the strip rather than the image, for renders too big to hold.
+//
+// Each strip goes into the bitmap as soon as it is done, and a checkpoint
+// next to it (out.bmp -> out.bmp.ckpt) then records how many rows are
+// safely on disk, with the scene, size and options they were rendered
+// with.  Resuming reads the checkpoint and carries on from there if all
+// of those still match.  The checkpoint is removed once the image is
+// complete.
+
+#include <string>
+
+#include "RayTracer.h"
+
+using namespace std;
+
+// Rows to a strip when resuming without saying.
+const int DEFAULT_STRIP_ROWS = 64;
+
+struct StreamTimes
+{
+	StreamTimes() : renderSeconds( 0.0 ), writeSeconds( 0.0 ), firstRow( 0 ) {}
+
+	double renderSeconds;
+	double writeSeconds;
+	int firstRow;			// where this run started, above 0 if it resumed
+};
+
+// Render the width x height image of the scene tracer has loaded from
+// sceneName into imgName, stripRows rows at a time on threads threads.
+// With resume, carry on from imgName's checkpoint.  Returns false, with
+// the reason printed, if the image can't be written or can't be resumed.
+bool renderStreaming( RayTracer& tracer, const char *sceneName, char *imgName,
+	int width, int height, int stripRows, int threads, bool resume, StreamTimes& times );
+
+// Where the checkpoint for imgName goes.
+string checkpointName( const char *imgName );
+
+#endif // __STREAM_H__
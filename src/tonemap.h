@@ -0,0 +1,39 @@
+#ifndef __TONEMAP_H__
+#define __TONEMAP_H__
+
+// Bringing the unclamped colours of an HDR render (RenderOptions::hdr)
+// down to ones that can be displayed.  Applied as pixels are stored and
+// again whenever it changes, so a new exposure needs no new render.
+
+#include <math.h>
+
+#include "vecmath/vecmath.h"
+
+enum ToneOperator
+{
+	TONE_CLAMP,			// cut off at 1
+	TONE_REINHARD		// c / (1 + c): rolls highlights off instead
+};
+
+struct ToneMap
+{
+	ToneMap() : exposure( 0.0 ), op( TONE_CLAMP ) {}
+
+	double exposure;	// in stops; each one doubles the brightness
+	ToneOperator op;
+
+	bool isIdentity() const { return exposure == 0.0 && op == TONE_CLAMP; }
+
+	// col mapped into [0,1]
+	vec3f apply( const vec3f& col ) const
+	{
+		vec3f c = exposure == 0.0 ? col : col * pow( 2.0, exposure );
+		if( op == TONE_REINHARD ) {
+			for( int k = 0; k < 3; ++k )
+				c[k] = c[k] > 0.0 ? c[k] / (1.0 + c[k]) : 0.0;
+		}
+		return c.clamp();
+	}
+};
+
+#endif // __TONEMAP_H__
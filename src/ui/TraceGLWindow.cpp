@@ -37,6 +37,8 @@ void TraceGLWindow::draw()
 
 	glClear( GL_COLOR_BUFFER_BIT );
 
+	// during a render this reads the buffer as it's being written; see
+	// TraceUI::cb_renderTimer
 	unsigned char* buf;
 	raytracer->getBuffer(buf, m_nDrawWidth, m_nDrawHeight);
 
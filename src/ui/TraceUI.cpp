@@ -12,7 +12,8 @@
 #include "TraceUI.h"
 #include "../RayTracer.h"
 
-static bool done;
+// how often the image is redrawn while rendering, in seconds
+static const double REDRAW_INTERVAL = 1.0 / 20.0;
 
 //------------------------------------- Help Functions --------------------------------------------
 TraceUI* TraceUI::whoami(Fl_Menu_* o)	// from menu item back to UI itself
@@ -30,10 +31,15 @@ void TraceUI::cb_load_scene(Fl_Menu_* o, void* v)
 	if (newfile != NULL) {
 		char buf[256];
 
+		// terminate the previous rendering
+		pUI->stopRender();
+
+		pUI->raytracer->setOptions(pUI->getRenderOptions());
 		if (pUI->raytracer->loadScene(newfile)) {
 			sprintf(buf, "Ray <%s>", newfile);
-			done=true;	// terminate the previous rendering
 		} else{
+			if (!pUI->raytracer->getLoadError().empty())
+				fl_alert("ParseError: %s\n", pUI->raytracer->getLoadError().c_str());
 			sprintf(buf, "Ray <Not Loaded>");
 		}
 
@@ -56,7 +62,7 @@ void TraceUI::cb_exit(Fl_Menu_* o, void* v)
 	TraceUI* pUI=whoami(o);
 
 	// terminate the rendering
-	done=true;
+	pUI->stopRender();
 
 	pUI->m_traceGlWindow->hide();
 	pUI->m_mainWindow->hide();
@@ -67,7 +73,7 @@ void TraceUI::cb_exit2(Fl_Widget* o, void* v)
 	TraceUI* pUI=(TraceUI *)(o->user_data());
 	
 	// terminate the rendering
-	done=true;
+	pUI->stopRender();
 
 	pUI->m_traceGlWindow->hide();
 	pUI->m_mainWindow->hide();
@@ -117,86 +123,134 @@ void TraceUI::cb_intThershSlides(Fl_Widget* o, void* v)
 	((TraceUI*)(o->user_data()))->m_nIntThresh = double(((Fl_Slider *)o)->value());
 }
 
-void TraceUI::cb_render(Fl_Widget* o, void* v)
+// Between off and MIN_AA_SAMPLES the slider snaps to whichever is nearer,
+// since no budget in between can refine a pixel.
+void TraceUI::cb_aaSamplesSlides(Fl_Widget* o, void* v)
+{
+	Fl_Slider* slider = (Fl_Slider *)o;
+	int samples = int(slider->value());
+	if (samples > 1 && samples < MIN_AA_SAMPLES) {
+		samples = samples - 1 < MIN_AA_SAMPLES - samples ? 1 : MIN_AA_SAMPLES;
+		slider->value(samples);
+	}
+	((TraceUI*)(o->user_data()))->m_nAASamples = samples;
+}
+
+void TraceUI::cb_aaThreshSlides(Fl_Widget* o, void* v)
+{
+	((TraceUI*)(o->user_data()))->m_nAAThresh = double(((Fl_Slider *)o)->value());
+}
+
+// The image is rendered unclamped, so a new exposure only needs the
+// pixels mapped again, once any render is over.
+void TraceUI::cb_exposureSlides(Fl_Widget* o, void* v)
 {
-	char buffer[256];
+	TraceUI* pUI=(TraceUI*)(o->user_data());
+
+	pUI->m_nExposure = double(((Fl_Slider *)o)->value());
+	if (!pUI->m_rendering) {
+		pUI->raytracer->setToneMap(pUI->getToneMap());
+		pUI->raytracer->applyToneMap();
+		pUI->m_traceGlWindow->refresh();
+	}
+}
 
+void TraceUI::cb_lightCutoffSlides(Fl_Widget* o, void* v)
+{
+	((TraceUI*)(o->user_data()))->m_nLightCutoff = double(((Fl_Slider *)o)->value());
+}
+
+void TraceUI::cb_render(Fl_Widget* o, void* v)
+{
 	TraceUI* pUI=((TraceUI*)(o->user_data()));
 	
 	if (pUI->raytracer->sceneLoaded()) {
+		pUI->stopRender();
+
 		int width=pUI->getSize();
 		int	height = (int)(width / pUI->raytracer->aspectRatio() + 0.5);
 		pUI->m_traceGlWindow->resizeWindow( width, height );
 
 		pUI->m_traceGlWindow->show();
 
+		pUI->raytracer->setOptions(pUI->getRenderOptions());
+		pUI->raytracer->setToneMap(pUI->getToneMap());
 		pUI->raytracer->traceSetup(width, height);
-		
-		// Save the window label
-		const char *old_label = pUI->m_traceGlWindow->label();
-
-		// start to render here	
-		done=false;
-		clock_t prev, now;
-		prev=clock();
-		
-		pUI->m_traceGlWindow->refresh();
-		Fl::check();
-		Fl::flush();
-
-		for (int y=0; y<height; y++) {
-			for (int x=0; x<width; x++) {
-				if (done) break;
-				
-				// current time
-				now = clock();
-
-				// check event every 1/2 second
-				if (((double)(now-prev)/CLOCKS_PER_SEC)>0.5) {
-					prev=now;
-
-					if (Fl::ready()) {
-						// refresh
-						pUI->m_traceGlWindow->refresh();
-						// check event
-						Fl::check();
-
-						if (Fl::damage()) {
-							Fl::flush();
-						}
-					}
-				}
-
-				pUI->raytracer->tracePixel( x, y );
-		
-			}
-			if (done) break;
-
-			// flush when finish a row
-			if (Fl::ready()) {
-				// refresh
-				pUI->m_traceGlWindow->refresh();
-
-				if (Fl::damage()) {
-					Fl::flush();
-				}
-			}
-			// update the window label
-			sprintf(buffer, "(%d%%) %s", (int)((double)y / (double)height * 100.0), old_label);
-			pUI->m_traceGlWindow->label(buffer);
-			
-		}
-		done=true;
-		pUI->m_traceGlWindow->refresh();
 
-		// Restore the window label
-		pUI->m_traceGlWindow->label(old_label);		
+		pUI->startRender();
 	}
 }
 
 void TraceUI::cb_stop(Fl_Widget* o, void* v)
 {
-	done=true;
+	((TraceUI*)(o->user_data()))->stopRender();
+}
+
+// Start rendering progressively in the background: coarse blocks first,
+// then finer ones down to single pixels, on every core.
+void TraceUI::startRender()
+{
+	m_windowLabel = m_traceGlWindow->label();
+	m_renderDone = false;
+	m_rendering = true;
+
+	RayTracer *tracer = raytracer;
+	std::atomic<bool> *done = &m_renderDone;
+	m_renderThread = std::thread( [tracer, done]() {
+		tracer->traceProgressive();
+		*done = true;
+	} );
+
+	m_traceGlWindow->refresh();
+	Fl::add_timeout(REDRAW_INTERVAL, cb_renderTimer, this);
+}
+
+// Cancel the render, if there is one, and wait for it to wind down, which
+// takes no longer than the tiles in progress.
+void TraceUI::stopRender()
+{
+	if (!m_rendering)
+		return;
+
+	raytracer->stop();
+	finishRender();
+}
+
+void TraceUI::finishRender()
+{
+	Fl::remove_timeout(cb_renderTimer, this);
+	m_renderThread.join();
+	m_rendering = false;
+
+	// the exposure may have moved while it rendered
+	raytracer->setToneMap(getToneMap());
+	raytracer->applyToneMap();
+
+	m_traceGlWindow->label(m_windowLabel);
+	m_traceGlWindow->refresh();
+}
+
+// While the render runs, the redraws it asks for read the image as the
+// workers write it, without a lock.  That is accepted: each pixel is three
+// bytes written once per pass, so the worst a redraw can show is a pixel
+// half updated, and the next redraw, or the last one after the workers
+// have been joined, shows it whole.
+void TraceUI::cb_renderTimer(void* v)
+{
+	TraceUI* pUI=(TraceUI*)v;
+
+	if (pUI->m_renderDone) {
+		pUI->finishRender();
+		return;
+	}
+
+	// show what there is so far
+	sprintf(pUI->m_progressLabel, "(%d%%) %s",
+		(int)(pUI->raytracer->getProgress() * 100.0), pUI->m_windowLabel);
+	pUI->m_traceGlWindow->label(pUI->m_progressLabel);
+	pUI->m_traceGlWindow->refresh();
+
+	Fl::repeat_timeout(REDRAW_INTERVAL, cb_renderTimer, v);
 }
 
 void TraceUI::show()
@@ -220,6 +274,28 @@ int TraceUI::getDepth()
 	return m_nDepth;
 }
 
+RenderOptions TraceUI::getRenderOptions() const
+{
+	RenderOptions options;
+	options.depth = m_nDepth;
+	options.threshold = m_nIntThresh;
+	options.constAtten = m_nConAtn;
+	options.linearAtten = m_nLinAtn;
+	options.quadAtten = m_nQuadAtn;
+	options.aaSamples = m_nAASamples;
+	options.aaThreshold = m_nAAThresh;
+	options.lightCutoff = m_nLightCutoff;
+	options.hdr = true;
+	return options;
+}
+
+ToneMap TraceUI::getToneMap() const
+{
+	ToneMap map;
+	map.exposure = m_nExposure;
+	return map;
+}
+
 void TraceUI::cb_load_background_image(Fl_Menu_* o, void* v)
 {
 	TraceUI* pUI = whoami(o);
@@ -227,6 +303,7 @@ void TraceUI::cb_load_background_image(Fl_Menu_* o, void* v)
 	char* newfile = fl_file_chooser("Open Image?", "*.bmp", NULL);
 	if (newfile != NULL)
 	{
+		pUI->stopRender();
 		pUI->raytracer->loadBackground(newfile);
 	}
 }
@@ -234,6 +311,7 @@ void TraceUI::cb_load_background_image(Fl_Menu_* o, void* v)
 void TraceUI::cb_clear_background_image(Fl_Menu_* o, void* v)
 {
 	TraceUI* pUI = whoami(o);
+	pUI->stopRender();
 	pUI->raytracer->clearBackground();
 }
 
@@ -257,6 +335,9 @@ Fl_Menu_Item TraceUI::menuitems[] = {
 
 TraceUI::TraceUI() {
 	// init.
+	m_rendering = false;
+	m_renderDone = true;
+	m_windowLabel = NULL;
 	m_nDepth = 5;
 	m_nSize = 300;
 	m_nConAtn = 0.0;
@@ -264,7 +345,11 @@ TraceUI::TraceUI() {
 	m_nQuadAtn = 0.0;
 	m_nAmbLight = 1.0;
 	m_nIntThresh = 0.15;
-	m_mainWindow = new Fl_Window(100, 40, 400, 250, "Ray <Not Loaded>");
+	m_nAASamples = 1;
+	m_nAAThresh = 0.1;
+	m_nExposure = 0.0;
+	m_nLightCutoff = 0.0;
+	m_mainWindow = new Fl_Window(100, 40, 400, 325, "Ray <Not Loaded>");
 		m_mainWindow->user_data((void*)(this));	// record self to be used by static callback functions
 		// install menu bar
 		m_menubar = new Fl_Menu_Bar(0, 0, 400, 25);
@@ -361,6 +446,58 @@ TraceUI::TraceUI() {
 		m_intThreshSlider->align(FL_ALIGN_RIGHT);
 		m_intThreshSlider->callback(cb_intThershSlides);
 
+		// install slider aa samples	8
+		m_aaSamplesSlider = new Fl_Value_Slider(10, 205, 180, 20, "AA Samples (1 = off)");
+		m_aaSamplesSlider->user_data((void*)(this));	// record self to be used by static callback functions
+		m_aaSamplesSlider->type(FL_HOR_NICE_SLIDER);
+		m_aaSamplesSlider->labelfont(FL_COURIER);
+		m_aaSamplesSlider->labelsize(12);
+		m_aaSamplesSlider->minimum(1);
+		m_aaSamplesSlider->maximum(MAX_AA_SAMPLES);
+		m_aaSamplesSlider->step(1);
+		m_aaSamplesSlider->value(m_nAASamples);
+		m_aaSamplesSlider->align(FL_ALIGN_RIGHT);
+		m_aaSamplesSlider->callback(cb_aaSamplesSlides);
+
+		// install slider aa threshold	9
+		m_aaThreshSlider = new Fl_Value_Slider(10, 230, 180, 20, "AA Threshold");
+		m_aaThreshSlider->user_data((void*)(this));	// record self to be used by static callback functions
+		m_aaThreshSlider->type(FL_HOR_NICE_SLIDER);
+		m_aaThreshSlider->labelfont(FL_COURIER);
+		m_aaThreshSlider->labelsize(12);
+		m_aaThreshSlider->minimum(0);
+		m_aaThreshSlider->maximum(1);
+		m_aaThreshSlider->step(0.01);
+		m_aaThreshSlider->value(m_nAAThresh);
+		m_aaThreshSlider->align(FL_ALIGN_RIGHT);
+		m_aaThreshSlider->callback(cb_aaThreshSlides);
+
+		// install slider exposure	10
+		m_exposureSlider = new Fl_Value_Slider(10, 255, 180, 20, "Exposure (stops)");
+		m_exposureSlider->user_data((void*)(this));	// record self to be used by static callback functions
+		m_exposureSlider->type(FL_HOR_NICE_SLIDER);
+		m_exposureSlider->labelfont(FL_COURIER);
+		m_exposureSlider->labelsize(12);
+		m_exposureSlider->minimum(-4);
+		m_exposureSlider->maximum(4);
+		m_exposureSlider->step(0.1);
+		m_exposureSlider->value(m_nExposure);
+		m_exposureSlider->align(FL_ALIGN_RIGHT);
+		m_exposureSlider->callback(cb_exposureSlides);
+
+		// install slider light cutoff	11
+		m_lightCutoffSlider = new Fl_Value_Slider(10, 280, 180, 20, "Light Cutoff");
+		m_lightCutoffSlider->user_data((void*)(this));	// record self to be used by static callback functions
+		m_lightCutoffSlider->type(FL_HOR_NICE_SLIDER);
+		m_lightCutoffSlider->labelfont(FL_COURIER);
+		m_lightCutoffSlider->labelsize(12);
+		m_lightCutoffSlider->minimum(0);
+		m_lightCutoffSlider->maximum(0.1);
+		m_lightCutoffSlider->step(0.001);
+		m_lightCutoffSlider->value(m_nLightCutoff);
+		m_lightCutoffSlider->align(FL_ALIGN_RIGHT);
+		m_lightCutoffSlider->callback(cb_lightCutoffSlides);
+
 		m_renderButton = new Fl_Button(240, 27, 70, 25, "&Render");
 		m_renderButton->user_data((void*)(this));
 		m_renderButton->callback(cb_render);
@@ -377,4 +514,10 @@ TraceUI::TraceUI() {
 	m_traceGlWindow = new TraceGLWindow(100, 150, m_nSize, m_nSize, "Rendered Image");
 	m_traceGlWindow->end();
 	m_traceGlWindow->resizable(m_traceGlWindow);
-}
\ No newline at end of file
+}
+
+// A render still going would be left with a thread that was never joined.
+TraceUI::~TraceUI()
+{
+	stopRender();
+}
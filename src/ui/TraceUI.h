@@ -16,11 +16,15 @@
 
 #include <FL/fl_file_chooser.H>		// FLTK file chooser
 
+#include <atomic>
+#include <thread>
+
 #include "TraceGLWindow.h"
 
 class TraceUI {
 public:
 	TraceUI();
+	~TraceUI();
 
 	// The FLTK widgets
 	Fl_Window*			m_mainWindow;
@@ -33,6 +37,10 @@ public:
 	Fl_Slider*			m_quadAttenSlider;
 	Fl_Slider*			m_ambLightSlider;
 	Fl_Slider*			m_intThreshSlider;
+	Fl_Slider*			m_aaSamplesSlider;
+	Fl_Slider*			m_aaThreshSlider;
+	Fl_Slider*			m_exposureSlider;
+	Fl_Slider*			m_lightCutoffSlider;
 
 	Fl_Button*			m_renderButton;
 	Fl_Button*			m_stopButton;
@@ -60,10 +68,27 @@ public:
 		return m_nQuadAtn;
 	}
 
+	// the render settings the sliders are at
+	RenderOptions getRenderOptions() const;
+	ToneMap getToneMap() const;
+
 
 private:
 	RayTracer*	raytracer;
 
+	// The render runs on m_renderThread while the UI keeps handling
+	// events; a timer redraws the image and notices when it's finished.
+	std::thread			m_renderThread;
+	std::atomic<bool>	m_renderDone;
+	bool				m_rendering;
+	const char*			m_windowLabel;		// the image window's label before the render
+	char				m_progressLabel[256];
+
+	void		startRender();
+	void		stopRender();
+	void		finishRender();
+	static void	cb_renderTimer(void* v);
+
 	int			m_nSize;
 	int			m_nDepth;
 	double		m_nConAtn;
@@ -71,6 +96,10 @@ private:
 	double		m_nQuadAtn;
 	double		m_nAmbLight;
 	double		m_nIntThresh;
+	int			m_nAASamples;
+	double		m_nAAThresh;
+	double		m_nExposure;
+	double		m_nLightCutoff;
 
 // static class members
 	static Fl_Menu_Item menuitems[];
@@ -91,6 +120,10 @@ private:
 	static void cb_quadAtnSlides(Fl_Widget* o, void* v);
 	static void cb_ambLightSlides(Fl_Widget* o, void* v);
 	static void cb_intThershSlides(Fl_Widget* o, void* v);
+	static void cb_aaSamplesSlides(Fl_Widget* o, void* v);
+	static void cb_aaThreshSlides(Fl_Widget* o, void* v);
+	static void cb_exposureSlides(Fl_Widget* o, void* v);
+	static void cb_lightCutoffSlides(Fl_Widget* o, void* v);
 	static void cb_load_background_image(Fl_Menu_* o, void* v);
 	static void cb_clear_background_image(Fl_Menu_* o, void* v);
 
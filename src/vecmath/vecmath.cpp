@@ -9,10 +9,11 @@
 
 #include "vecmath.h"
 
-mat3f mat3f::inverse() const	    // Gauss-Jordan elimination with partial pivoting
+template <class T>
+mat3t<T> mat3t<T>::inverse() const	    // Gauss-Jordan elimination with partial pivoting
 {
-	mat3f a(*this);				// As a evolves from original mat into identity
-	mat3f b; 					// b evolves from identity into inverse(a)
+	mat3t a(*this);				// As a evolves from original mat into identity
+	mat3t b; 					// b evolves from identity into inverse(a)
 	int	 i, j, i1;
 
 	// Loop over cols of a from left to right, eliminating above and below diag
@@ -43,10 +44,11 @@ mat3f mat3f::inverse() const	    // Gauss-Jordan elimination with partial pivoti
 	return b;
 }
 
-mat4f mat4f::inverse() const	    // Gauss-Jordan elimination with partial pivoting
+template <class T>
+mat4t<T> mat4t<T>::inverse() const	    // Gauss-Jordan elimination with partial pivoting
 {
-	mat4f a(*this);				// As a evolves from original mat into identity
-	mat4f b;   					// b evolves from identity into inverse(a)
+	mat4t a(*this);				// As a evolves from original mat into identity
+	mat4t b;   					// b evolves from identity into inverse(a)
 	int i, j, i1;
 
 	// Loop over cols of a from left to right, eliminating above and below diag
@@ -76,3 +78,8 @@ mat4f mat4f::inverse() const	    // Gauss-Jordan elimination with partial pivoti
 	}
 	return b;
 }
+
+template class mat3t<float>;
+template class mat3t<double>;
+template class mat4t<float>;
+template class mat4t<double>;